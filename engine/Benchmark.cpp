@@ -0,0 +1,238 @@
+#include <iostream>
+#include <random>
+#include <cstdlib>
+#include "Version.h"
+#include "Index.h"
+
+using namespace std;
+
+// 并发控制的竞争基准：比较加锁模式（repeatableRead，删除经过LockTable）与乐观模式（optimistic，提交时验证）
+// 表中有keyNumber个逻辑键，每个键当前版本的uid存放在keys中；每个事务读readNumber个随机键，再更新writeNumber个随机键（删除旧版本并插入新版本），提交后发布新版本的uid
+// 键越少，竞争越激烈。读到已被他人更新的版本、死锁、等待超时、写冲突和验证失败都使事务撤销并重试
+// 之后对并发B-link树做一次正确性检查（见indexCheck）
+// 用法：benchmark [线程数] [每个线程提交的事务数] [每个线程插入的索引项数]，需要在空目录中运行（会创建.db、.log和.xid）
+
+static const int readNumber=4;
+static const int writeNumber=2;
+static const int payloadSize=64;
+
+struct Result{
+    long long commits=0;
+    long long aborts=0;
+    double seconds=0;
+};
+
+static std::vector<char> payload(long long key,long long version){
+    std::vector<char> data(payloadSize,0);
+    std::copy(reinterpret_cast<char*>(&key),reinterpret_cast<char*>(&key)+sizeof(key),data.begin());
+    std::copy(reinterpret_cast<char*>(&version),reinterpret_cast<char*>(&version)+sizeof(version),data.begin()+sizeof(key));
+    return data;
+}
+
+// 执行一个事务，成功提交返回true，需要重试返回false
+static bool transaction(int level,std::vector<std::atomic<long long>>& keys,std::mt19937_64& random,long long version){
+    std::shared_ptr<VersionManager> vm=VersionManager::instance();
+    std::uniform_int_distribution<int> pick(0,keys.size()-1);
+    long long xid=vm->begin(level);
+    int written[writeNumber];
+    long long inserted[writeNumber];
+    std::vector<char> data;
+    try{
+        for(int i=0;i<readNumber;i++){
+            if(!vm->read(xid,keys[pick(random)].load(),data)){
+                // 读到的版本已被其他事务更新
+                vm->abort(xid);
+                return false;
+            }
+        }
+        for(int i=0;i<writeNumber;i++){
+            // 同一个事务不重复更新一个键
+            int key;
+            bool repeated;
+            do{
+                key=pick(random);
+                repeated=false;
+                for(int j=0;j<i;j++)repeated=repeated||written[j]==key;
+            }while(repeated);
+            written[i]=key;
+            if(!vm->del(xid,keys[key].load())){
+                vm->abort(xid);
+                return false;
+            }
+            data=payload(key,version);
+            inserted[i]=vm->insert(xid,data);
+        }
+        vm->commit(xid);
+    }catch(const char* e){
+        // 死锁、等待超时、写冲突或验证失败，事务已被自动撤销
+        vm->abort(xid);
+        return false;
+    }
+    for(int i=0;i<writeNumber;i++)keys[written[i]].store(inserted[i]);
+    return true;
+}
+
+static Result run(int level,int keyNumber,int threadNumber,int transactions){
+    std::shared_ptr<VersionManager> vm=VersionManager::instance();
+    std::vector<std::atomic<long long>> keys(keyNumber);
+    long long xid=vm->begin(Transaction::readCommitted);
+    std::vector<std::vector<char>> rows;
+    for(int i=0;i<keyNumber;i++)rows.push_back(payload(i,0));
+    std::vector<long long> uids=vm->bulkInsert(xid,rows);
+    vm->commit(xid);
+    for(int i=0;i<keyNumber;i++)keys[i].store(uids[i]);
+
+    std::atomic<long long> commits{0},aborts{0};
+    auto start=std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for(int i=0;i<threadNumber;i++){
+        threads.emplace_back([&,i]{
+            std::mt19937_64 random(i*7919+level);
+            long long committed=0,aborted=0;
+            while(committed<transactions){
+                if(transaction(level,keys,random,committed+1))committed++;
+                else aborted++;
+            }
+            commits+=committed;
+            aborts+=aborted;
+        });
+    }
+    for(std::thread& thread:threads)thread.join();
+    Result result;
+    result.commits=commits;
+    result.aborts=aborts;
+    result.seconds=std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+    return result;
+}
+
+// 字符串键：较长的公共前缀加上序号，有的键超出前缀之后8个字节，需要比较Rest
+static std::string stringKey(long long key){
+    static const char* regions[]={"north","south","east","west"};
+    char buffer[Node::maxKeyLength];
+    snprintf(buffer,sizeof(buffer),"customer/%s/%08lld%s",regions[key%4],key,key%3==0?"/priority":"");
+    return buffer;
+}
+
+// 并发B-link树的检查：threadNumber个线程从空树开始并发插入，同时threadNumber个线程查找已经插入完成的项
+// 键有大量重复，会触发根节点分裂的竞争以及重复键在父节点中的定位；每次查找都必须找到已经插入完成的uid
+// 全部插入之后，按键的顺序扫描整棵树，键必须非降序且每个uid恰好出现一次；再逐个查找每个键，返回的项数必须等于插入的个数
+// strings为true时使用字符串键（见stringKey），否则使用整数键
+static bool indexCheck(int threadNumber,int insertions,bool strings){
+    std::shared_ptr<BPlusTree> tree=BPlusTree::load(BPlusTree::create(strings?Node::maxKeyLength:Node::integerKeyLength));
+    const int distinct=insertions/8+1; // 每个键平均重复8*threadNumber次
+    auto keyOf=[&](long long thread,long long i){return (i*7919+thread*31)%distinct;};
+    auto bytesOf=[&](long long key){return strings?stringKey(key):Node::normalize(key);}; // 键的规范化形式
+    auto uidOf=[&](long long thread,long long i){return thread*insertions+i+1;};
+    std::vector<std::atomic<int>> progress(threadNumber); // 每个插入线程已经插入完成的项数
+    for(std::atomic<int>& p:progress)p.store(0);
+    std::atomic<int> writing{threadNumber};
+    std::atomic<long long> searches{0},misses{0};
+    std::atomic<bool> failed{false};
+    auto start=std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for(int t=0;t<threadNumber;t++){
+        threads.emplace_back([&,t]{
+            try{
+                for(int i=0;i<insertions;i++){
+                    tree->insert(bytesOf(keyOf(t,i)),uidOf(t,i));
+                    progress[t].store(i+1);
+                }
+            }catch(const char* e){
+                cout<<"index insert failed: "<<e<<endl;
+                failed=true;
+            }
+            writing--;
+        });
+        threads.emplace_back([&,t]{
+            std::mt19937_64 random(t*104729+1);
+            try{
+                while(writing>0){
+                    int writer=random()%threadNumber;
+                    int done=progress[writer].load();
+                    if(done==0)continue;
+                    int i=random()%done;
+                    std::vector<long long> uids=tree->search(bytesOf(keyOf(writer,i)));
+                    searches++;
+                    if(std::find(uids.begin(),uids.end(),uidOf(writer,i))==uids.end())misses++;
+                }
+            }catch(const char* e){
+                cout<<"index search failed: "<<e<<endl;
+                failed=true;
+            }
+        });
+    }
+    for(std::thread& thread:threads)thread.join();
+    double seconds=std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+    if(failed)return false;
+
+    long long total=(long long)threadNumber*insertions;
+    std::vector<char> seen(total+1,0);
+    std::vector<long long> counts(distinct,0);
+    long long scanned=0;
+    std::string lastKey;
+    bool ordered=true,unique=true;
+    IndexIterator iterator(*tree,std::string(),std::string(Node::maxKeyLength,'\xff'));
+    while(iterator.next()){
+        std::string key=iterator.getKeyBytes();
+        long long uid=iterator.getUid();
+        ordered=ordered&&key>=lastKey;
+        lastKey=key;
+        if(uid<1||uid>total||seen[uid]||bytesOf(keyOf((uid-1)/insertions,(uid-1)%insertions))!=key)unique=false;
+        else seen[uid]=1;
+        scanned++;
+    }
+    for(int t=0;t<threadNumber;t++){
+        for(int i=0;i<insertions;i++)counts[keyOf(t,i)]++;
+    }
+    long long wrongKeys=0;
+    for(int key=0;key<distinct;key++){
+        if((long long)tree->search(bytesOf(key)).size()!=counts[key])wrongKeys++;
+    }
+    cout<<"index ("<<(strings?"string":"integer")<<" keys): "<<total<<" inserts in "<<seconds<<"s, "<<searches<<" concurrent searches, "<<misses<<" misses, scanned "<<scanned
+        <<(ordered?"":" out of order")<<(unique?"":" with wrong or repeated uids")<<", "<<wrongKeys<<" keys with wrong counts"<<endl;
+    return misses==0&&scanned==total&&ordered&&unique&&wrongKeys==0;
+}
+
+int main(int argc,char** argv){
+    int threadNumber=argc>1?atoi(argv[1]):4;
+    int transactions=argc>2?atoi(argv[2]):2000;
+    int insertions=argc>3?atoi(argv[3]):20000;
+    try{
+        TransactionManager::instance()->init();
+        DataManager::instance()->init(1<<26);
+        VersionManager::instance()->init();
+        LockTable::instance()->setWaitTimeout(1000);
+    }catch(const char* e){
+        cout<<"init failed: "<<e<<endl;
+        return 1;
+    }
+    cout<<"threads="<<threadNumber<<" transactions/thread="<<transactions<<" reads="<<readNumber<<" writes="<<writeNumber<<endl;
+    cout<<"keys\tmode\t\tcommits/s\taborts\tabort rate"<<endl;
+    const int keyNumbers[]={16,256,4096,65536};
+    for(int keyNumber:keyNumbers){
+        const int levels[]={Transaction::repeatableRead,Transaction::optimistic};
+        for(int level:levels){
+            try{
+                Result result=run(level,keyNumber,threadNumber,transactions);
+                cout<<keyNumber<<"\t"<<(level==Transaction::optimistic?"optimistic":"locking   ")<<"\t"
+                    <<(long long)(result.commits/result.seconds)<<"\t\t"<<result.aborts<<"\t"
+                    <<(double)result.aborts/(result.commits+result.aborts)<<endl;
+            }catch(const char* e){
+                cout<<keyNumber<<"\tfailed: "<<e<<endl;
+                return 1;
+            }
+        }
+    }
+    try{
+        for(bool strings:{false,true}){
+            if(!indexCheck(threadNumber,insertions,strings)){
+                cout<<"index check failed"<<endl;
+                return 1;
+            }
+        }
+    }catch(const char* e){
+        cout<<"index check failed: "<<e<<endl;
+        return 1;
+    }
+    return 0;
+}
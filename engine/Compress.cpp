@@ -0,0 +1,117 @@
+#include "Compress.h"
+
+int Compressor::bound(int n){
+    return n+n/255+16;
+}
+
+int Compressor::hash(const unsigned char* p){
+    unsigned int v;
+    std::memcpy(&v,p,sizeof(v));
+    return (v*2654435761u)>>(32-hashBits);
+}
+
+bool Compressor::writeLength(unsigned char*& out,unsigned char* end,int length){
+    while(length>=255){
+        if(out>=end)return false;
+        *out++=255;
+        length-=255;
+    }
+    if(out>=end)return false;
+    *out++=(unsigned char)length;
+    return true;
+}
+
+int Compressor::compress(const char* src,int n,char* dst,int capacity){
+    const unsigned char* in=reinterpret_cast<const unsigned char*>(src);
+    unsigned char* out=reinterpret_cast<unsigned char*>(dst);
+    unsigned char* end=out+capacity;
+    int table[1<<hashBits]; // 哈希值到最近一次出现位置的映射
+    for(int& position:table)position=-1;
+
+    int anchor=0; // 尚未输出的字面量的起始位置
+    int i=0;
+    int limit=n-lastLiterals-minMatch; // 之后的字节全部作为字面量
+    while(i<=limit){
+        int h=hash(in+i);
+        int candidate=table[h];
+        table[h]=i;
+        if(candidate<0||i-candidate>maxOffset||std::memcmp(in+candidate,in+i,minMatch)!=0){
+            i++;
+            continue;
+        }
+        // 找到匹配，向后延伸
+        int matchLength=minMatch;
+        while(i+matchLength<n-lastLiterals&&in[candidate+matchLength]==in[i+matchLength])matchLength++;
+        int literalLength=i-anchor;
+        if(out+1+literalLength+2>end)return -1;
+        unsigned char* token=out++;
+        *token=(unsigned char)((literalLength>=15?15:literalLength)<<4);
+        if(literalLength>=15&&!writeLength(out,end,literalLength-15))return -1;
+        if(out+literalLength+2>end)return -1;
+        std::memcpy(out,in+anchor,literalLength);
+        out+=literalLength;
+        int offset=i-candidate;
+        *out++=(unsigned char)(offset&0xff);
+        *out++=(unsigned char)(offset>>8);
+        int extra=matchLength-minMatch;
+        *token|=(unsigned char)(extra>=15?15:extra);
+        if(extra>=15&&!writeLength(out,end,extra-15))return -1;
+        i+=matchLength;
+        anchor=i;
+    }
+    // 最后一个序列只有字面量
+    int literalLength=n-anchor;
+    if(out>=end)return -1;
+    unsigned char* token=out++;
+    *token=(unsigned char)((literalLength>=15?15:literalLength)<<4);
+    if(literalLength>=15&&!writeLength(out,end,literalLength-15))return -1;
+    if(out+literalLength>=end)return -1;
+    if(literalLength>0)std::memcpy(out,in+anchor,literalLength);
+    out+=literalLength;
+    return out-reinterpret_cast<unsigned char*>(dst);
+}
+
+int Compressor::decompress(const char* src,int n,char* dst,int capacity){
+    const unsigned char* in=reinterpret_cast<const unsigned char*>(src);
+    const unsigned char* inEnd=in+n;
+    unsigned char* out=reinterpret_cast<unsigned char*>(dst);
+    unsigned char* begin=out;
+    unsigned char* end=out+capacity;
+    while(in<inEnd){
+        int token=*in++;
+        int literalLength=token>>4;
+        if(literalLength==15){
+            int b;
+            do{
+                if(in>=inEnd)return -1;
+                b=*in++;
+                literalLength+=b;
+            }while(b==255);
+        }
+        if(in+literalLength>inEnd||out+literalLength>end)return -1;
+        std::memcpy(out,in,literalLength);
+        in+=literalLength;
+        out+=literalLength;
+        if(in==inEnd)break; // 最后一个序列
+        if(in+2>inEnd)return -1;
+        int offset=in[0]|(in[1]<<8);
+        in+=2;
+        if(offset==0||offset>out-begin)return -1;
+        int matchLength=(token&15);
+        if(matchLength==15){
+            int b;
+            do{
+                if(in>=inEnd)return -1;
+                b=*in++;
+                matchLength+=b;
+            }while(b==255);
+        }
+        matchLength+=minMatch;
+        if(out+matchLength>end)return -1;
+        // 匹配可能与输出重叠（offset小于匹配长度），逐字节拷贝
+        const unsigned char* match=out-offset;
+        for(int k=0;k<matchLength;k++)out[k]=match[k];
+        out+=matchLength;
+    }
+    return out-begin;
+}
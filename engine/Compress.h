@@ -0,0 +1,27 @@
+#ifndef COMPRESS
+#define COMPRESS
+
+#include <vector>
+#include <cstring>
+
+// LZ系列的页面压缩编码，不依赖外部库
+// 压缩数据由若干序列组成，每个序列为：[Token] [LiteralLength...] [Literals] [Offset] [MatchLength...]
+// Token 1字节，高4位为字面量长度，低4位为匹配长度减4，为15时后面跟若干字节继续累加（遇到不为255的字节结束）
+// Offset 2字节，为匹配位置到当前位置的距离；最后一个序列只有字面量，没有Offset和匹配部分
+class Compressor{
+public:
+    // 压缩src中的n个字节到dst中，返回压缩后的长度；压缩后不小于capacity时返回-1（不值得压缩）
+    static int compress(const char* src,int n,char* dst,int capacity);
+    // 解压src中的n个字节到dst中，返回解压后的长度；数据损坏或超出capacity时返回-1
+    static int decompress(const char* src,int n,char* dst,int capacity);
+    static int bound(int n); // 压缩n个字节最坏情况下需要的空间
+private:
+    static const int minMatch=4; // 最短匹配长度
+    static const int hashBits=12; // 哈希表大小的对数
+    static const int maxOffset=65535; // 最远匹配距离
+    static const int lastLiterals=5; // 末尾至少保留为字面量的字节数
+    static int hash(const unsigned char* p); // 4字节的哈希值
+    static bool writeLength(unsigned char*& out,unsigned char* end,int length); // 写入超出Token部分的长度
+};
+
+#endif
@@ -1,40 +1,69 @@
 #include "Data.h"
 
-DataItem::DataItem(Page* page,std::vector<char>& dataItem,std::vector<char>& oldDataItem,long long uid)
-:page(page),dataItem(dataItem),oldDataItem(oldDataItem),uid(uid)
+DataItem::DataItem(Page* page,short offset,short length,long long uid)
+:page(page),offset(offset),length(length),uid(uid)
 {}
 
+void DataItem::reset(Page* page,short offset,short length,long long uid){
+    this->page=page;
+    this->offset=offset;
+    this->length=length;
+    this->uid=uid;
+}
+
+char* DataItem::raw(){
+    return page->getData()+offset;
+}
+
 void DataItem::setValid(bool valid){
-    dataItem[0]=(valid?0:1);
+    if(valid)raw()[0]&=~invalidFlag;
+    else raw()[0]|=invalidFlag;
 }
 
 bool DataItem::isValid(){
-    return dataItem[0]==0;
+    return (raw()[0]&invalidFlag)==0;
 }
 
 char* DataItem::getData() {
-    return &(dataItem[validFlagLen+dataSizeLen]);
+    return raw()+validFlagLen+dataSizeLen;
+}
+
+void DataItem::rLock(){
+    page->readLatch();
+}
+
+void DataItem::rUnLock(){
+    page->readUnlatch();
 }
 
 void DataItem::before(){
     writeLock.lock();
+    page->writeLatch();
     page->setDirty(true);
-    // 保存前相数据
-    oldDataItem.resize(dataItem.size());
-    std::copy(dataItem.begin(),dataItem.end(),oldDataItem.begin());
+    // 保存前相数据，前相缓冲区只在修改时才分配
+    oldDataItem.assign(raw(),raw()+length);
 }
 
 void DataItem::unBefore(){
     // 用前相数据重做
-    dataItem.resize(oldDataItem.size());
-    std::copy(oldDataItem.begin(),oldDataItem.end(),dataItem.begin());
+    std::copy(oldDataItem.begin(),oldDataItem.end(),raw());
+    page->writeUnlatch();
     writeLock.unlock();
 }
 
-void DataItem::after(long long xid){
-    // 为XID生成日志
-    std::vector<char> log=Recover::updateLog(xid,*this);
-    Logger::instance()->log(log);
+void DataItem::after(long long xid,Arena* arena){
+    // 为XID生成日志；日志落盘前页面一直处于写闩锁下，保证页面不会先于日志被写出
+    int size=Recover::updateLogSize(*this);
+    if(arena!=nullptr){
+        char* log=arena->allocate(size);
+        Recover::updateLog(xid,*this,log);
+        Logger::instance()->log(log,size);
+    }else{
+        std::vector<char> log(size);
+        Recover::updateLog(xid,*this,&(log[0]));
+        Logger::instance()->log(log);
+    }
+    page->writeUnlatch();
     writeLock.unlock();
 }
 
@@ -45,13 +74,14 @@ DataItem* DataItem::parseDataItem(Page* page,short offset){
     std::copy(p+validFlagLen,p+validFlagLen+dataSizeLen,pp);
     short dataItemSize=validFlagLen+dataSizeLen+dataSize;
     long long uid=(page->getPageNumber())<<32|(long long)(offset);
-    std::vector<char> data(p,p+dataItemSize);
-    std::vector<char> oldData(dataItemSize);
-    return new DataItem(page,data,oldData,uid);
+    DataItem* di=ObjectPool<DataItem>::acquire();
+    di->reset(page,offset,dataItemSize,uid);
+    return di;
 }
 
-std::vector<char> DataItem::construct(std::vector<char>& data){
+std::vector<char> DataItem::construct(std::vector<char>& data,bool versioned,bool compressed){
     std::vector<char> dataItem(validFlagLen+dataSizeLen+data.size());
+    dataItem[0]=(versioned?versionedFlag:0)|(compressed?compressFlag:0);
     short size=data.size();
     char* p=reinterpret_cast<char*>(&size);
     std::copy(p,p+dataSizeLen,dataItem.begin()+validFlagLen);
@@ -74,9 +104,17 @@ std::shared_ptr<DataManager> DataManager::instance(){
     return dataManager;
 }
 
-void DataManager::init(long long memory){
+void DataManager::init(long long memory,bool hugePages,FrameArena::NumaPolicy policy){
     bool isCreate= !std::ifstream(".db").good();
-    PageCache::instance()->init(memory);
+    pageCache=PageCache::instance();
+    pageCache->init(memory,hugePages,policy);
+    memoryConsumer=MemoryGovernor::instance()->addConsumer("dataItem");
+    // 页面上第一个DataItem带有压缩标志时压缩页面；在恢复之前注册，恢复时写回的页面也按标志压缩
+    pageCache->setCompressionPolicy([](const char* data){
+        short fso;
+        std::copy(data,data+sizeof(fso),reinterpret_cast<char*>(&fso));
+        return fso>(short)sizeof(short)&&(data[sizeof(short)]&DataItem::compressFlag)!=0;
+    });
     Logger::instance()->init();
     if(isCreate){ // 如果各种文件都是新建的
         initFirstPage();
@@ -102,9 +140,47 @@ DataItem* DataManager::read(long long uid){
     return di;
 }
 
-long long DataManager::insert(long xid,std::vector<char>& data){
-    std::vector<char> dataItem=DataItem::construct(data);
-    Page* page;
+void DataManager::readMany(const std::vector<long long>& uids,ReadBatch& result,bool versioned){
+    int n=uids.size();
+    result.buffer.clear();
+    result.offsets.assign(n,0);
+    result.lengths.assign(n,-1);
+    // uid的高32位是页号，按uid排序即按页号、页内偏移排序
+    std::vector<std::pair<long long,int>> order(n);
+    for(int i=0;i<n;i++)order[i]={uids[i],i};
+    std::sort(order.begin(),order.end());
+    int i=0;
+    while(i<n){
+        long long pageNumber=order[i].first>>32;
+        int j=i;
+        while(j<n&&(order[j].first>>32)==pageNumber)j++;
+        Page* page=PageCache::instance()->get(pageNumber);
+        page->readLatch();
+        int end=PageManager::getFSO(page); // 页面中已使用部分的末尾
+        for(int k=i;k<j;k++){
+            int offset=order[k].first&((1ll<<16)-1);
+            // uid可能来自过时的索引项，偏移落在页首的FSO中、或数据项越出页面中已使用的部分时视为不存在
+            if(offset<(int)sizeof(short)||offset+DataItem::validFlagLen+DataItem::dataSizeLen>end)continue;
+            char* p=page->getData()+offset;
+            if((p[0]&DataItem::invalidFlag)!=0)continue;
+            if(versioned&&(p[0]&DataItem::versionedFlag)==0)continue;
+            short dataSize=0;
+            std::copy(p+DataItem::validFlagLen,p+DataItem::validFlagLen+DataItem::dataSizeLen,reinterpret_cast<char*>(&dataSize));
+            if(dataSize<0||offset+DataItem::validFlagLen+DataItem::dataSizeLen+dataSize>end)continue;
+            char* data=p+DataItem::validFlagLen+DataItem::dataSizeLen;
+            result.offsets[order[k].second]=result.buffer.size();
+            result.lengths[order[k].second]=dataSize;
+            result.buffer.insert(result.buffer.end(),data,data+dataSize);
+        }
+        page->readUnlatch();
+        PageCache::instance()->release(pageNumber);
+        i=j;
+    }
+}
+
+long long DataManager::insert(long xid,std::vector<char>& data,bool versioned,bool compressed){
+    std::vector<char> dataItem=DataItem::construct(data,versioned,compressed);
+    Page* page=nullptr;
     for(int i=0; i<10;i ++){
         PageInfo pi=PageIndex::instance()->select(dataItem.size());
         if(pi.pageNumber>0){
@@ -119,14 +195,42 @@ long long DataManager::insert(long xid,std::vector<char>& data){
             PageIndex::instance()->add(newPageNumber,PageManager::getFreeSpaceSize(&newPage));
         }
     }
+    if(page==nullptr)throw "database is busy";
     // 记录一条insert日志
     std::vector<char> log=Recover::insertLog(xid,page,dataItem);
     Logger::instance()->log(log);
 
-    short offset=PageManager::insertData(page,dataItem);
-    PageIndex::instance()->add(pi.pageNumber,PageManager::getFreeSpaceSize(page));
-    PageCache::instance()->release(page->getPageNumber());
-    return (page->getPageNumber())<<32|(long long)(offset);
+    long long pageNumber=page->getPageNumber();
+    short offset=PageManager::getFSO(page); // 数据插入的位置
+    page->writeLatch();
+    PageManager::insertData(page,dataItem);
+    page->writeUnlatch();
+    PageIndex::instance()->add(pageNumber,PageManager::getFreeSpaceSize(page));
+    PageCache::instance()->release(pageNumber);
+    return pageNumber<<32|(long long)(offset);
+}
+
+bool ReadBatch::found(int i){
+    return lengths[i]>=0;
+}
+
+char* ReadBatch::data(int i){
+    return buffer.data()+offsets[i];
+}
+
+int ReadBatch::length(int i){
+    return lengths[i];
+}
+
+std::vector<long long> DataManager::bulkInsert(long long xid,std::vector<std::vector<char>>& rows,bool versioned){
+    std::vector<long long> uids;
+    uids.reserve(rows.size());
+    BulkInserter inserter(xid,versioned);
+    for(auto& row:rows){
+        uids.push_back(inserter.append(row));
+    }
+    inserter.finish();
+    return uids;
 }
 
 void DataManager::initFirstPage(){
@@ -150,11 +254,17 @@ bool DataManager::loadFirstPage(){
 void DataManager::initPageIndex(){
     PageIndex::instance()->init();
     int pageNumbers=PageCache::instance()->getPageNumbers();
+    PageCache::instance()->scanHint(2,pageNumbers); // 顺序读取所有页面，提示PageCache预读
     for(int i=2;i<=pageNumbers;i++){
         Page* page=PageCache::instance()->get(i);
+        if(!PageManager::isInitialized(page)){
+            // 批量插入预留了页号但在写出之前崩溃，该页全为0
+            PageManager::initPage(page);
+        }
         PageIndex::instance()->add(page->getPageNumber(),PageManager::getFreeSpaceSize(page));
         PageCache::instance()->release(i);
     }
+    PageCache::instance()->clearScanHint(2,pageNumbers);
 }
 
 DataItem* DataManager::get(long long uid){
@@ -174,21 +284,31 @@ DataItem* DataManager::get(long long uid){
             resourceLock.unlock();
             return data;
         }
-        if(count==maxItemNumber){
-            // 如果缓存已满则抛出异常
-            resourceLock.unlock();
-            throw "cache is full!";
-        }
-        // 如果该数据项没有正被获取，且没有在缓存中，且缓存未满；则将该资源加入到缓存中
-        count++;
+        // 如果该数据项没有正被获取，且没有在缓存中；则将该资源加入到缓存中
         getting.insert(std::pair<long long,bool>(uid,true));
         resourceLock.unlock();
         break;
     }
 
-    DataItem* data=getForCache(uid);
+    // 向MemoryGovernor申请内存，预算不足时会请求其他缓存释放内存，仍然不足则抛出异常
+    if(!MemoryGovernor::instance()->reserve(memoryConsumer,sizeof(DataItem))){
+        std::unique_lock<std::mutex> lock(resourceLock);
+        getting.erase(uid);
+        throw "cache is full!";
+    }
+
+    DataItem* data=nullptr;
+    try{
+        data=getForCache(uid);
+    }catch(const char* e){
+        MemoryGovernor::instance()->release(memoryConsumer,sizeof(DataItem));
+        std::unique_lock<std::mutex> lock(resourceLock);
+        getting.erase(uid);
+        throw;
+    }
     std::unique_lock<std::mutex> lock(resourceLock);
     getting.erase(uid);
+    count++;
     cache.insert(std::pair<long long,DataItem*>(uid,data));
     references.insert(std::pair<long long,int>(uid,1));
     return data;
@@ -206,13 +326,16 @@ void DataManager::release(long long uid){
         references.erase(uid);
         cache.erase(uid);
         count--;
+        MemoryGovernor::instance()->release(memoryConsumer,sizeof(DataItem));
     }
 }
 
 DataManager::~DataManager(){
-    Page* page=PageCache::instance()->get(1);
+    // 进程退出时静态对象的析构顺序不确定，PageCache的单例可能已经析构，使用自己持有的引用
+    if(pageCache==nullptr)return;
+    Page* page=pageCache->get(1);
     PageManager::close(page);
-    PageCache::instance()->release(1);
+    pageCache->release(1);
 }
 
 DataItem* DataManager::getForCache(long long uid){
@@ -225,4 +348,124 @@ DataItem* DataManager::getForCache(long long uid){
 
 void DataManager::releaseForCache(DataItem* di){
     PageCache::instance()->release(di->page->getPageNumber());
-}
\ No newline at end of file
+    ObjectPool<DataItem>::release(di);
+}
+
+BulkInserter::BulkInserter(long long xid,bool versioned):xid(xid),versioned(versioned){
+}
+
+BulkInserter::~BulkInserter(){
+    // finish需要由使用者显式调用；析构时还没有写出的批次是出错后放弃的，直接丢弃，不能在析构中做I/O和抛出异常
+    // 已经记录的页面日志在恢复时按其事务的状态重做或撤销；丢弃的页面不登记到PageIndex，不会被分配出去
+}
+
+long long BulkInserter::append(std::vector<char>& data){
+    std::vector<char> dataItem=DataItem::construct(data,versioned);
+    ensureRoom(dataItem.size());
+    short offset=getFSO(current);
+    std::copy(dataItem.begin(),dataItem.end(),pageData(current)+offset);
+    setFSO(current,offset+dataItem.size());
+    return (firstPageNumber+current)<<32|(long long)(offset);
+}
+
+long long BulkInserter::nextUid(int dataSize,int skip){
+    int itemSize=DataItem::validFlagLen+DataItem::dataSizeLen+dataSize;
+    ensureRoom(itemSize);
+    // 按ensureRoom的规则模拟之后skip条数据的放置
+    int pageSize=PageCache::getPageSize();
+    int index=current;
+    int offset=getFSO(current);
+    for(int i=0;i<skip;i++){
+        offset+=itemSize;
+        if(offset+itemSize>pageSize){
+            index++;
+            offset=sizeof(short);
+        }
+    }
+    if(index<reserved)return (firstPageNumber+index)<<32|(long long)(offset);
+    // 落在下一批中，下一批的页号需要现在就确定
+    if(aheadPageNumber==0){
+        aheadPages=nextBatchPages;
+        if(nextBatchPages<maxBatchPages)nextBatchPages*=2;
+        aheadPageNumber=PageCache::instance()->reservePages(aheadPages);
+    }
+    if(index-reserved>=aheadPages)throw "bulk insert lookahead is too far";
+    return (aheadPageNumber+index-reserved)<<32|(long long)(offset);
+}
+
+void BulkInserter::finish(){
+    if(current>=0){
+        sealPage();
+        writeBatch();
+    }
+    if(aheadPageNumber!=0){
+        // 提前预留但没有用到的一批页面，作为空页面写出
+        reserveBatch();
+        writeBatch();
+    }
+}
+
+void BulkInserter::ensureRoom(int itemSize){
+    int pageSize=PageCache::getPageSize();
+    if(itemSize>pageSize-(int)sizeof(short))throw "data is too large";
+    if(current>=0&&getFSO(current)+itemSize<=pageSize)return;
+    if(current>=0){
+        sealPage();
+        current++;
+        if(current<reserved)return;
+        writeBatch();
+    }
+    reserveBatch();
+}
+
+void BulkInserter::reserveBatch(){
+    int pageSize=PageCache::getPageSize();
+    if(aheadPageNumber!=0){
+        // 使用nextUid提前预留的页面
+        reserved=aheadPages;
+        firstPageNumber=aheadPageNumber;
+        aheadPageNumber=0;
+        aheadPages=0;
+    }else{
+        reserved=nextBatchPages;
+        if(nextBatchPages<maxBatchPages)nextBatchPages*=2;
+        firstPageNumber=PageCache::instance()->reservePages(reserved);
+    }
+    batch.assign((long long)reserved*pageSize,0);
+    for(int i=0;i<reserved;i++){
+        setFSO(i,sizeof(short));
+    }
+    current=0;
+}
+
+void BulkInserter::sealPage(){
+    short fso=getFSO(current);
+    if(fso<=(short)sizeof(short))return; // 空页面不需要日志
+    std::vector<char> log=Recover::pageLog(xid,firstPageNumber+current,pageData(current),fso);
+    Logger::instance()->log(log);
+}
+
+void BulkInserter::writeBatch(){
+    // 这一批所有页面的日志都已经落盘，可以写出页面；未用到的预留页面也作为空页面写出
+    PageCache::instance()->writePages(firstPageNumber,&(batch[0]),reserved);
+    for(int i=0;i<reserved;i++){
+        PageIndex::instance()->add(firstPageNumber+i,PageCache::getPageSize()-getFSO(i));
+    }
+    current=-1;
+    reserved=0;
+}
+
+char* BulkInserter::pageData(int index){
+    return &(batch[(long long)index*PageCache::getPageSize()]);
+}
+
+short BulkInserter::getFSO(int index){
+    short offset=0;
+    std::copy(pageData(index),pageData(index)+sizeof(short),reinterpret_cast<char*>(&offset));
+    return offset;
+}
+
+void BulkInserter::setFSO(int index,short offset){
+    char* p=reinterpret_cast<char*>(&offset);
+    std::copy(p,p+sizeof(short),pageData(index));
+}
@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <mutex>
+#include <algorithm>
 #include "Page.h"
 #include "Recover.h"
 #include "Version.h"
@@ -13,41 +14,66 @@ class Entry;
 
 class DataManager;
 class VersionManager;
-// DataItem 结构：[ValidFlag] [DataSize] [Data]，其中ValidFlag 1字节，0为有效，1为无效；DataSize  2字节，标识Data的长度
+// DataItem 是页面上一段数据的视图（页面、页内偏移、长度），读写都直接作用在缓存的页面上，不拷贝数据；在DataItem存活期间，其所在页面一直被引用
+// DataItem 结构：[ValidFlag] [DataSize] [Data]，其中ValidFlag 1字节，最低位为0表示有效，为1表示无效；次低位为1表示Data是VM的Entry（带有XCRT/XDEL头部）；第三位为1表示所在页面写回时压缩（只对页面上的第一个DataItem有意义）；DataSize  2字节，标识Data的长度
 class DataItem {
 public:
     friend class DataManager;
     friend class Recover;
     friend class Entry;
     friend class VersionManager;
-    DataItem(Page* page,std::vector<char>& dataItem,std::vector<char>& oldDataItem,long long uid);
+    friend class BulkInserter;
+    friend class PaxBlock;
+    friend class TableManager;
+    DataItem()=default; // 供对象池使用，取出后需调用reset
+    DataItem(Page* page,short offset,short length,long long uid);
+    void reset(Page* page,short offset,short length,long long uid); // 复用一个DataItem对象，保留前相缓冲区的容量
     void setValid(bool valid); // 设置DataItem的有效位
     bool isValid(); // 判断DataItem是否有效（是否被删除）
     char* getData(); // 获取数据
-    void before(); // 修改DataItem数据前要调用的方法
+    void rLock(); // 读取数据前加读闩锁（页面读闩锁）
+    void rUnLock();
+    void before(); // 修改DataItem数据前要调用的方法，持有写锁和页面写闩锁直到after()或unBefore()
     void unBefore(); // 撤销修改需要调用的方法
-    void after(long long xid); // 修改DataItem数据后要调用的方法
+    void after(long long xid,Arena* arena=nullptr); // 修改DataItem数据后要调用的方法；给出arena时日志记录在其中构造
     static DataItem* parseDataItem(Page* page,short offset); // 从页面的offset处解析并构造DataItem
-    static std::vector<char> construct(std::vector<char>& data); // 从真正的数据构造出DataItem要求的数据格式
+    static std::vector<char> construct(std::vector<char>& data,bool versioned=false,bool compressed=false); // 从真正的数据构造出DataItem要求的数据格式，versioned表示数据是否为Entry，compressed表示设置压缩标志位
 private:
+    static const char invalidFlag=1; // 无效标志位
+    static const char versionedFlag=2; // Entry标志位
+    static const char compressFlag=4; // 页面压缩标志位，例如压缩表的PAX块；标志随插入日志重做，崩溃恢复时写回的页面也能压缩
     static const int validFlagLen=sizeof(char); // 有效位长度
     static const int dataSizeLen=sizeof(short); // 数据位长度
-    std::vector<char> oldDataItem; // 老数据
-    std::vector<char> dataItem; // 存储的数据；1字节为有效位；2-3字节为长度位；之后的字节是真正承载的数据
+    char* raw(); // DataItem在页面中的起始位置；1字节为有效位；2-3字节为长度位；之后的字节是真正承载的数据
+    std::vector<char> oldDataItem; // 前相数据，只在before()时填充
     Page* page; // 数据所在的页面
+    short offset; // DataItem在页面中的偏移
+    short length; // DataItem的总长度
     long long uid; // DataItem地址
-    std::mutex readLock; // 读锁
     std::mutex writeLock; // 写锁
 };
 
+// 批量读取的结果，与请求的uid按下标一一对应；所有数据拼接在一块连续的缓冲区中
+struct ReadBatch{
+    std::vector<char> buffer; // 所有结果数据依次拼接
+    std::vector<int> offsets; // 第i个uid的数据在buffer中的偏移
+    std::vector<int> lengths; // 第i个uid的数据长度，不存在（无效或不可见）时为-1
+    bool found(int i); // 第i个uid是否存在
+    char* data(int i); // 第i个uid的数据
+    int length(int i); // 第i个uid的数据长度
+};
+
 // DataItem的缓存
 class DataManager{
 public:
     static std::shared_ptr<DataManager> instance(); // 获取DataManager的单例对象
-    void init(long long memory); // 初始化DataManager
+    void init(long long memory,bool hugePages=false,FrameArena::NumaPolicy policy=FrameArena::local); // 初始化DataManager，hugePages和policy决定页帧内存的分配方式
 
     DataItem* read(long long uid); // 根据地址uid读取数据项
-    long long insert(long xid,std::vector<char>& data); // 事务XID插入数据data，并返回插入的DataItem的uid
+    void readMany(const std::vector<long long>& uids,ReadBatch& result,bool versioned=false); // 批量读取数据项：按页分组，每页只获取一次并在一次读闩锁下拷出所有数据；versioned为true时不是Entry的数据项视为不存在
+    void release(long long uid); // 释放一个数据项，如果没有其他使用者引用该数据项，将其从缓存中移除
+    long long insert(long xid,std::vector<char>& data,bool versioned=false,bool compressed=false); // 事务XID插入数据data，并返回插入的DataItem的uid；versioned表示数据是否为Entry；compressed时若数据项是页面上的第一个，页面写回时压缩
+    std::vector<long long> bulkInsert(long long xid,std::vector<std::vector<char>>& rows,bool versioned=false); // 批量插入：数据按顺序填入新页面，每页一条日志，返回每条数据的uid
 
     ~DataManager();
     DataManager(const DataManager&) = delete; // 禁用拷贝构造函数
@@ -58,17 +84,50 @@ private:
     bool loadFirstPage(); // 在打开已有文件时时读入第一个页，并验证正确性
     void initPageIndex(); // 初始化pageIndex
     DataItem* get(long long uid); // 从缓存中获取一个数据项，如果不在缓存中则从PageCache中载入
-    void release(long long uid); // 释放一个数据项，如果没有其他使用者引用该数据项，将其从缓存中移除
     DataItem* getForCache(long long uid); // 根据地址uid读取数据，并包裹成DataItem返回。当键值为key的资源不在缓存中时，资源的获取方式
     void releaseForCache(DataItem* di); // 当资源被逐出缓存时的写入行为
 
     std::unordered_map<long long,DataItem*> cache; // 键值到数据项的映射
     std::unordered_map<long long,int> references; // 键值到该数据项的引用的个数的映射
     std::unordered_map<long long,bool> getting; // 是否有其他进程正在获取该数据项
-    long long maxItemNumber; // 缓存最大可缓存的数据项数
+    int memoryConsumer=-1; // 在MemoryGovernor中的使用者编号，每个缓存的数据项占用sizeof(DataItem)字节
+    std::shared_ptr<PageCache> pageCache; // 持有PageCache，保证析构时关闭第一页还能访问页面缓存
     long long count=0; // 缓存中当前包含的数据项个数
 
     std::mutex resourceLock; // 资源访问互斥锁
 };
 
+// 批量插入器：将数据按顺序填入内存中的新页面，每填满一页记录一条页面日志；页号成批预留，一批页面写满后一次写入文件
+// 数据的uid在追加时即可确定，nextUid可以预知之后第skip+1条数据的uid（例如构造带有兄弟指针的索引节点时）；预知的位置落在下一批时，下一批页面会被提前预留
+class BulkInserter{
+public:
+    BulkInserter(long long xid,bool versioned=false);
+    ~BulkInserter(); // 丢弃没有finish的批次
+    long long append(std::vector<char>& data); // 追加一条数据，返回其uid
+    long long nextUid(int dataSize,int skip=0); // 再追加skip条长度为dataSize的数据之后，下一条长度为dataSize的数据将得到的uid
+    void finish(); // 写出所有尚未写出的页面，并登记到PageIndex；必须显式调用，析构函数不会代为写出
+
+    BulkInserter(const BulkInserter&) = delete; // 禁用拷贝构造函数
+    BulkInserter& operator=(const BulkInserter&) = delete; // 禁用赋值运算符
+private:
+    void ensureRoom(int itemSize); // 保证当前页面能容纳itemSize字节，否则切换到下一个页面
+    void reserveBatch(); // 预留新的一批页面
+    void sealPage(); // 为当前页面记录页面日志
+    void writeBatch(); // 将当前批次的页面一次写入文件
+    char* pageData(int index); // 批次中第index个页面的数据
+    short getFSO(int index);
+    void setFSO(int index,short offset);
+
+    long long xid; // 插入数据的事务
+    bool versioned; // 数据是否为Entry
+    std::vector<char> batch; // 当前批次所有页面的数据，按页连续存放
+    long long firstPageNumber=0; // 当前批次第一个页面的页号
+    int reserved=0; // 当前批次预留的页面数
+    int current=-1; // 正在填充的页面在批次中的下标，-1表示没有批次
+    int nextBatchPages=1; // 下一批预留的页面数，从1开始倍增，避免少量数据占用大量页面
+    long long aheadPageNumber=0; // 被nextUid提前预留的下一批的第一个页号，0表示没有
+    int aheadPages=0; // 提前预留的页面数
+    static const int maxBatchPages=64; // 一批最多预留的页面数
+};
+
 #endif
\ No newline at end of file
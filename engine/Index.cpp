@@ -1 +1,1079 @@
 #include "Index.h"
+
+#if defined(__x86_64__)||defined(__i386__)
+bool Node::simd=__builtin_cpu_supports("avx2");
+#else
+bool Node::simd=false;
+#endif
+
+int Node::areaSize(int keyLength){
+    int rest=keyLength>integerKeyLength?keyLength-integerKeyLength:0;
+    return 2*keyLength+balance*rest;
+}
+
+int Node::nodeSize(int keyLength){
+    return headerSize+capacity*entrySize+areaSize(keyLength);
+}
+
+std::string Node::normalize(long long key){
+    // 翻转符号位后按大端序排列，无符号字节的字典序与有符号整数的大小顺序一致
+    unsigned long long u=(unsigned long long)key^(1ull<<63);
+    std::string bytes(integerKeyLength,0);
+    for(int i=0;i<integerKeyLength;i++)bytes[i]=(char)(u>>(56-8*i));
+    return bytes;
+}
+
+long long Node::denormalize(const std::string& key){
+    if(key.size()!=integerKeyLength)throw "index key is not an integer";
+    unsigned long long u=0;
+    for(int i=0;i<integerKeyLength;i++)u=u<<8|(unsigned char)key[i];
+    return (long long)(u^(1ull<<63));
+}
+
+long long Node::head(const char* tail,int length){
+    unsigned long long h=0;
+    for(int i=0;i<integerKeyLength;i++){
+        h=h<<8|(i<length?(unsigned char)tail[i]:0);
+    }
+    // 翻转符号位，使无符号的字节序与有符号整数的大小顺序一致
+    return (long long)(h^(1ull<<63));
+}
+
+bool Node::load(long long uid){
+    DataItem* di=DataManager::instance()->read(uid);
+    if(di==nullptr)return false;
+    // 在页面读闩锁下整体拷出，拷贝是节点某一时刻的完整内容
+    di->rLock();
+    decode(di->getData());
+    di->rUnLock();
+    DataManager::instance()->release(uid);
+    this->uid=uid;
+    return true;
+}
+
+void Node::store(){
+    DataItem* di=DataManager::instance()->read(uid);
+    if(di==nullptr)throw "index node not found";
+    std::vector<char> raw=encode();
+    di->before();
+    std::copy(raw.begin(),raw.end(),di->getData());
+    di->after(TransactionManager::supperXID);
+    DataManager::instance()->release(uid);
+}
+
+std::vector<char> Node::encode(){
+    if(!fits())throw "index node overflow";
+    std::vector<char> raw(nodeSize(keyLength),0);
+    char* p=&(raw[0]);
+    p[0]=leaf?1:0;
+    p[1]=(char)level;
+    short n=(short)keyNumber;
+    std::memcpy(p+2,&n,sizeof(n));
+    p[4]=(char)((lowInfinite?1:0)|(highInfinite?2:0));
+    p[5]=(char)keyLength;
+    short prefixLength=(short)prefix.size();
+    std::memcpy(p+6,&prefixLength,sizeof(prefixLength));
+    std::memcpy(p+8,&sibling,sizeof(sibling));
+    short lowLength=(short)lowKey.size(),highLength=(short)highKey.size(),restLength=offsets[keyNumber];
+    std::memcpy(p+16,&lowLength,sizeof(lowLength));
+    std::memcpy(p+18,&highLength,sizeof(highLength));
+    std::memcpy(p+20,&restLength,sizeof(restLength));
+    char* q=p+headerSize;
+    std::memcpy(q,heads,keyNumber*sizeof(long long));
+    q+=capacity*sizeof(long long);
+    std::memcpy(q,sons,keyNumber*sizeof(long long));
+    q+=capacity*sizeof(long long);
+    std::memcpy(q,lengths,keyNumber*sizeof(short));
+    q+=capacity*sizeof(short);
+    std::memcpy(q,lowKey.data(),lowLength);
+    std::memcpy(q+lowLength,highKey.data(),highLength);
+    std::memcpy(q+lowLength+highLength,rests,restLength);
+    return raw;
+}
+
+void Node::decode(const char* data){
+    leaf=data[0]==1;
+    level=data[1];
+    short n;
+    std::memcpy(&n,data+2,sizeof(n));
+    keyNumber=n;
+    lowInfinite=(data[4]&1)!=0;
+    highInfinite=(data[4]&2)!=0;
+    keyLength=data[5];
+    short prefixLength,lowLength,highLength,restLength;
+    std::memcpy(&prefixLength,data+6,sizeof(prefixLength));
+    std::memcpy(&sibling,data+8,sizeof(sibling));
+    std::memcpy(&lowLength,data+16,sizeof(lowLength));
+    std::memcpy(&highLength,data+18,sizeof(highLength));
+    std::memcpy(&restLength,data+20,sizeof(restLength));
+    const char* q=data+headerSize;
+    std::memcpy(heads,q,keyNumber*sizeof(long long));
+    q+=capacity*sizeof(long long);
+    std::memcpy(sons,q,keyNumber*sizeof(long long));
+    q+=capacity*sizeof(long long);
+    std::memcpy(lengths,q,keyNumber*sizeof(short));
+    q+=capacity*sizeof(short);
+    lowKey.assign(q,lowLength);
+    highKey.assign(q+lowLength,highLength);
+    std::memcpy(rests,q+lowLength+highLength,restLength);
+    // 前缀是两个栅栏键共有的，不单独存放
+    prefix.assign(highInfinite?lowKey.data():highKey.data(),prefixLength);
+    offsets[0]=0;
+    if(restLength==0){
+        std::fill(offsets,offsets+keyNumber+1,0); // 整数键和短键都没有Rest
+        return;
+    }
+    for(int i=0;i<keyNumber;i++){
+        offsets[i+1]=offsets[i]+(lengths[i]>integerKeyLength?lengths[i]-integerKeyLength:0);
+    }
+}
+
+long long Node::getUid(){
+    return uid;
+}
+
+bool Node::isLeaf(){
+    return leaf;
+}
+
+int Node::getLevel(){
+    return level;
+}
+
+int Node::getKeyNumber(){
+    return keyNumber;
+}
+
+long long Node::getSibling(){
+    return sibling;
+}
+
+std::string Node::getKeyBytes(int i){
+    if(lengths[i]<0)throw "index key is infinite";
+    std::string key(prefix);
+    int length=lengths[i];
+    unsigned long long h=(unsigned long long)heads[i]^(1ull<<63);
+    for(int j=0;j<integerKeyLength&&j<length;j++)key.push_back((char)(h>>(56-8*j)));
+    key.append(rests+offsets[i],offsets[i+1]-offsets[i]);
+    return key;
+}
+
+long long Node::getKey(int i){
+    return denormalize(getKeyBytes(i));
+}
+
+long long Node::getSon(int i){
+    return sons[i];
+}
+
+bool Node::isInfinite(int i){
+    return lengths[i]<0;
+}
+
+bool Node::aboveHigh(const std::string& key){
+    return !highInfinite&&key>highKey;
+}
+
+bool Node::belowHigh(const std::string& key){
+    return highInfinite||key<highKey;
+}
+
+bool Node::covers(int i,long long uid){
+    // 从第i项的儿子沿右兄弟指针向右走，直到下一项的儿子或超出第i项的键；只读取节点的拷贝，不加节点锁
+    long long next=i+1<keyNumber?sons[i+1]:0;
+    long long current=sons[i];
+    bool infinite=isInfinite(i);
+    std::string key;
+    if(!infinite)key=getKeyBytes(i);
+    Node node;
+    while(current!=0&&current!=next){
+        if(current==uid)return true;
+        if(!node.load(current)||(!infinite&&node.belowHigh(key)))return false;
+        current=node.sibling;
+    }
+    return false;
+}
+
+int Node::lowerBound(const std::string& key){
+    return bound(key,false);
+}
+
+int Node::upperBound(const std::string& key){
+    return bound(key,true);
+}
+
+int Node::bound(const std::string& key,bool upper){
+    int n=keyNumber;
+    if(n>0&&lengths[n-1]<0)n--; // 正无穷只会是最后一个键，大于任何key
+    int c=comparePrefix(key);
+    if(c!=0)return c<0?0:n;
+    const char* tail=key.data()+prefix.size();
+    int length=key.size()-prefix.size();
+    long long h=head(tail,length);
+    int low=countLess(heads,n,h);
+    if(low==n||heads[low]!=h)return low; // 没有Head等于h的键，大多数查找到此为止
+    int high=countLessEqual(heads,n,h);
+    // [low,high)中的键Head都等于h，只有它们需要再比较长度或Rest
+    while(low<high){
+        int middle=(low+high)/2;
+        int r=compareTail(middle,tail,length);
+        if(r>0||(upper&&r==0))low=middle+1;
+        else high=middle;
+    }
+    return low;
+}
+
+int Node::comparePrefix(const std::string& key){
+    int n=key.size()<prefix.size()?key.size():prefix.size();
+    int c=std::memcmp(key.data(),prefix.data(),n);
+    if(c!=0)return c<0?-1:1;
+    return key.size()<prefix.size()?-1:0; // key是前缀的一部分，小于所有的键
+}
+
+int Node::compareTail(int i,const char* tail,int length){
+    int entryLength=lengths[i];
+    // Head相同且有一方不超过8个字节时，它是另一方的前缀（Head中补的0与另一方的字节相同），短的较小
+    if(length<=integerKeyLength||entryLength<=integerKeyLength){
+        return length<entryLength?-1:(length>entryLength?1:0);
+    }
+    int rest=length-integerKeyLength;
+    int entryRest=offsets[i+1]-offsets[i];
+    int c=std::memcmp(tail+integerKeyLength,rests+offsets[i],rest<entryRest?rest:entryRest);
+    if(c!=0)return c<0?-1:1;
+    return rest<entryRest?-1:(rest>entryRest?1:0);
+}
+
+int Node::countLess(const long long* keys,int n,long long key){
+#if defined(__x86_64__)||defined(__i386__)
+    if(simd)return countLessAVX2(keys,n,key);
+#endif
+    return std::lower_bound(keys,keys+n,key)-keys;
+}
+
+int Node::countLessEqual(const long long* keys,int n,long long key){
+#if defined(__x86_64__)||defined(__i386__)
+    if(simd)return countLessEqualAVX2(keys,n,key);
+#endif
+    return std::upper_bound(keys,keys+n,key)-keys;
+}
+
+#if defined(__x86_64__)||defined(__i386__)
+// 先用无分支的二分把范围缩小到16个键以内，再用4次向量比较统计剩下的键，没有分支预测失败
+__attribute__((target("avx2")))
+int Node::countLessAVX2(const long long* keys,int n,long long key){
+    const long long* base=keys;
+    while(n>16){
+        int half=n/2;
+        base=base[half-1]<key?base+half:base;
+        n-=half;
+    }
+    __m256i target=_mm256_set1_epi64x(key);
+    __m256i count=_mm256_setzero_si256(); // 每个通道的计数，比较结果为-1时减去即加1
+    int i=0;
+    for(;i+4<=n;i+=4){
+        __m256i v=_mm256_loadu_si256(reinterpret_cast<const __m256i*>(base+i));
+        count=_mm256_sub_epi64(count,_mm256_cmpgt_epi64(target,v)); // keys[i]<key
+    }
+    long long lanes[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes),count);
+    int result=(base-keys)+lanes[0]+lanes[1]+lanes[2]+lanes[3];
+    for(;i<n;i++)result+=base[i]<key;
+    return result;
+}
+
+__attribute__((target("avx2")))
+int Node::countLessEqualAVX2(const long long* keys,int n,long long key){
+    const long long* base=keys;
+    while(n>16){
+        int half=n/2;
+        base=base[half-1]<=key?base+half:base;
+        n-=half;
+    }
+    __m256i target=_mm256_set1_epi64x(key);
+    __m256i count=_mm256_setzero_si256();
+    int i=0;
+    for(;i+4<=n;i+=4){
+        __m256i v=_mm256_loadu_si256(reinterpret_cast<const __m256i*>(base+i));
+        count=_mm256_sub_epi64(count,_mm256_cmpgt_epi64(v,target)); // keys[i]>key
+    }
+    long long lanes[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes),count);
+    int result=(base-keys)+i-(lanes[0]+lanes[1]+lanes[2]+lanes[3]);
+    for(;i<n;i++)result+=base[i]<=key;
+    return result;
+}
+#endif
+
+
+bool Node::fits(){
+    return keyNumber<=capacity&&(int)(lowKey.size()+highKey.size())+offsets[keyNumber]<=areaSize(keyLength);
+}
+
+int Node::splitPoint(){
+    int total=offsets[keyNumber];
+    if((int)(lowKey.size()+highKey.size())+total<=areaSize(keyLength))return keyNumber/2; // 只是键的个数超出
+    // Rest的字节数超出：按字节数对半分，两边都不会超过一半加一个键的Rest
+    int half=1;
+    while(half<keyNumber-1&&offsets[half]*2<total)half++;
+    return half;
+}
+
+void Node::setPrefix(int length){
+    std::vector<std::string> keys(keyNumber);
+    std::vector<long long> children(sons,sons+keyNumber);
+    for(int i=0;i<keyNumber;i++){
+        if(!isInfinite(i))keys[i]=getKeyBytes(i);
+    }
+    bool infinite=keyNumber>0&&isInfinite(keyNumber-1);
+    int n=keyNumber;
+    prefix.resize(length);
+    keyNumber=0;
+    offsets[0]=0;
+    for(int i=0;i<n;i++){
+        if(i==n-1&&infinite)appendInfinite(children[i]);
+        else insertAt(keyNumber,keys[i],children[i]);
+    }
+}
+
+void Node::assign(const std::vector<std::string>& keys,const std::vector<long long>& sons,int begin,int end){
+    // 两个栅栏键都有限时，它们的公共前缀是节点中所有键（包括之后插入的键）共有的
+    int length=0;
+    if(!lowInfinite&&!highInfinite){
+        while(length<(int)lowKey.size()&&length<(int)highKey.size()&&lowKey[length]==highKey[length])length++;
+    }
+    prefix.assign(highKey.data(),length);
+    keyNumber=0;
+    offsets[0]=0;
+    for(int i=begin;i<end;i++){
+        // 每层最右的内部节点的最后一个键为正无穷
+        if(i==end-1&&!leaf&&highInfinite)appendInfinite(sons[i]);
+        else insertAt(keyNumber,keys[i],sons[i]);
+    }
+}
+
+void Node::appendInfinite(long long son){
+    heads[keyNumber]=LLONG_MAX;
+    sons[keyNumber]=son;
+    lengths[keyNumber]=-1;
+    offsets[keyNumber+1]=offsets[keyNumber];
+    keyNumber++;
+}
+
+void Node::insertAt(int i,const std::string& key,long long son){
+    if(comparePrefix(key)!=0){
+        // 键不在栅栏键之内时缩短前缀，使它仍然是所有键共有的
+        int length=0;
+        while(length<(int)prefix.size()&&length<(int)key.size()&&key[length]==prefix[length])length++;
+        setPrefix(length);
+    }
+    const char* tail=key.data()+prefix.size();
+    int length=key.size()-prefix.size();
+    int rest=length>integerKeyLength?length-integerKeyLength:0;
+    std::copy_backward(heads+i,heads+keyNumber,heads+keyNumber+1);
+    std::copy_backward(sons+i,sons+keyNumber,sons+keyNumber+1);
+    std::copy_backward(lengths+i,lengths+keyNumber,lengths+keyNumber+1);
+    std::memmove(rests+offsets[i]+rest,rests+offsets[i],offsets[keyNumber]-offsets[i]);
+    for(int j=keyNumber+1;j>i;j--)offsets[j]=offsets[j-1]+rest;
+    std::memcpy(rests+offsets[i],tail+integerKeyLength,rest);
+    heads[i]=head(tail,length);
+    sons[i]=son;
+    lengths[i]=(short)length;
+    keyNumber++;
+}
+
+void Node::split(Node& right){
+    int half=splitPoint();
+    // 两边的栅栏键变窄，前缀只会变长，所以用完整的键重建两个节点
+    std::vector<std::string> keys(keyNumber);
+    std::vector<long long> children(sons,sons+keyNumber);
+    for(int i=0;i<keyNumber;i++){
+        if(!isInfinite(i))keys[i]=getKeyBytes(i);
+    }
+    right.leaf=leaf;
+    right.level=level;
+    right.keyLength=keyLength;
+    right.sibling=sibling;
+    right.highInfinite=highInfinite;
+    right.highKey=highKey;
+    right.lowInfinite=false;
+    right.lowKey=keys[half-1];
+    right.assign(keys,children,half,keyNumber);
+    highInfinite=false;
+    highKey=keys[half-1];
+    assign(keys,children,0,half);
+}
+
+long long BPlusTree::create(int keyLength){
+    if(keyLength<1||keyLength>Node::maxKeyLength)throw "index key length is out of range";
+    Node root; // 空的叶子，覆盖所有的键
+    root.keyLength=keyLength;
+    std::vector<char> raw=root.encode();
+    long long rootUid=DataManager::instance()->insert(TransactionManager::supperXID,raw);
+    std::vector<char> boot(sizeof(long long));
+    std::memcpy(&(boot[0]),&rootUid,sizeof(rootUid));
+    return DataManager::instance()->insert(TransactionManager::supperXID,boot);
+}
+
+std::shared_ptr<BPlusTree> BPlusTree::load(long long bootUid){
+    DataItem* di=DataManager::instance()->read(bootUid);
+    if(di==nullptr)throw "index not found";
+    DataManager::instance()->release(bootUid);
+    return std::shared_ptr<BPlusTree>(new BPlusTree(bootUid));
+}
+
+BPlusTree::BPlusTree(long long bootUid):bootUid(bootUid){
+}
+
+long long BPlusTree::getBootUid(){
+    return bootUid;
+}
+
+long long BPlusTree::rootUid(){
+    DataItem* di=DataManager::instance()->read(bootUid);
+    if(di==nullptr)throw "index not found";
+    long long uid;
+    di->rLock();
+    std::memcpy(&uid,di->getData(),sizeof(uid));
+    di->rUnLock();
+    DataManager::instance()->release(bootUid);
+    return uid;
+}
+
+long long BPlusTree::descend(const std::string& key,int level,std::vector<long long>* path){
+    long long uid=rootUid();
+    Node node;
+    while(true){
+        if(!node.load(uid))throw "index node not found";
+        if(node.aboveHigh(key)&&node.sibling!=0){
+            // 节点在我们读到其地址之后分裂了，键已经移到右边
+            uid=node.sibling;
+            continue;
+        }
+        if(node.level==level)return uid;
+        if(node.level<level)throw "index level not found";
+        if(path!=nullptr)path->push_back(uid);
+        int i=node.lowerBound(key);
+        uid=node.sons[i<node.keyNumber?i:node.keyNumber-1];
+    }
+}
+
+void BPlusTree::lockNode(long long uid){
+    nodeLocks[((unsigned long long)uid*0x9E3779B97F4A7C15ull)>>58].lock();
+}
+
+void BPlusTree::unlockNode(long long uid){
+    nodeLocks[((unsigned long long)uid*0x9E3779B97F4A7C15ull)>>58].unlock();
+}
+
+void BPlusTree::insert(long long key,long long uid){
+    insert(Node::normalize(key),uid);
+}
+
+void BPlusTree::insert(const std::string& key,long long uid){
+    std::vector<long long> path; // 下降时经过的内部节点，path.back()是叶子的父节点
+    long long current=descend(key,0,&path);
+    std::string separator=key; // 要插入当前层的键
+    long long son=uid; // 要插入当前层的儿子
+    long long child=0; // 在下一层分裂的节点，son是它分裂出的右节点
+    int level=0;
+    Node node;
+    while(true){
+        lockNode(current);
+        if(!node.load(current)){
+            unlockNode(current);
+            throw "index node not found";
+        }
+        // 在加锁之前节点可能已经分裂，向右移动到覆盖separator的节点；同一时刻只持有一把节点锁
+        while(node.aboveHigh(separator)&&node.sibling!=0){
+            long long next=node.sibling;
+            unlockNode(current);
+            current=next;
+            lockNode(current);
+            if(!node.load(current)){
+                unlockNode(current);
+                throw "index node not found";
+            }
+        }
+        if(level==0){
+            if((int)separator.size()>node.keyLength){
+                unlockNode(current);
+                throw "index key is too long";
+            }
+            node.insertAt(node.upperBound(separator),separator,son);
+        }else{
+            // 子节点child在separator处分裂出了新节点son：包含child的项一分为二，左半（键为separator）指向原来的儿子，右半指向son
+            // 一个项的儿子沿右兄弟指针到下一项的儿子之前的节点都归这一项（其中有的节点还没有在父节点中插入自己的项）
+            // 有重复键时可能有多个项的键等于separator，不能只按键查找，要找到链段中包含child的那一项
+            int i=node.lowerBound(separator);
+            while(i<node.keyNumber&&!node.isInfinite(i)&&node.getKeyBytes(i)==separator&&!node.covers(i,child))i++;
+            if(i==node.keyNumber)i=node.keyNumber-1; // separator不大于highKey，最后一项覆盖它
+            node.insertAt(i,separator,node.sons[i]);
+            node.sons[i+1]=son;
+        }
+        if(node.fits()){
+            try{
+                node.store();
+            }catch(...){
+                unlockNode(current);
+                throw;
+            }
+            unlockNode(current);
+            return;
+        }
+        // 键的个数或字节数超出时分裂：先插入新的右节点，再修改左节点，读者在两步之间只会看到旧的左节点（仍然包含全部的键）
+        Node right;
+        node.split(right);
+        try{
+            std::vector<char> raw=right.encode();
+            right.uid=DataManager::instance()->insert(TransactionManager::supperXID,raw);
+            node.sibling=right.uid;
+            node.store();
+        }catch(...){
+            unlockNode(current);
+            throw;
+        }
+        unlockNode(current);
+        separator=node.highKey;
+        child=current;
+        son=right.uid;
+        level=node.level+1;
+        if(!path.empty()){
+            current=path.back();
+            path.pop_back();
+            continue;
+        }
+        if(newRoot(node,separator,son))return;
+        // node已经不是根节点：下降之后树长高了，或者另一个线程分裂了根节点（node是它分裂出的右节点）但还没有生成新的根节点
+        // 等到根节点高过node，再从根节点找到父节点
+        waitRoot(level);
+        current=descend(separator,level,nullptr);
+    }
+}
+
+bool BPlusTree::newRoot(Node& left,const std::string& separator,long long right){
+    std::unique_lock<std::mutex> lock(bootLock);
+    if(rootUid()!=left.uid)return false;
+    Node root; // 栅栏键都是无穷，第二项的键为正无穷
+    root.leaf=false;
+    root.level=left.level+1;
+    root.keyLength=left.keyLength;
+    std::vector<std::string> keys={separator,std::string()};
+    std::vector<long long> sons={left.uid,right};
+    root.assign(keys,sons,0,2);
+    std::vector<char> raw=root.encode();
+    long long uid=DataManager::instance()->insert(TransactionManager::supperXID,raw);
+    DataItem* di=DataManager::instance()->read(bootUid);
+    di->before();
+    std::memcpy(di->getData(),&uid,sizeof(uid));
+    di->after(TransactionManager::supperXID);
+    DataManager::instance()->release(bootUid);
+    return true;
+}
+
+void BPlusTree::waitRoot(int level){
+    Node root;
+    while(true){
+        {
+            // 新的根节点在bootLock下发布，正在发布时在这里等待
+            std::unique_lock<std::mutex> lock(bootLock);
+            if(!root.load(rootUid()))throw "index node not found";
+        }
+        if(root.level>=level)return;
+        // 分裂根节点的线程还没有拿到bootLock
+        std::this_thread::yield();
+    }
+}
+
+std::vector<long long> BPlusTree::search(long long key){
+    return searchRange(key,key);
+}
+
+std::vector<long long> BPlusTree::search(const std::string& key){
+    return searchRange(key,key);
+}
+
+std::vector<long long> BPlusTree::searchRange(long long leftKey,long long rightKey){
+    if(leftKey>rightKey)return std::vector<long long>();
+    return searchRange(Node::normalize(leftKey),Node::normalize(rightKey));
+}
+
+std::vector<long long> BPlusTree::searchRange(const std::string& leftKey,const std::string& rightKey){
+    std::vector<long long> result;
+    if(leftKey>rightKey)return result;
+    long long uid=descend(leftKey,0,nullptr);
+    Node node;
+    while(uid!=0){
+        if(!node.load(uid))throw "index node not found";
+        int end=node.upperBound(rightKey);
+        for(int i=node.lowerBound(leftKey);i<end;i++)result.push_back(node.sons[i]);
+        if(end<node.keyNumber)break;
+        // 右兄弟中的键不小于HighKey（重复键可能跨越多个叶子）
+        if(node.belowHigh(rightKey))break;
+        uid=node.sibling;
+    }
+    return result;
+}
+
+TreeBuilder::TreeBuilder(double fillFactor,int keyLength):inserter(TransactionManager::supperXID),keyLength(keyLength){
+    if(keyLength<1||keyLength>Node::maxKeyLength)throw "index key length is out of range";
+    fill=(int)(Node::capacity*fillFactor);
+    if(fill<2)fill=2;
+    if(fill>Node::capacity)fill=Node::capacity;
+    // 栅栏键之外的空间留给Rest
+    fillBytes=(int)((Node::areaSize(keyLength)-2*keyLength)*fillFactor);
+}
+
+int TreeBuilder::restOf(const std::string& key){
+    return key.size()>Node::integerKeyLength?key.size()-Node::integerKeyLength:0;
+}
+
+void TreeBuilder::add(long long key,long long uid){
+    add(Node::normalize(key),uid);
+}
+
+void TreeBuilder::add(const std::string& key,long long uid){
+    if((int)key.size()>keyLength)throw "index key is too long";
+    if(hasKey&&key<lastKey)throw "keys are not sorted";
+    hasKey=true;
+    lastKey=key;
+    // 还有后续的键，说明正在填充的叶子不是最右的
+    if((int)leafKeys.size()==fill||(!leafKeys.empty()&&leafBytes+restOf(key)>fillBytes))writeLeaf(false);
+    leafKeys.push_back(key);
+    leafSons.push_back(uid);
+    leafBytes+=restOf(key);
+}
+
+long long TreeBuilder::write(int level,std::vector<std::string>& keys,std::vector<long long>& sons,int begin,int end,bool last,std::vector<std::string>& written){
+    // 写出之前确定自身和右兄弟的uid：右兄弟是本层紧接着写出的下一个节点
+    int size=Node::nodeSize(keyLength);
+    long long uid=inserter.nextUid(size);
+    Node node;
+    node.leaf=level==0;
+    node.level=level;
+    node.keyLength=keyLength;
+    node.sibling=last?0:inserter.nextUid(size,1);
+    // LowKey是本层前一个节点的HighKey
+    node.lowInfinite=written.empty();
+    if(!written.empty())node.lowKey=written.back();
+    node.highInfinite=last;
+    if(!last)node.highKey=keys[end-1];
+    node.assign(keys,sons,begin,end);
+    std::vector<char> raw=node.encode();
+    if(inserter.append(raw)!=uid)throw "bulk insert uid mismatch";
+    written.push_back(node.highKey);
+    return uid;
+}
+
+void TreeBuilder::writeLeaf(bool last){
+    long long uid=write(0,leafKeys,leafSons,0,leafKeys.size(),last,highKeys);
+    sons.push_back(uid);
+    leafKeys.clear();
+    leafSons.clear();
+    leafBytes=0;
+}
+
+long long TreeBuilder::finish(){
+    writeLeaf(true); // 没有键时写出一个空的叶子作为根节点
+    int level=0;
+    while(sons.size()>1){
+        // 由下一层的(HighKey,uid)构成新的一层，最右的HighKey是正无穷
+        std::vector<std::string> childKeys;
+        std::vector<long long> children;
+        childKeys.swap(highKeys);
+        children.swap(sons);
+        level++;
+        int n=children.size();
+        int begin=0;
+        while(begin<n){
+            // 按键的个数和Rest的字节数分段
+            int end=begin,bytes=0;
+            while(end<n&&end-begin<fill&&(end==begin||bytes+restOf(childKeys[end])<=fillBytes)){
+                bytes+=restOf(childKeys[end]);
+                end++;
+            }
+            long long uid=write(level,childKeys,children,begin,end,end==n,highKeys);
+            sons.push_back(uid);
+            begin=end;
+        }
+    }
+    std::vector<char> boot(sizeof(long long));
+    std::memcpy(&(boot[0]),&(sons[0]),sizeof(long long));
+    long long bootUid=inserter.append(boot);
+    inserter.finish();
+    return bootUid;
+}
+
+bool Bucket::load(long long uid){
+    DataItem* di=DataManager::instance()->read(uid);
+    if(di==nullptr)return false;
+    di->rLock();
+    decode(di->getData());
+    di->rUnLock();
+    DataManager::instance()->release(uid);
+    this->uid=uid;
+    return true;
+}
+
+void Bucket::store(){
+    DataItem* di=DataManager::instance()->read(uid);
+    if(di==nullptr)throw "hash bucket not found";
+    std::vector<char> raw=encode();
+    di->before();
+    std::copy(raw.begin(),raw.end(),di->getData());
+    di->after(TransactionManager::supperXID);
+    DataManager::instance()->release(uid);
+}
+
+std::vector<char> Bucket::encode(){
+    std::vector<char> raw(bucketSize,0);
+    char* p=&(raw[0]);
+    p[0]=(char)localDepth;
+    short n=(short)count;
+    std::memcpy(p+2,&n,sizeof(n));
+    std::memcpy(p+8,&pattern,sizeof(pattern));
+    std::memcpy(p+16,&next,sizeof(next));
+    std::memcpy(p+24,&overflow,sizeof(overflow));
+    std::memcpy(p+headerSize,keys,count*sizeof(long long));
+    std::memcpy(p+headerSize+capacity*sizeof(long long),uids,count*sizeof(long long));
+    return raw;
+}
+
+void Bucket::decode(const char* data){
+    localDepth=data[0];
+    short n;
+    std::memcpy(&n,data+2,sizeof(n));
+    count=n;
+    std::memcpy(&pattern,data+8,sizeof(pattern));
+    std::memcpy(&next,data+16,sizeof(next));
+    std::memcpy(&overflow,data+24,sizeof(overflow));
+    std::memcpy(keys,data+headerSize,count*sizeof(long long));
+    std::memcpy(uids,data+headerSize+capacity*sizeof(long long),count*sizeof(long long));
+}
+
+long long HashIndex::create(){
+    Bucket bucket; // 深度为0的桶，容纳所有的键
+    std::vector<char> raw=bucket.encode();
+    long long first=DataManager::instance()->insert(TransactionManager::supperXID,raw);
+    std::vector<char> boot(sizeof(long long));
+    std::memcpy(&(boot[0]),&first,sizeof(first));
+    return DataManager::instance()->insert(TransactionManager::supperXID,boot);
+}
+
+std::shared_ptr<HashIndex> HashIndex::load(long long bootUid){
+    DataItem* di=DataManager::instance()->read(bootUid);
+    if(di==nullptr)throw "index not found";
+    long long uid;
+    di->rLock();
+    std::memcpy(&uid,di->getData(),sizeof(uid));
+    di->rUnLock();
+    DataManager::instance()->release(bootUid);
+
+    std::shared_ptr<HashIndex> index(new HashIndex(bootUid));
+    // 沿桶链读出每个桶的深度和模式，全局深度为最大的局部深度
+    std::vector<Bucket> buckets;
+    Bucket bucket;
+    while(uid!=0){
+        if(!bucket.load(uid))throw "hash bucket not found";
+        buckets.push_back(bucket);
+        if(bucket.localDepth>index->globalDepth)index->globalDepth=bucket.localDepth;
+        uid=bucket.next;
+    }
+    index->directory.assign(1LL<<index->globalDepth,0);
+    for(Bucket& b:buckets){
+        for(long long i=b.pattern;i<(long long)index->directory.size();i+=1LL<<b.localDepth){
+            index->directory[i]=b.uid;
+        }
+    }
+    return index;
+}
+
+HashIndex::HashIndex(long long bootUid):bootUid(bootUid){
+}
+
+long long HashIndex::getBootUid(){
+    return bootUid;
+}
+
+int HashIndex::getGlobalDepth(){
+    std::shared_lock<std::shared_mutex> lock(directoryLock);
+    return globalDepth;
+}
+
+unsigned long long HashIndex::hash(long long key){
+    // splitmix64的最终混合，低位也均匀分布
+    unsigned long long h=(unsigned long long)key;
+    h^=h>>30;
+    h*=0xbf58476d1ce4e5b9ull;
+    h^=h>>27;
+    h*=0x94d049bb133111ebull;
+    h^=h>>31;
+    return h;
+}
+
+long long HashIndex::bucketOf(unsigned long long h){
+    std::shared_lock<std::shared_mutex> lock(directoryLock);
+    return directory[h&((1ull<<globalDepth)-1)];
+}
+
+void HashIndex::lockBucket(long long uid){
+    bucketLocks[((unsigned long long)uid*0x9E3779B97F4A7C15ull)>>58].lock();
+}
+
+void HashIndex::unlockBucket(long long uid){
+    bucketLocks[((unsigned long long)uid*0x9E3779B97F4A7C15ull)>>58].unlock();
+}
+
+std::vector<long long> HashIndex::search(long long key){
+    std::vector<long long> result;
+    unsigned long long h=hash(key);
+    Bucket bucket;
+    {
+        // 桶在目录写锁下改写，持有目录读锁时读到的桶与目录一致
+        std::shared_lock<std::shared_mutex> lock(directoryLock);
+        long long uid=directory[h&((1ull<<globalDepth)-1)];
+        if(!bucket.load(uid))throw "hash bucket not found";
+    }
+    while(true){
+        for(int i=0;i<bucket.count;i++){
+            if(bucket.keys[i]==key)result.push_back(bucket.uids[i]);
+        }
+        // 溢出桶只会追加键，分裂时换成新的溢出桶而不改写旧的，读到旧的桶时沿旧的链读出的仍是分裂之前的状态，不需要目录锁
+        if(bucket.overflow==0)return result;
+        if(!bucket.load(bucket.overflow))throw "hash bucket not found";
+    }
+}
+
+void HashIndex::insert(long long key,long long uid){
+    unsigned long long h=hash(key);
+    Bucket bucket;
+    while(true){
+        long long current=bucketOf(h);
+        lockBucket(current);
+        if(!bucket.load(current)){
+            unlockBucket(current);
+            throw "hash bucket not found";
+        }
+        if((h&((1ull<<bucket.localDepth)-1))!=(unsigned long long)bucket.pattern){
+            // 在加锁之前桶已经分裂，键已经不属于这个桶
+            unlockBucket(current);
+            continue;
+        }
+        try{
+            if(bucket.count<Bucket::capacity){
+                bucket.keys[bucket.count]=key;
+                bucket.uids[bucket.count]=uid;
+                bucket.count++;
+                bucket.store();
+                unlockBucket(current);
+                return;
+            }
+            // 桶满，分裂后重新定位；分裂不能把任何键与新键分开时（例如重复的键），再分裂只会让目录无谓地加倍，放入溢出桶
+            std::vector<Bucket> chain=loadChain(bucket);
+            if(bucket.localDepth==maxDepth||!separable(bucket,chain,h)){
+                spill(bucket,chain,key,uid);
+                unlockBucket(current);
+                return;
+            }
+            split(bucket,chain);
+        }catch(...){
+            unlockBucket(current);
+            throw;
+        }
+        unlockBucket(current);
+    }
+}
+
+std::vector<Bucket> HashIndex::loadChain(Bucket& bucket){
+    std::vector<Bucket> chain;
+    for(long long uid=bucket.overflow;uid!=0;uid=chain.back().overflow){
+        chain.emplace_back();
+        if(!chain.back().load(uid))throw "hash bucket not found";
+    }
+    return chain;
+}
+
+bool HashIndex::separable(Bucket& bucket,std::vector<Bucket>& chain,unsigned long long h){
+    unsigned long long bit=1ull<<bucket.localDepth;
+    for(int i=0;i<bucket.count;i++){
+        if((hash(bucket.keys[i])^h)&bit)return true;
+    }
+    for(Bucket& overflow:chain){
+        for(int i=0;i<overflow.count;i++){
+            if((hash(overflow.keys[i])^h)&bit)return true;
+        }
+    }
+    return false;
+}
+
+void HashIndex::split(Bucket& bucket,std::vector<Bucket>& chain){
+    int depth=bucket.localDepth;
+    unsigned long long bit=1ull<<depth;
+    // 桶和溢出桶中的键按哈希值的第depth位分到两边，每边的前capacity个放入桶中，其余的放入新的溢出桶
+    std::vector<std::pair<long long,long long>> sides[2];
+    for(int i=0;i<bucket.count;i++){
+        sides[(hash(bucket.keys[i])&bit)!=0].push_back({bucket.keys[i],bucket.uids[i]});
+    }
+    for(Bucket& overflow:chain){
+        for(int i=0;i<overflow.count;i++){
+            sides[(hash(overflow.keys[i])&bit)!=0].push_back({overflow.keys[i],overflow.uids[i]});
+        }
+    }
+    Bucket right;
+    right.localDepth=depth+1;
+    right.pattern=bucket.pattern|bit;
+    right.next=bucket.next;
+    Bucket* halves[2]={&bucket,&right};
+    for(int side=0;side<2;side++){
+        Bucket& half=*halves[side];
+        half.count=std::min((int)sides[side].size(),(int)Bucket::capacity);
+        for(int i=0;i<half.count;i++){
+            half.keys[i]=sides[side][i].first;
+            half.uids[i]=sides[side][i].second;
+        }
+        // 旧的溢出桶不改写，正在读它们的查找看到的仍是完整的旧链；旧链不再被引用，和崩溃时留下的桶一样不回收
+        half.overflow=writeChain(sides[side],half.count);
+    }
+    bucket.localDepth=depth+1;
+    // 先插入新桶，再改写原来的桶使其指向新桶；在两步之间崩溃只会留下一个无法到达的新桶
+    std::vector<char> raw=right.encode();
+    right.uid=DataManager::instance()->insert(TransactionManager::supperXID,raw);
+    bucket.next=right.uid;
+    std::unique_lock<std::shared_mutex> lock(directoryLock);
+    if(depth+1>globalDepth){
+        // 目录加倍，只是内存中的拷贝
+        directory.resize(directory.size()*2);
+        std::copy(directory.begin(),directory.begin()+directory.size()/2,directory.begin()+directory.size()/2);
+        globalDepth++;
+    }
+    bucket.store();
+    for(long long i=right.pattern;i<(long long)directory.size();i+=1LL<<right.localDepth){
+        directory[i]=right.uid;
+    }
+}
+
+long long HashIndex::writeChain(std::vector<std::pair<long long,long long>>& entries,int begin){
+    // 从链尾往前写，每个桶写入时已经知道它的下一个桶
+    long long first=0;
+    int n=entries.size();
+    for(int end=n;end>begin;){
+        int start=std::max(begin,end-(end-begin-1)%Bucket::capacity-1);
+        Bucket overflow;
+        overflow.count=end-start;
+        for(int i=start;i<end;i++){
+            overflow.keys[i-start]=entries[i].first;
+            overflow.uids[i-start]=entries[i].second;
+        }
+        overflow.overflow=first;
+        std::vector<char> raw=overflow.encode();
+        first=DataManager::instance()->insert(TransactionManager::supperXID,raw);
+        end=start;
+    }
+    return first;
+}
+
+void HashIndex::spill(Bucket& bucket,std::vector<Bucket>& chain,long long key,long long uid){
+    // 溢出桶链由桶锁保护；先找一个还有空位的溢出桶
+    for(Bucket& overflow:chain){
+        if(overflow.count<Bucket::capacity){
+            overflow.keys[overflow.count]=key;
+            overflow.uids[overflow.count]=uid;
+            overflow.count++;
+            overflow.store();
+            return;
+        }
+    }
+    // 都满了，新的溢出桶放在链头：先插入溢出桶，再改写桶使其指向它；在两步之间崩溃只会留下一个无法到达的溢出桶
+    Bucket fresh;
+    fresh.keys[0]=key;
+    fresh.uids[0]=uid;
+    fresh.count=1;
+    fresh.overflow=bucket.overflow;
+    std::vector<char> raw=fresh.encode();
+    bucket.overflow=DataManager::instance()->insert(TransactionManager::supperXID,raw);
+    bucket.store(); // 目录不变，不需要目录写锁；查找读到的要么是旧的桶，要么是指向新溢出桶的桶
+}
+
+IndexIterator::IndexIterator(BPlusTree& tree,long long leftKey,long long rightKey,int prefetchLeaves):IndexIterator(tree,Node::normalize(leftKey),Node::normalize(rightKey),prefetchLeaves){
+}
+
+IndexIterator::IndexIterator(BPlusTree& tree,const std::string& leftKey,const std::string& rightKey,int prefetchLeaves):tree(tree),leftKey(leftKey),rightKey(rightKey),window(prefetchLeaves){
+    if(leftKey>rightKey){
+        finished=true;
+        return;
+    }
+    std::vector<long long> path;
+    long long uid=tree.descend(leftKey,0,&path);
+    loadLeaf(uid);
+    position=leaf.lowerBound(leftKey)-1;
+    if(!path.empty()&&window>0){
+        if(!parent.load(path.back()))throw "index node not found";
+        // 父节点中第一个不小于leftKey的项指向当前叶子（或其左边的叶子），预取从它的下一项开始
+        parentPosition=parent.lowerBound(leftKey)+1;
+        parentDone=false;
+        prefetch();
+    }
+}
+
+void IndexIterator::loadLeaf(long long uid){
+    if(!leaf.load(uid))throw "index node not found";
+    end=leaf.upperBound(rightKey);
+}
+
+bool IndexIterator::next(){
+    if(finished)return false;
+    position++;
+    while(position>=leaf.keyNumber){
+        // 右兄弟中的键不小于HighKey
+        if(end<leaf.keyNumber||leaf.belowHigh(rightKey)||leaf.sibling==0){
+            finished=true;
+            return false;
+        }
+        loadLeaf(leaf.sibling);
+        position=0;
+        if(ahead>0)ahead--;
+        prefetch();
+    }
+    if(position>=end){
+        finished=true;
+        return false;
+    }
+    return true;
+}
+
+long long IndexIterator::getKey(){
+    return leaf.getKey(position);
+}
+
+std::string IndexIterator::getKeyBytes(){
+    return leaf.getKeyBytes(position);
+}
+
+long long IndexIterator::getUid(){
+    return leaf.sons[position];
+}
+
+void IndexIterator::prefetch(){
+    while(!parentDone&&ahead<window){
+        if(parentPosition>=parent.keyNumber){
+            if(!parent.aboveHigh(rightKey)||parent.sibling==0){
+                parentDone=true;
+                break;
+            }
+            if(!parent.load(parent.sibling))throw "index node not found";
+            parentPosition=0;
+            continue;
+        }
+        // 第parentPosition个儿子覆盖的键大于前一项的键，前一项的键已经超出范围时后面的叶子都不需要
+        if(parentPosition>0&&!parent.isInfinite(parentPosition-1)&&parent.getKeyBytes(parentPosition-1)>rightKey){
+            parentDone=true;
+            break;
+        }
+        long long pageNumber=parent.sons[parentPosition]>>32;
+        if(pageNumber!=lastPrefetched){
+            PageCache::instance()->prefetch(pageNumber,1);
+            lastPrefetched=pageNumber;
+        }
+        parentPosition++;
+        ahead++;
+    }
+}
@@ -1,13 +1,266 @@
 #ifndef INDEX
 #define INDEX
 
+#include <vector>
+#include <mutex>
+#include <shared_mutex>
+#include <memory>
+#include <climits>
+#include <cstring>
+#include <string>
+#if defined(__x86_64__)||defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "Data.h"
+
+class BPlusTree;
+class HashIndex;
+class IndexIterator;
 
+// B-link树的节点，每个节点存放在一个DataItem中（由超级事务写入，不经过VM）
+// 键是规范化的字节串，按无符号字节的字典序比较：整数键规范化为翻转符号位后的8字节大端序，字符串键就是它本身的字节
+// 节点结构：[Header] [Head0...HeadN-1] [Son0...SonN-1] [Length0...LengthN-1] [LowKey] [HighKey] [Rest0...RestN-1]
+// Header 24字节：LeafFlag 1字节，Level 1字节（叶子为0），KeyNumber 2字节，Fence 1字节（第0位LowKey为负无穷，第1位HighKey为正无穷），KeyLength 1字节（树的最大键长），PrefixLength 2字节；
+//   Sibling 8字节，为右兄弟的uid，最右的节点为0；LowKey、HighKey和所有Rest的长度各2字节，之后2字节填充
+// LowKey和HighKey是节点的栅栏键，节点中的键都在[LowKey,HighKey]之内，所以共有两者的公共前缀（长度为PrefixLength），前缀只存一次
+// 每个键去掉前缀之后，接下来的8个字节（不足时补0）组成保序的整数Head，Length是去掉前缀之后的长度，超出8个字节的部分（Rest）依次存放在节点末尾
+// 叶子中Son为记录的uid；内部节点中Son为子节点的uid，键为该子节点覆盖的最大键（最后一个键等于HighKey，每层最右的内部节点的最后一个键为正无穷，Length为-1）
+// Head、Son和Length各有capacity个位置；节点的长度由树的最大键长决定，整数键的树每个节点1192字节，一个页面放得下3个
+// Node本身是节点内容在内存中的拷贝，读取时在页面读闩锁下整体拷出，修改后整体写回
+// 节点内的查找在连续的Head数组上进行，只比较8字节的整数：x86的CPU支持AVX2时先二分缩小到16个键以内，再每次比较4个Head并统计小于（不大于）目标的个数，否则退回标量的二分查找
+// 只有Head相同的几个键才需要再比较长度或Rest，不对完整的键调用memcmp；整数键的Rest总是空的
 class Node{
+public:
+    friend class BPlusTree;
+    friend class TreeBuilder;
+    friend class IndexIterator;
+    static const int balance=32; // 节点半满时的键个数
+    static const int capacity=balance*2; // 节点最多存放的键个数
+    static const int headerSize=24; // 节点头部的长度
+    static const int entrySize=2*sizeof(long long)+sizeof(short); // 每一项的Head、Son和Length的长度
+    static const int integerKeyLength=sizeof(long long); // 整数键规范化之后的长度
+    static const int maxKeyLength=64; // 树的最大键长的上限，保证一个节点放得进一个页面
+    static int areaSize(int keyLength); // 栅栏键和Rest的空间：两个栅栏键，加上每个键的Rest都取最大时的一半
+    static int nodeSize(int keyLength); // 最大键长为keyLength的树中节点的长度
+    static std::string normalize(long long key); // 整数键的规范化形式
+    static long long denormalize(const std::string& key); // 从规范化形式还原整数键
+
+    bool load(long long uid); // 读取uid处节点的拷贝，节点不存在时返回false
+    void store(); // 将节点写回其DataItem，记录一条超级事务的更新日志
+    std::vector<char> encode(); // 将节点编码为DataItem承载的数据
+    void decode(const char* data); // 从DataItem承载的数据解码
+
+    long long getUid();
+    bool isLeaf();
+    int getLevel();
+    int getKeyNumber();
+    long long getSibling();
+    std::string getKeyBytes(int i); // 第i个键的规范化形式
+    long long getKey(int i); // 整数键的树中第i个键
+    long long getSon(int i);
+    int lowerBound(const std::string& key); // 第一个不小于key的键的下标，没有时返回keyNumber
+    int upperBound(const std::string& key); // 第一个大于key的键的下标，没有时返回keyNumber
+    bool isInfinite(int i); // 第i个键是否为正无穷
+    bool aboveHigh(const std::string& key); // key是否大于HighKey
+    bool belowHigh(const std::string& key); // key是否小于HighKey
+    bool covers(int i,long long uid); // 内部节点第i项的链段（它的儿子直到下一项的儿子之前的节点）是否包含节点uid
+private:
+    static bool simd; // CPU是否支持AVX2，启动时检测一次；不是x86的平台总是false
+    static int countLess(const long long* keys,int n,long long key); // 有序数组中小于key的键的个数
+    static int countLessEqual(const long long* keys,int n,long long key); // 有序数组中不大于key的键的个数
+#if defined(__x86_64__)||defined(__i386__)
+    static int countLessAVX2(const long long* keys,int n,long long key);
+    static int countLessEqualAVX2(const long long* keys,int n,long long key);
+#endif
+    static long long head(const char* tail,int length); // 去掉前缀之后的键的前8个字节按大端序组成整数并翻转符号位，不足8个字节时补0；Head保序
+    static const int restCapacity=(capacity+1)*(maxKeyLength-integerKeyLength); // Rest的缓冲区，容纳分裂之前超出的一项
+
+    int bound(const std::string& key,bool upper); // lowerBound和upperBound：先按Head定位，再只对Head相同的键比较余下部分
+    int comparePrefix(const std::string& key); // key小于、属于、大于以节点前缀开头的键的范围时分别返回-1、0、1
+    int compareTail(int i,const char* tail,int length); // Head相同时，去掉前缀之后长度为length的键与第i个键比较
+    bool fits(); // 键和字节数是否都放得下
+    int splitPoint(); // 分裂时留在左边的键的个数
+    void setPrefix(int length); // 修改前缀长度，重新编码所有的键（只在插入的键不在栅栏键之内时发生）
+    void assign(const std::vector<std::string>& keys,const std::vector<long long>& sons,int begin,int end); // 设置好栅栏键之后，用keys和sons中[begin,end)的项重建节点
+    void appendInfinite(long long son); // 在末尾加入键为正无穷的一项
+    void insertAt(int i,const std::string& key,long long son); // 在下标i处插入一对键和儿子，允许暂时超出capacity一个位置或超出字节数
+    void split(Node& right); // 将后面的键和儿子移到right中，right继承右兄弟和HighKey，LowKey为自身新的HighKey，即留下的最后一个键
 
+    long long uid=0; // 节点所在的DataItem的地址
+    bool leaf=true;
+    int level=0;
+    int keyNumber=0;
+    int keyLength=integerKeyLength; // 树的最大键长
+    long long sibling=0;
+    bool lowInfinite=true; // LowKey为负无穷（每层最左的节点）
+    bool highInfinite=true; // HighKey为正无穷（每层最右的节点）
+    std::string lowKey;
+    std::string highKey;
+    std::string prefix; // 节点中所有键共有的前缀
+    long long heads[capacity+1];
+    long long sons[capacity+1];
+    short lengths[capacity+1];
+    short offsets[capacity+2]={0}; // 第i个键的Rest在rests中的范围是[offsets[i],offsets[i+1])
+    char rests[restCapacity];
 };
 
+// 并发B-link树（Lehman-Yao），键为整数或不超过最大键长的字节串，允许重复键；叶子中保存记录的uid，可以直接交给VersionManager::read读取
+// 每个节点有右兄弟指针和HighKey：查找的键大于节点的HighKey时，说明节点已经分裂，沿右兄弟继续查找即可，因此读者只拷贝当前节点，不持有任何父节点的闩锁
+// 写者对正在修改的节点加节点锁（同一时刻只持有一把），分裂时先插入新的右节点，再修改左节点，最后向父节点插入分隔键，父节点的修改按键定位，与其他分裂的先后顺序无关
+// 树的根节点地址保存在一个8字节的DataItem（boot）中，根节点分裂时在bootLock下生成新的根节点
 class BPlusTree{
+public:
+    friend class IndexIterator;
+    static long long create(int keyLength=Node::integerKeyLength); // 创建一棵空树，返回boot的uid；keyLength为树的最大键长，整数键的树为8
+    static std::shared_ptr<BPlusTree> load(long long bootUid); // 打开boot为bootUid的树
+    void insert(long long key,long long uid); // 插入一对整数键和记录的uid
+    void insert(const std::string& key,long long uid); // 插入一对字节串键和记录的uid，键长超过树的最大键长时抛出异常
+    std::vector<long long> search(long long key); // 查找键等于key的所有记录的uid
+    std::vector<long long> search(const std::string& key);
+    std::vector<long long> searchRange(long long leftKey,long long rightKey); // 查找键在[leftKey,rightKey]之间的所有记录的uid，按键的顺序返回
+    std::vector<long long> searchRange(const std::string& leftKey,const std::string& rightKey);
+    long long getBootUid();
+
+    BPlusTree(const BPlusTree&) = delete; // 禁用拷贝构造函数
+    BPlusTree& operator=(const BPlusTree&) = delete; // 禁用赋值运算符
+private:
+    explicit BPlusTree(long long bootUid);
+    long long rootUid(); // 读取当前根节点的地址
+    long long descend(const std::string& key,int level,std::vector<long long>* path); // 从根节点出发找到第level层中可能包含key的最左的节点，path按层记录经过的节点
+    void lockNode(long long uid);
+    void unlockNode(long long uid);
+    bool newRoot(Node& left,const std::string& separator,long long right); // left是根节点时为其生成新的根节点，返回false表示left已经不是根节点
+    void waitRoot(int level); // 等待根节点的层数不低于level：分裂了根节点的线程可能还没有在bootLock下发布新的根节点
+
+    long long bootUid; // boot的地址
+    std::mutex bootLock; // 修改根节点地址的锁
+    static const int nodeLockNumber=64; // 节点锁的个数，按uid散列
+    std::mutex nodeLocks[nodeLockNumber];
+};
+
+// 自底向上构建B-link树：按键的非降序逐个给出(key,uid)，先顺序写出所有叶子，再逐层写出内部节点，同一层的节点在文件中连续存放
+// 节点通过BulkInserter写出，每写满一页只记录一条页面日志；右兄弟的uid在写出节点之前由nextUid预知
+// 每个节点按fillFactor填充键的个数和Rest的字节数，为之后的插入留出空间；只有一层叶子需要边读边写，内部各层由下一层每个节点的(HighKey,uid)构成
+class TreeBuilder{
+public:
+    explicit TreeBuilder(double fillFactor=0.9,int keyLength=Node::integerKeyLength);
+    void add(long long key,long long uid); // 追加一对整数键和记录的uid，键必须不小于之前的键
+    void add(const std::string& key,long long uid); // 追加一对字节串键和记录的uid
+    long long finish(); // 写出所有剩余的节点以及boot，返回boot的uid
+
+    TreeBuilder(const TreeBuilder&) = delete; // 禁用拷贝构造函数
+    TreeBuilder& operator=(const TreeBuilder&) = delete; // 禁用赋值运算符
+private:
+    static int restOf(const std::string& key); // 键的Rest在没有前缀时的长度，是它在任何节点中的Rest长度的上界
+    // 用keys和sons中[begin,end)的项写出第level层的一个节点，last表示它是本层最右的节点；written为本层已经写出的节点的HighKey，返回其uid
+    long long write(int level,std::vector<std::string>& keys,std::vector<long long>& sons,int begin,int end,bool last,std::vector<std::string>& written);
+    void writeLeaf(bool last); // 写出正在填充的叶子，并将其(HighKey,uid)加入上一层
+
+    BulkInserter inserter; // 超级事务的批量插入器
+    int keyLength; // 树的最大键长
+    int fill; // 每个节点填充的键个数
+    int fillBytes; // 每个节点填充的Rest的字节数
+    std::vector<std::string> leafKeys; // 正在填充的叶子的键
+    std::vector<long long> leafSons; // 正在填充的叶子的记录uid
+    int leafBytes=0; // 正在填充的叶子的Rest字节数
+    bool hasKey=false; // 是否已经追加过键
+    std::string lastKey; // 上一个追加的键
+    std::vector<std::string> highKeys; // 上一层的键，即本层每个节点的HighKey
+    std::vector<long long> sons; // 上一层的儿子，即本层每个节点的uid
+};
+
+// B-link树的范围扫描迭代器，按键的顺序逐项返回[leftKey,rightKey]中的(key,uid)
+// 键直接取自叶子的拷贝（覆盖读），只需要键的查询不必再按uid读取记录
+// 迭代器保留叶子的父节点的拷贝，从中得到后续叶子的地址，在消费当前叶子的同时通过PageCache::prefetch预取之后若干个叶子所在的页面
+// 与查找一样只拷贝节点、不持有闩锁，扫描期间并发的插入不会被阻塞（扫描不保证看到扫描开始之后插入的键）
+class IndexIterator{
+public:
+    IndexIterator(BPlusTree& tree,long long leftKey,long long rightKey,int prefetchLeaves=8);
+    IndexIterator(BPlusTree& tree,const std::string& leftKey,const std::string& rightKey,int prefetchLeaves=8);
+    bool next(); // 移动到下一项，没有更多的项时返回false
+    long long getKey(); // 当前项的整数键
+    std::string getKeyBytes(); // 当前项的键的规范化形式
+    long long getUid(); // 当前项的记录uid
+private:
+    void prefetch(); // 补足预取窗口：从父节点中取出后续叶子的地址，预取其页面
+    void loadLeaf(long long uid);
+
+    BPlusTree& tree;
+    std::string leftKey;
+    std::string rightKey;
+    Node leaf; // 当前叶子的拷贝
+    int position=-1; // 当前项在叶子中的下标
+    int end=0; // 当前叶子中第一个大于rightKey的键的下标
+    bool finished=false; // 扫描是否已经结束
+    Node parent; // 后续叶子的父节点的拷贝
+    int parentPosition=0; // 下一个要预取的叶子在父节点中的下标
+    bool parentDone=true; // 父节点中（以及其右兄弟中）不再有需要预取的叶子
+    int window; // 预取窗口，即最多提前预取的叶子个数
+    int ahead=0; // 已经预取、尚未读到的叶子个数
+    long long lastPrefetched=0; // 最近一次预取的页号，避免同一页面上的多个叶子重复预取
+};
+
+// 可扩展哈希索引的桶，每个桶存放在一个DataItem中（由超级事务写入）
+// 桶结构：[LocalDepth] [Count] [Pattern] [Next] [Overflow] [Key0...KeyN-1] [Uid0...UidN-1]
+// LocalDepth 1字节，之后1字节填充，Count 2字节，之后4字节填充；Pattern 8字节，桶中所有键的哈希值的低LocalDepth位都等于Pattern；Next 8字节，为下一个桶的uid，所有桶串成一条链，打开索引时沿链重建目录
+// Overflow 8字节，为溢出桶链的第一个桶，没有时为0：桶满而分裂不能把任何键与新键分开时（例如大量重复的键），新键放入溢出桶
+// 溢出桶的结构与桶相同，只用Count、Overflow（链中的下一个溢出桶）和键，不在Next链和目录中；溢出桶中的键同样满足桶的模式
+class Bucket{
+public:
+    friend class HashIndex;
+    static const int capacity=64; // 桶最多存放的键个数
+    static const int headerSize=32; // 桶头部的长度
+    static const int bucketSize=headerSize+capacity*2*sizeof(long long); // 桶的长度
+
+    bool load(long long uid); // 读取uid处桶的拷贝，桶不存在时返回false
+    void store(); // 将桶写回其DataItem，记录一条超级事务的更新日志
+    std::vector<char> encode();
+    void decode(const char* data);
+private:
+    long long uid=0; // 桶所在的DataItem的地址
+    int localDepth=0;
+    int count=0;
+    long long pattern=0;
+    long long next=0;
+    long long overflow=0; // 溢出桶链的第一个桶
+    long long keys[capacity];
+    long long uids[capacity];
+};
+
+// 可扩展哈希索引，只支持等值查找，键允许重复；等值查找只需读一个桶（重复的键超过一个桶时再读其溢出桶），不需要从根节点下降
+// 目录缓存在内存中，第i项指向哈希值低globalDepth位等于i的键所在的桶；目录不落盘，打开索引时沿桶链重建
+// 桶满时只分裂这一个桶：先插入新桶，再在目录写锁下改写原来的桶并修改目录，需要时目录在内存中加倍；不会整体重新散列
+// 查找在目录读锁下读取桶，因此不会看到分裂到一半的桶；插入对桶加桶锁（同一时刻只持有一把），加锁后检查桶是否仍然对应该键的哈希值
+class HashIndex{
+public:
+    static long long create(); // 创建一个空的哈希索引，返回boot的uid
+    static std::shared_ptr<HashIndex> load(long long bootUid); // 打开boot为bootUid的哈希索引，沿桶链重建目录
+    void insert(long long key,long long uid); // 插入一对键和记录的uid
+    std::vector<long long> search(long long key); // 查找键等于key的所有记录的uid
+    long long getBootUid();
+    int getGlobalDepth();
+
+    HashIndex(const HashIndex&) = delete; // 禁用拷贝构造函数
+    HashIndex& operator=(const HashIndex&) = delete; // 禁用赋值运算符
+private:
+    explicit HashIndex(long long bootUid);
+    static unsigned long long hash(long long key); // 64位的哈希值
+    long long bucketOf(unsigned long long h); // 在目录读锁下查出哈希值h所在的桶
+    void lockBucket(long long uid);
+    void unlockBucket(long long uid);
+    static std::vector<Bucket> loadChain(Bucket& bucket); // 读出桶的溢出桶链
+    static bool separable(Bucket& bucket,std::vector<Bucket>& chain,unsigned long long h); // 按下一位分裂之后，是否有键与哈希值为h的新键分开
+    void split(Bucket& bucket,std::vector<Bucket>& chain); // 分裂一个满的桶，溢出桶中的键一起重新分配，调用者持有其桶锁
+    void spill(Bucket& bucket,std::vector<Bucket>& chain,long long key,long long uid); // 把键放入桶的溢出桶链，需要时新建一个溢出桶，调用者持有桶的桶锁
+    static long long writeChain(std::vector<std::pair<long long,long long>>& entries,int begin); // 把entries中从begin开始的项写入新的溢出桶链，返回链中第一个桶的uid
 
+    long long bootUid; // boot的地址，boot中保存桶链的第一个桶
+    int globalDepth=0; // 目录的全局深度
+    std::vector<long long> directory; // 目录，大小为2^globalDepth
+    std::shared_mutex directoryLock; // 目录的读写锁
+    static const int maxDepth=24; // 目录的最大全局深度
+    static const int bucketLockNumber=64; // 桶锁的个数，按uid散列
+    std::mutex bucketLocks[bucketLockNumber];
 };
 
 #endif
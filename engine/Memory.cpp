@@ -0,0 +1,101 @@
+#include "Memory.h"
+
+static std::shared_ptr<MemoryGovernor> memoryGovernor=nullptr;
+static std::mutex mutex;
+
+std::shared_ptr<MemoryGovernor> MemoryGovernor::instance(){
+    // 懒汉模式
+    // 使用双重检查保证线程安全
+    if(memoryGovernor==nullptr){
+        std::unique_lock<std::mutex> lock(mutex); // 访问临界区之前需要加锁
+        if(memoryGovernor==nullptr){
+            memoryGovernor=std::shared_ptr<MemoryGovernor>(new MemoryGovernor());
+        }
+    }
+    return memoryGovernor;
+}
+
+void MemoryGovernor::setBudget(long long bytes){
+    budget=bytes;
+}
+
+long long MemoryGovernor::getBudget(){
+    return budget.load();
+}
+
+long long MemoryGovernor::getUsed(){
+    return used.load();
+}
+
+int MemoryGovernor::addConsumer(const std::string& name,Shrinker shrinker){
+    std::unique_lock<std::mutex> lock(consumerLock);
+    int id=consumerNumber.load();
+    if(id==maxConsumers)throw "too many memory consumers";
+    consumers[id].name=name;
+    consumers[id].shrinker=shrinker;
+    consumerNumber=id+1;
+    return id;
+}
+
+bool MemoryGovernor::reserve(int consumer,long long bytes){
+    if(tryReserve(consumer,bytes))return true;
+    // 超出预算，逐个要求使用者释放内存
+    std::unique_lock<std::mutex> lock(shrinkLock);
+    if(tryReserve(consumer,bytes))return true; // 其他线程刚刚腾出了空间
+    while(true){
+        long long need=used.load()+bytes-budget.load();
+        long long freed=shrink(consumer,need);
+        if(tryReserve(consumer,bytes))return true;
+        // 腾出的空间可能被不经过shrinkLock的其他申请者先拿走（例如多个线程并发扫描），只要还能释放就继续
+        if(freed<=0)break;
+    }
+    consumers[consumer].failures++;
+    return false;
+}
+
+void MemoryGovernor::release(int consumer,long long bytes){
+    consumers[consumer].used-=bytes;
+    used-=bytes;
+}
+
+bool MemoryGovernor::tryReserve(int consumer,long long bytes){
+    long long limit=budget.load();
+    long long current=used.load();
+    do{
+        if(limit>0&&current+bytes>limit)return false;
+    }while(!used.compare_exchange_weak(current,current+bytes));
+    long long now=consumers[consumer].used+=bytes;
+    long long peak=consumers[consumer].peak.load();
+    while(now>peak&&!consumers[consumer].peak.compare_exchange_weak(peak,now));
+    return true;
+}
+
+long long MemoryGovernor::shrink(int consumer,long long bytes){
+    // 先按占用从大到小要求其他使用者释放，申请者自己排在最后（例如页面缓存最后才逐出自己未被引用的页面，保留自己的工作集）
+    int number=consumerNumber.load();
+    std::vector<int> order;
+    for(int i=0;i<number;i++){
+        if(i!=consumer&&consumers[i].shrinker!=nullptr)order.push_back(i);
+    }
+    std::sort(order.begin(),order.end(),[this](int a,int b){
+        return consumers[a].used.load()>consumers[b].used.load();
+    });
+    if(consumers[consumer].shrinker!=nullptr)order.push_back(consumer);
+    long long freed=0;
+    for(int i:order){
+        if(freed>=bytes)break;
+        long long n=consumers[i].shrinker(bytes-freed);
+        consumers[i].shrunk+=n;
+        freed+=n;
+    }
+    return freed;
+}
+
+std::vector<MemoryGovernor::ConsumerStat> MemoryGovernor::getStats(){
+    std::vector<ConsumerStat> stats;
+    int number=consumerNumber.load();
+    for(int i=0;i<number;i++){
+        stats.push_back({consumers[i].name,consumers[i].used.load(),consumers[i].peak.load(),consumers[i].shrunk.load(),consumers[i].failures.load()});
+    }
+    return stats;
+}
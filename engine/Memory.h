@@ -0,0 +1,61 @@
+#ifndef MEMORY
+#define MEMORY
+
+#include <vector>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <functional>
+#include <algorithm>
+
+// 内存管理器：整个引擎共用一份内存预算，在页面缓存、DataItem缓存、Entry缓存以及索引、排序等缓冲区之间动态分配
+// 每个使用者先登记自己，并提供一个压力回调：回调被要求释放若干字节，返回实际释放的字节数（例如逐出未被引用的页面）
+// 使用者申请内存超出预算时，管理器按占用从大到小依次调用其他使用者的压力回调，最后才调用申请者自己的，腾出空间后再分配，仍然不够时申请失败
+class MemoryGovernor{
+public:
+    using Shrinker=std::function<long long(long long)>; // 压力回调，参数为需要释放的字节数，返回实际释放的字节数
+    // 一个使用者的占用统计
+    struct ConsumerStat{
+        std::string name; // 使用者名称
+        long long used; // 当前占用的字节数
+        long long peak; // 占用的峰值
+        long long shrunk; // 被压力回调释放的字节数
+        long long failures; // 申请失败的次数
+    };
+
+    static std::shared_ptr<MemoryGovernor> instance(); // 获取MemoryGovernor的单例对象
+    void setBudget(long long bytes); // 设置内存预算
+    long long getBudget();
+    long long getUsed(); // 所有使用者的总占用
+    int addConsumer(const std::string& name,Shrinker shrinker=nullptr); // 登记一个使用者，返回其编号；没有可释放内存的使用者可以不提供压力回调
+    bool reserve(int consumer,long long bytes); // 使用者申请bytes字节，必要时调用压力回调腾出空间，仍然不够时返回false
+    bool tryReserve(int consumer,long long bytes); // 不调用压力回调，只在预算内还有空间时申请（例如预读这类可有可无的申请）
+    void release(int consumer,long long bytes); // 使用者归还bytes字节
+    std::vector<ConsumerStat> getStats(); // 获取各使用者的占用统计
+
+    MemoryGovernor(const MemoryGovernor&) = delete; // 禁用拷贝构造函数
+    MemoryGovernor& operator=(const MemoryGovernor&) = delete; // 禁用赋值运算符
+private:
+    MemoryGovernor() = default; // 禁用外部构造
+    long long shrink(int consumer,long long bytes); // 依次调用压力回调，直到释放了bytes字节；申请者consumer自己的回调最后调用
+
+    // 一个使用者
+    struct Consumer{
+        std::string name;
+        Shrinker shrinker;
+        std::atomic<long long> used{0};
+        std::atomic<long long> peak{0};
+        std::atomic<long long> shrunk{0};
+        std::atomic<long long> failures{0};
+    };
+    static const int maxConsumers=32; // 最多可登记的使用者个数
+    Consumer consumers[maxConsumers];
+    std::atomic<int> consumerNumber{0};
+    std::atomic<long long> budget{0}; // 内存预算，为0表示不限制
+    std::atomic<long long> used{0}; // 总占用
+    std::mutex consumerLock; // 登记使用者的锁
+    std::mutex shrinkLock; // 同一时刻只有一个线程调用压力回调
+};
+
+#endif
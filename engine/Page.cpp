@@ -1,11 +1,27 @@
 #include "Page.h"
 
 Page::Page(long long pageNumber, std::vector<char>& data,int pageSize):pageNumber(pageNumber){
-    this->data.resize(pageSize);
-    std::copy(data.begin(),data.end(),this->data.begin());
+    this->storage.resize(pageSize);
+    std::copy(data.begin(),data.end(),this->storage.begin());
+    this->data=&(this->storage[0]);
     this->dirty=false;
 }
 
+Page::Page(long long pageNumber,char* frame):pageNumber(pageNumber),data(frame),frame(frame){
+    this->dirty=false;
+}
+
+void Page::reset(long long pageNumber,char* frame){
+    this->pageNumber=pageNumber;
+    this->data=frame;
+    this->frame=frame;
+    this->dirty=false;
+}
+
+char* Page::getFrame(){
+    return this->frame;
+}
+
 void Page::setDirty(bool dirty) {
     this->dirty=dirty;
 }
@@ -19,7 +35,23 @@ long long Page::getPageNumber() {
 }
 
 char* Page::getData() {
-    return &(this->data[0]);
+    return this->data;
+}
+
+void Page::readLatch() {
+    latch.lock_shared();
+}
+
+void Page::readUnlatch() {
+    latch.unlock_shared();
+}
+
+void Page::writeLatch() {
+    latch.lock();
+}
+
+void Page::writeUnlatch() {
+    latch.unlock();
 }
 
 void PageManager::initFirstPage(Page* page) {
@@ -46,6 +78,10 @@ bool PageManager::check(Page* firstPage) {
     return true;
 }
 
+bool PageManager::isInitialized(Page* page) {
+    return getFSO(page)>=offsetLength;
+}
+
 void PageManager::initPage(Page *page) {
     // FSO的初值设置为offsetLength
     setFSO(page,offsetLength);
@@ -77,8 +113,8 @@ void PageManager::updateData(Page* page,std::vector<char>& data,int start){
     page->setDirty(true);
     std::copy(data.begin(),data.end(),page->getData()+start);
     short oldOffset= getFSO(page);
-    // 如果更新后数据的总长度大于旧数据的总长度，则需要更新偏移
-    setFSO(page,std::max((int)oldOffset,(int)(offsetLength+start+data.size())));
+    // 如果更新后数据的总长度大于旧数据的总长度，则需要更新偏移（start为页内的绝对偏移）
+    setFSO(page,std::max((int)oldOffset,(int)(start+data.size())));
 }
 
 int PageManager::getFreeSpaceSize(Page* page){
@@ -100,19 +136,83 @@ std::shared_ptr<PageCache> PageCache::instance(){
     return pageCache;
 }
 
-void PageCache::init(long long memory) {
+void PageCache::init(long long memory,bool hugePages,FrameArena::NumaPolicy policy) {
     this->maxPageNumber=memory/pageSize;
-    if(!std::ifstream(".db").good()){
-        // DB文件不存在时，需要创建一个新文件
-        std::ofstream temp;
-        temp.open(".db", std::ios::out|std::ios::binary);
-        temp.close();
+    // 没有单独设置内存预算时，以memory作为整个引擎的预算；页面缓存在预算不足时逐出未被引用的页面
+    memoryGovernor=MemoryGovernor::instance();
+    if(memoryGovernor->getBudget()==0)memoryGovernor->setBudget(memory);
+    memoryConsumer=memoryGovernor->addConsumer("page",[this](long long bytes){
+        return evict(bytes);
+    });
+    frames.init(maxPageNumber+prefetchCapacity,pageSize,hugePages,policy); // 预读的页面另外占用页帧
+    // DB文件不存在时会创建一个新文件
+    int flags=O_RDWR|O_CREAT;
+#ifdef O_DIRECT
+    if(mode==direct){
+        fd=open(".db",flags|O_DIRECT,0644);
+        if(fd<0)mode=buffered; // 文件系统不支持O_DIRECT（例如tmpfs）
     }
-    file.open(".db", std::ios::in|std::ios::out|std::ios::binary);
+#else
+    mode=buffered;
+#endif
+    if(fd<0)fd=open(".db",flags,0644);
+    if(fd<0)throw "failed to open .db";
     // 获取文件大小
-    file.seekg(0,std::ios::end); //设置文件指针到文件流的尾部
-    long long size = file.tellg(); //读取文件指针的位置
-    pageNumbers=size/pageSize;
+    struct stat st;
+    fstat(fd,&st);
+    pageNumbers=st.st_size/pageSize;
+    openSlots(st.st_size==0);
+    if(mode==mapped)mapFile();
+}
+
+void PageCache::mapFile(){
+#ifdef __linux__
+    // 预留一段不可访问的地址空间，文件的每一部分都映射在其中的固定位置，文件变长时在原地扩展映射，已获取的页面地址不变
+    long long fileLength=pageNumbers.load()*2*pageSize;
+    mapReserved=fileLength>minMapReserved?fileLength:minMapReserved;
+    void* p=mmap(nullptr,mapReserved,PROT_NONE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE,-1,0);
+    if(p==MAP_FAILED){
+        mode=buffered;
+        return;
+    }
+    mapBase=static_cast<char*>(p);
+    std::unique_lock<std::mutex> lock(fileLock);
+    extendMapping(pageNumbers.load());
+#else
+    mode=buffered;
+#endif
+}
+
+void PageCache::extendMapping(long long pageNumber){
+#ifdef __linux__
+    long long mapped=mappedPages.load();
+    if(mapBase==nullptr||pageNumber<=mapped)return;
+    if(pageNumber*pageSize>mapReserved)pageNumber=mapReserved/pageSize; // 超出预留空间的页面从文件读入页帧
+    void* p=mmap(mapBase+mapped*pageSize,(pageNumber-mapped)*pageSize,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_FIXED,fd,mapped*pageSize);
+    if(p!=MAP_FAILED)mappedPages.store(pageNumber);
+#endif
+}
+
+void PageCache::shrinkMapping(long long pageNumber){
+#ifdef __linux__
+    long long mapped=mappedPages.load();
+    if(mapBase==nullptr||pageNumber>=mapped)return;
+    // 文件末尾之后的映射访问会产生SIGBUS，换回不可访问的匿名映射
+    mappedPages.store(pageNumber);
+    mmap(mapBase+pageNumber*pageSize,(mapped-pageNumber)*pageSize,PROT_NONE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE|MAP_FIXED,-1,0);
+#endif
+}
+
+bool PageCache::isMapped(Page* page){
+    return mapBase!=nullptr&&page->getData()>=mapBase&&page->getData()<mapBase+mapReserved;
+}
+
+void PageCache::setFileMode(FileMode mode){
+    this->mode=mode;
+}
+
+PageCache::FileMode PageCache::getFileMode(){
+    return mode;
 }
 
 long long PageCache::getPageNumbers(){
@@ -132,98 +232,823 @@ Page* PageCache::get(long long pageNumber) {
         if(cache.find(pageNumber)!=cache.end()){
             // 没有其他线程正在获取且页面在缓存中
             Page* data=cache[pageNumber];
-            references[pageNumber]++;
+            if(references[pageNumber]++==0)removeUnpinned(data); // 未被引用的页面重新被引用
             resourceLock.unlock();
             return data;
         }
-        if(count==maxPageNumber){
-            // 如果缓存已满则抛出异常
-            resourceLock.unlock();
-            throw "cache is full!";
-        }
-        // 如果该页面没有正被获取，且没有在缓存中，且缓存未满；则将该资源加入到缓存中
-        count++;
+        // 如果该页面没有正被获取，且没有在缓存中；则将该资源加入到缓存中
         getting.insert(std::pair<long long,bool>(pageNumber,true));
         resourceLock.unlock();
         break;
     }
 
-    Page* data=getForCache(pageNumber);
+    // 向MemoryGovernor申请页面的内存，预算不足时会逐出未被引用的页面，仍然不足则抛出异常
+    Page* data=nullptr;
+    try{
+        if(!memoryGovernor->reserve(memoryConsumer,pageSize))throw "cache is full!";
+        try{
+            data=getForCache(pageNumber);
+        }catch(const char* e){
+            memoryGovernor->release(memoryConsumer,pageSize);
+            throw;
+        }
+    }catch(const char* e){
+        std::unique_lock<std::mutex> lock(resourceLock);
+        getting.erase(pageNumber);
+        throw;
+    }
     std::unique_lock<std::mutex> lock(resourceLock);
     getting.erase(pageNumber);
     cache.insert(std::pair<long long,Page*>(pageNumber,data));
     references.insert(std::pair<long long,int>(pageNumber,1));
+    count++;
     return data;
 }
 
 void PageCache::release(long long pageNumber) {
     std::unique_lock<std::mutex> lock(resourceLock);
     int ref=references[pageNumber]-1; // 该资源当前的引用计数
-    if(ref!=0){
-        references[pageNumber]=ref;
-    }else{
-        // 引用计数减为0，应将该资源逐出
-        Page* data=cache[pageNumber];
-        releaseForCache(data);
-        references.erase(pageNumber);
-        cache.erase(pageNumber);
-        count--;
+    references[pageNumber]=ref;
+    if(ref==0){
+        // 引用计数减为0，页面留在缓存中，内存不足时再逐出
+        pushUnpinned(cache[pageNumber]);
+    }
+}
+
+long long PageCache::evict(long long bytes){
+    long long freed=0;
+    {
+        std::unique_lock<std::mutex> lock(resourceLock);
+        while(freed<bytes&&unpinnedTail!=nullptr){
+            Page* page=unpinnedTail;
+            long long pageNumber=page->getPageNumber();
+            removeUnpinned(page);
+            references.erase(pageNumber);
+            cache.erase(pageNumber);
+            count--;
+            char* frame=isMapped(page)?nullptr:page->getFrame();
+            if(frame!=nullptr)page->frame=nullptr; // 页帧在下面归还，并把物理内存还给系统
+            releaseForCache(page);
+            frames.release(frame,true);
+            freed+=pageSize;
+        }
+    }
+    if(freed<bytes){
+        // 再丢弃预读的页面
+        std::unique_lock<std::mutex> prefetch(prefetchLock);
+        while(freed<bytes&&!prefetchOrder.empty()){
+            auto iter=prefetched.find(prefetchOrder.front());
+            prefetchOrder.pop_front();
+            if(iter==prefetched.end())continue;
+            freePrefetchFrame(iter->second);
+            prefetched.erase(iter);
+            prefetchWasted++;
+            freed+=pageSize;
+        }
+    }
+    return freed;
+}
+
+void PageCache::pushUnpinned(Page* page){
+    page->prev=nullptr;
+    page->next=unpinnedHead;
+    if(unpinnedHead!=nullptr)unpinnedHead->prev=page;
+    unpinnedHead=page;
+    if(unpinnedTail==nullptr)unpinnedTail=page;
+}
+
+void PageCache::removeUnpinned(Page* page){
+    if(page->prev!=nullptr)page->prev->next=page->next;
+    else unpinnedHead=page->next;
+    if(page->next!=nullptr)page->next->prev=page->prev;
+    else unpinnedTail=page->prev;
+    page->prev=nullptr;
+    page->next=nullptr;
+}
+
+void PageCache::dropUnpinned(Page* page){
+    long long pageNumber=page->getPageNumber();
+    removeUnpinned(page);
+    references.erase(pageNumber);
+    cache.erase(pageNumber);
+    count--;
+    page->setDirty(false);
+    releaseForCache(page);
+}
+
+char* PageCache::acquireFrame(){
+    char* frame=frames.acquire();
+    if(frame==nullptr){
+        // 预算比页帧多时，页帧可能先用完
+        evict(pageSize);
+        frame=frames.acquire();
     }
+    if(frame==nullptr)throw "cache is full!";
+    return frame;
+}
+
+char* PageCache::acquirePrefetchFrame(){
+    if(!memoryGovernor->tryReserve(memoryConsumer,pageSize))return nullptr;
+    char* frame=frames.acquire();
+    if(frame==nullptr)memoryGovernor->release(memoryConsumer,pageSize);
+    return frame;
+}
+
+void PageCache::freePrefetchFrame(char* frame){
+    frames.release(frame);
+    memoryGovernor->release(memoryConsumer,pageSize);
 }
 
 Page* PageCache::getForCache(long long key){
     // 将key作为pageNumber使用
     long long offset = (key-1)*pageSize; // 计算页面偏移
-    std::unique_lock<std::mutex> lock(fileLock);
-    file.seekg(offset);
-    std::vector<char> data(pageSize);
-    file.read(&(data[0]),pageSize);
-    return new Page(key,data,pageSize);
+    if(isCompressed(key)){
+        // 压缩存放的页面总是解压到页帧中
+        char* frame=acquireFrame();
+        if(readSlot(key,frame)){
+            missReads++;
+            Page* page=ObjectPool<Page>::acquire();
+            page->reset(key,frame);
+            return page;
+        }
+        frames.release(frame);
+    }
+    if(mode==mapped&&key<=mappedPages.load()){
+        // 页面直接位于映射中，不需要读文件；顺序访问时提示内核提前读入后续页面
+        int number=readaheadLength(key);
+        if(number>0){
+#ifdef __linux__
+            long long last=std::min(key+number,mappedPages.load());
+            madvise(mapBase+key*pageSize,(last-key)*pageSize,MADV_WILLNEED);
+#endif
+        }
+        Page* page=ObjectPool<Page>::acquire();
+        page->reset(key,mapBase+offset);
+        return page;
+    }
+    Page* page=ObjectPool<Page>::acquire();
+    char* frame=takePrefetched(key);
+    if(frame!=nullptr){
+        prefetchHits++;
+        memoryGovernor->release(memoryConsumer,pageSize); // 预读时已经为该页帧申请过内存
+
+        page->reset(key,frame);
+        return page;
+    }
+    try{
+        frame=acquireFrame();
+    }catch(const char* e){
+        ObjectPool<Page>::release(page);
+        throw;
+    }
+    page->reset(key,frame);
+    missReads++;
+    int number=readaheadLength(key);
+    std::vector<long long> claimed;
+    if(number>0)claimed=claimPrefetch(key,number);
+    if(claimed.empty()){
+        readAt(offset,page->getData(),pageSize); // 直接读入页面缓冲区
+        return page;
+    }
+    // 把当前页面和预读的页面用一次读入
+    long long generation=writeGeneration.load();
+    std::vector<char*> buffers(1,frame);
+    for(int i=0;i<(int)claimed.size();i++){
+        char* f=acquirePrefetchFrame();
+        if(f==nullptr)break;
+        buffers.push_back(f);
+    }
+    readPages(key,buffers.data(),buffers.size());
+    installPrefetched(claimed,buffers.data()+1,buffers.size()-1,generation);
+    return page;
+}
+
+void PageCache::installPrefetched(const std::vector<long long>& claimed,char** buffers,int number,long long generation){
+    std::unique_lock<std::mutex> lock(resourceLock);
+    std::unique_lock<std::mutex> prefetch(prefetchLock);
+    for(int i=0;i<number;i++){
+        if(generation!=writeGeneration.load()){
+            // 读入期间有页面被直接写入文件，预读的内容可能已经过时
+            freePrefetchFrame(buffers[i]);
+            prefetchWasted++;
+            continue;
+        }
+        prefetched[claimed[i]]=buffers[i];
+        prefetchOrder.push_back(claimed[i]);
+        prefetchedPages++;
+    }
+    for(long long pageNumber:claimed)getting.erase(pageNumber); // 页帧不足而没有读入的页面也一并撤销标记
+}
+
+void PageCache::prefetch(long long first,int number){
+    if(number<=0||first<1)return;
+    long long last=first+number-1;
+    if(mode==mapped){
+#ifdef __linux__
+        long long mappedLast=mappedPages.load();
+        if(last>mappedLast)last=mappedLast;
+        if(last>=first)madvise(mapBase+(first-1)*pageSize,(last-first+1)*pageSize,MADV_WILLNEED);
+#endif
+        return;
+    }
+    if(mode==buffered){
+        // 由内核异步读入操作系统的页面缓存，之后缺页时的读取不再等待磁盘
+#ifdef __linux__
+        posix_fadvise(fd,(first-1)*pageSize,(long long)number*pageSize,POSIX_FADV_WILLNEED);
+#endif
+        return;
+    }
+    // O_DIRECT绕过了内核缓存，交给预读线程读入，调用者不等待
+    std::unique_lock<std::mutex> lock(requestLock);
+    if(!prefetcher.joinable())prefetcher=std::thread(&PageCache::prefetchLoop,this);
+    if(!prefetchRequests.empty()&&prefetchRequests.back().first+prefetchRequests.back().second==first&&prefetchRequests.back().second+number<=maxPrefetchRun){
+        // 索引扫描逐个叶子预取，相邻的页面合并成一次读入
+        prefetchRequests.back().second+=number;
+    }else if((int)prefetchRequests.size()<maxPrefetchRequests){
+        prefetchRequests.push_back({first,number});
+    }else{
+        return;
+    }
+    lock.unlock();
+    requestWake.notify_one();
+}
+
+void PageCache::prefetchLoop(){
+    while(true){
+        std::unique_lock<std::mutex> lock(requestLock);
+        requestWake.wait(lock,[this]{return prefetcherStopping||!prefetchRequests.empty();});
+        if(prefetcherStopping)return;
+        std::pair<long long,int> request=prefetchRequests.front();
+        prefetchRequests.pop_front();
+        lock.unlock();
+        try{
+            readAhead(request.first,request.second);
+        }catch(const char* e){
+            // 预读只是提示，读失败时丢弃，之后真正的读取会再报告错误
+        }
+    }
+}
+
+void PageCache::readAhead(long long first,int number){
+    // 合并后的请求中间可能有已经在缓存中的页面，跳过它们，其余每段连续的页面各读一次
+    long long last=first+number-1;
+    while(first<=last){
+        std::vector<long long> claimed=claimPrefetch(first-1,last-first+1);
+        if(claimed.empty()){
+            first++;
+            continue;
+        }
+        first=claimed.back()+1;
+        long long generation=writeGeneration.load();
+        std::vector<char*> buffers;
+        for(int i=0;i<(int)claimed.size();i++){
+            char* f=acquirePrefetchFrame();
+            if(f==nullptr)break;
+            buffers.push_back(f);
+        }
+        try{
+            if(!buffers.empty())readPages(claimed[0],buffers.data(),buffers.size());
+        }catch(const char* e){
+            for(char* f:buffers)freePrefetchFrame(f);
+            installPrefetched(claimed,buffers.data(),0,generation); // 撤销正在获取的标记
+            throw;
+        }
+        installPrefetched(claimed,buffers.data(),buffers.size(),generation);
+        if(buffers.size()<claimed.size())return; // 预读页帧不足，放弃剩余的页面
+    }
 }
 
 void PageCache::releaseForCache(Page* page){
     if(page->isDirty()){ // 如果是脏页需要刷回磁盘
         flush(page);
-        delete page;
+#ifdef __linux__
+        // 私有副本已经写入文件，丢弃它以归还内存，之后的访问重新映射到文件内容
+        if(isMapped(page))madvise(page->getData(),pageSize,MADV_DONTNEED);
+#endif
+    }
+    if(!isMapped(page))frames.release(page->getFrame());
+    memoryGovernor->release(memoryConsumer,pageSize);
+    ObjectPool<Page>::release(page);
+}
+
+void PageCache::setReadahead(int pages){
+    readahead=pages;
+}
+
+void PageCache::scanHint(long long first,long long last){
+    std::unique_lock<std::mutex> lock(prefetchLock);
+    scanHints.push_back({first,last});
+}
+
+void PageCache::clearScanHint(long long first,long long last){
+    std::unique_lock<std::mutex> lock(prefetchLock);
+    auto iter=std::find(scanHints.begin(),scanHints.end(),std::pair<long long,long long>(first,last));
+    if(iter!=scanHints.end())scanHints.erase(iter);
+}
+
+PageCache::PrefetchStats PageCache::getPrefetchStats(){
+    return {missReads.load(),prefetchedPages.load(),prefetchHits.load(),prefetchWasted.load()};
+}
+
+int PageCache::readaheadLength(long long key){
+    // 每个线程分别检测自己的访问是否连续，多个扫描并发时互不干扰
+    static thread_local long long lastMiss=-1;
+    static thread_local int run=0;
+    if(key!=lastMiss){
+        // 同一页面上的多次缺页（页面在两次访问之间被逐出）不打断顺序
+        run=(key==lastMiss+1)?run+1:0;
+        lastMiss=key;
+    }
+    int number=readahead.load();
+    if(number<=0)return 0;
+    {
+        std::unique_lock<std::mutex> lock(prefetchLock);
+        for(auto& hint:scanHints){
+            if(key>=hint.first&&key<hint.second){
+                return (int)std::min((long long)number,hint.second-key);
+            }
+        }
+    }
+    return run>=sequentialThreshold?number:0;
+}
+
+std::vector<long long> PageCache::claimPrefetch(long long key,int number){
+    std::vector<long long> claimed;
+    std::unique_lock<std::mutex> lock(resourceLock);
+    std::unique_lock<std::mutex> prefetch(prefetchLock);
+    // 先丢弃最早的预读页面，为这次预读腾出位置
+    while((int)prefetched.size()+number>prefetchCapacity&&!prefetchOrder.empty()){
+        auto iter=prefetched.find(prefetchOrder.front());
+        prefetchOrder.pop_front();
+        if(iter==prefetched.end())continue; // 已经被取走
+        freePrefetchFrame(iter->second);
+        prefetched.erase(iter);
+        prefetchWasted++;
+    }
+    if(prefetchOrder.size()>2*(size_t)prefetchCapacity){
+        // 清理已经被取走的页号
+        std::deque<long long> order;
+        for(long long pageNumber:prefetchOrder){
+            if(prefetched.count(pageNumber)!=0)order.push_back(pageNumber);
+        }
+        prefetchOrder.swap(order);
+    }
+    long long last=pageNumbers.load();
+    for(long long pageNumber=key+1;pageNumber<=key+number&&pageNumber<=last;pageNumber++){
+        // 遇到已经在缓存中、正被获取或已预读的页面就停止，保证一次读入的页面连续
+        if(cache.count(pageNumber)!=0||getting.count(pageNumber)!=0||prefetched.count(pageNumber)!=0)break;
+        if(isCompressed(pageNumber))break; // 压缩页面在.db中的位置是空洞
+        getting.insert(std::pair<long long,bool>(pageNumber,true));
+        claimed.push_back(pageNumber);
+    }
+    return claimed;
+}
+
+char* PageCache::takePrefetched(long long key){
+    std::unique_lock<std::mutex> lock(prefetchLock);
+    auto iter=prefetched.find(key);
+    if(iter==prefetched.end())return nullptr;
+    char* frame=iter->second;
+    prefetched.erase(iter);
+    return frame;
+}
+
+void PageCache::dropPrefetched(long long first,long long last){
+    std::unique_lock<std::mutex> lock(prefetchLock);
+    if(prefetched.empty())return;
+    for(long long pageNumber=first;pageNumber<=last;pageNumber++){
+        auto iter=prefetched.find(pageNumber);
+        if(iter==prefetched.end())continue;
+        freePrefetchFrame(iter->second);
+        prefetched.erase(iter);
+        prefetchWasted++;
+    }
+}
+
+void PageCache::readPages(long long firstPageNumber,char** buffers,int number){
+    std::vector<struct iovec> iov(number);
+    for(int i=0;i<number;i++){
+        iov[i].iov_base=buffers[i];
+        iov[i].iov_len=pageSize;
+    }
+    long long offset=(firstPageNumber-1)*pageSize;
+    long long n=preadv(fd,iov.data(),number,offset);
+    if(n<0)n=0;
+    // 短读时逐页补齐：完整读到的页面跳过，其余页面单独读，文件末尾之后的部分填0
+    for(int i=n/pageSize;i<number;i++){
+        readAt(offset+(long long)i*pageSize,buffers[i],pageSize);
     }
 }
 
 long long PageCache::newPage(std::vector<char>& data) {
-    pageNumbers++;
-    long long pageNumber = pageNumbers;
-    Page page(pageNumber,data,pageSize);
-    flush(&page);
-    return pageNumber;
+    return newPages(data);
+}
+
+long long PageCache::newPages(std::vector<char>& data) {
+    int number=(data.size()+pageSize-1)/pageSize;
+    data.resize((long long)number*pageSize);
+    long long firstPageNumber=reservePages(number);
+    writePages(firstPageNumber,&(data[0]),number);
+    return firstPageNumber;
+}
+
+long long PageCache::reservePages(int number) {
+    return pageNumbers.fetch_add(number)+1;
+}
+
+void PageCache::writePages(long long firstPageNumber,const char* data,int number) {
+    long long offset = (firstPageNumber-1)*pageSize; // 第一个页面的偏移
+    writeAt(offset,data,(long long)number*pageSize);
+    // 预留页面可能已被预读为全0；先递增写代数，使正在进行的预读作废，再丢弃已有的预读页面
+    writeGeneration++;
+    dropPrefetched(firstPageNumber,firstPageNumber+number-1);
+    {
+        // 缓存中未被引用的旧页面也已经过时
+        std::unique_lock<std::mutex> lock(resourceLock);
+        for(long long pageNumber=firstPageNumber;pageNumber<firstPageNumber+number;pageNumber++){
+            auto iter=cache.find(pageNumber);
+            if(iter!=cache.end()&&references[pageNumber]==0)dropUnpinned(iter->second);
+        }
+    }
+    if(mode==mapped){
+        std::unique_lock<std::mutex> lock(fileLock);
+        struct stat st;
+        fstat(fd,&st);
+        extendMapping(st.st_size/pageSize);
+    }
 }
 
 void PageCache::truncate(long long newPageNumber) {
     long long size=newPageNumber*pageSize;
+    {
+        // 截掉的页面如果还在缓存中（未被引用），直接丢弃
+        std::unique_lock<std::mutex> lock(resourceLock);
+        Page* page=unpinnedHead;
+        while(page!=nullptr){
+            Page* next=page->next;
+            if(page->getPageNumber()>newPageNumber)dropUnpinned(page);
+            page=next;
+        }
+    }
     std::unique_lock<std::mutex> lock(fileLock);
-    // 获取文件原始大小
-    file.seekg(0,std::ios::end); //设置文件指针到文件流的尾部
-    long long oldSize = file.tellg(); //读取文件指针的位置
-    char* temp=new char[size-oldSize];
-    file.seekp(0,std::ios::end); //设置文件指针到文件流的尾部
-    file.write(temp,size-oldSize);
-    delete[] temp;
+    // 扩展时新增的部分全为0；缩小时截掉的都是日志之外的页面（例如批量插入预留但未用到的页面），都是空页面
+    if(mode==mapped)shrinkMapping(newPageNumber);
+    if(ftruncate(fd,size)!=0)throw "failed to truncate .db";
+    if(mode==mapped)extendMapping(newPageNumber);
+    writeGeneration++;
+    dropPrefetched(std::min(newPageNumber,pageNumbers.load())+1,std::max(newPageNumber,pageNumbers.load()));
+    {
+        // 截掉的页面如果压缩存放，也释放其槽
+        std::unique_lock<std::mutex> slot(slotLock);
+        for(long long pageNumber=newPageNumber+1;pageNumber<=pageNumbers.load();pageNumber++){
+            freeSlot(pageNumber);
+        }
+    }
     pageNumbers.store(newPageNumber);
 }
 
 void PageCache::flush(Page* page) {
     long long offset = (page->getPageNumber()-1)*pageSize; // 页面偏移
-    std::unique_lock<std::mutex> lock(fileLock);
-    file.seekp(offset);
-    file.write(page->getData(),pageSize);
-    file.flush();
+    if(shouldCompress(page)&&writeSlot(page)){
+#if defined(__linux__)&&defined(FALLOC_FL_PUNCH_HOLE)
+        // 页面已经压缩存放，.db中原来的位置打洞以释放磁盘空间
+        fallocate(fd,FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,offset,pageSize);
+#endif
+        page->setDirty(false);
+        return;
+    }
+    writeAt(offset,page->getData(),pageSize);
+    if(isCompressed(page->getPageNumber())){
+        // 页面改回原样存放（不再压缩或压缩不划算），释放原来的槽
+        std::unique_lock<std::mutex> lock(slotLock);
+        freeSlot(page->getPageNumber());
+    }
+    page->setDirty(false);
+}
+
+void PageCache::setCompression(bool enable){
+    compression=enable;
+}
+
+void PageCache::setPageCompression(long long pageNumber,bool enable){
+    std::unique_lock<std::mutex> lock(slotLock);
+    pageCompression[pageNumber]=enable;
+}
+
+void PageCache::setCompressionPolicy(CompressionPolicy policy){
+    std::unique_lock<std::mutex> lock(slotLock);
+    compressionPolicy=std::move(policy);
+}
+
+PageCache::CompressionStats PageCache::getCompressionStats(){
+    std::unique_lock<std::mutex> lock(slotLock);
+    return {(long long)slots.size(),(long long)slots.size()*pageSize,storedBytes};
+}
+
+void PageCache::openSlots(bool create){
+    slotFd=open(".dbz",O_RDWR|O_CREAT|(create?O_TRUNC:0),0644);
+    if(slotFd<0)throw "failed to open .dbz";
+    struct stat st;
+    fstat(slotFd,&st);
+    long long size=st.st_size;
+    long long offset=0;
+    std::vector<char> buffer(pageSize);
+    while(offset+(long long)sizeof(SlotHeader)<=size){
+        SlotHeader header;
+        if(pread(slotFd,&header,sizeof(header),offset)!=(long long)sizeof(header))break;
+        if(header.capacity<=0||header.capacity%slotAlign!=0||header.capacity>pageSize||offset+header.capacity>size)break; // 写了一半的槽
+        bool valid=header.pageNumber!=0&&header.length>0&&header.length+(int)sizeof(SlotHeader)<=header.capacity;
+        if(valid){
+            valid=pread(slotFd,&(buffer[0]),header.length,offset+sizeof(SlotHeader))==header.length
+                &&slotChecksum(&(buffer[0]),header.length)==header.checksum;
+        }
+        if(valid){
+            auto iter=slots.find(header.pageNumber);
+            if(iter==slots.end()||iter->second.seq<header.seq){
+                if(iter!=slots.end()){
+                    freeSlots[iter->second.capacity].push_back(iter->second.offset);
+                    storedBytes-=iter->second.capacity;
+                }
+                slots[header.pageNumber]={offset,header.capacity,header.length,header.seq};
+                storedBytes+=header.capacity;
+            }else{
+                freeSlots[header.capacity].push_back(offset);
+            }
+            slotSeq=std::max(slotSeq,header.seq);
+        }else{
+            freeSlots[header.capacity].push_back(offset);
+        }
+        offset+=header.capacity;
+    }
+    if(offset<size&&ftruncate(slotFd,offset)!=0)throw "failed to truncate .dbz"; // 截掉不完整的尾部
+    slotFileEnd=offset;
+}
+
+bool PageCache::shouldCompress(Page* page){
+    long long pageNumber=page->getPageNumber();
+    if(pageNumber==1)return false; // 第一页用于有效性检查，总是原样存放
+    std::unique_lock<std::mutex> lock(slotLock);
+    auto iter=pageCompression.find(pageNumber);
+    if(iter!=pageCompression.end())return iter->second;
+    if(compressionPolicy&&compressionPolicy(page->getData()))return true;
+    return compression.load();
+}
+
+bool PageCache::isCompressed(long long pageNumber){
+    std::unique_lock<std::mutex> lock(slotLock);
+    return slots.count(pageNumber)!=0;
+}
+
+bool PageCache::readSlot(long long pageNumber,char* data){
+    std::unique_lock<std::mutex> lock(slotLock);
+    auto iter=slots.find(pageNumber);
+    if(iter==slots.end())return false;
+    Slot slot=iter->second;
+    char buffer[pageSize];
+    if(pread(slotFd,buffer,slot.length,slot.offset+sizeof(SlotHeader))!=slot.length)throw "failed to read .dbz";
+    lock.unlock();
+    if(Compressor::decompress(buffer,slot.length,data,pageSize)!=pageSize)throw "corrupted compressed page";
+    return true;
+}
+
+bool PageCache::writeSlot(Page* page){
+    char buffer[pageSize];
+    int headerLength=sizeof(SlotHeader);
+    // 压缩后至少要节省一个对齐单位才值得压缩存放
+    int length=Compressor::compress(page->getData(),pageSize,buffer+headerLength,pageSize-slotAlign-headerLength+1);
+    if(length<0)return false;
+    int capacity=(headerLength+length+slotAlign-1)/slotAlign*slotAlign;
+    SlotHeader header={page->getPageNumber(),0,capacity,length,slotChecksum(buffer+headerLength,length),0};
+
+    std::unique_lock<std::mutex> lock(slotLock);
+    // 总是写入新槽，写完之后再释放旧槽，崩溃时旧槽仍然完整
+    long long offset;
+    std::vector<long long>& free=freeSlots[capacity];
+    if(!free.empty()){
+        offset=free.back();
+        free.pop_back();
+    }else{
+        offset=slotFileEnd;
+        slotFileEnd+=capacity;
+    }
+    header.seq=++slotSeq;
+    std::copy(reinterpret_cast<char*>(&header),reinterpret_cast<char*>(&header)+headerLength,buffer);
+    std::fill(buffer+headerLength+length,buffer+capacity,0);
+    long long done=0;
+    while(done<capacity){
+        long long n=pwrite(slotFd,buffer+done,capacity-done,offset+done);
+        if(n<0)throw "failed to write .dbz";
+        done+=n;
+    }
+    freeSlot(page->getPageNumber());
+    slots[page->getPageNumber()]={offset,capacity,length,header.seq};
+    storedBytes+=capacity;
+    return true;
+}
+
+void PageCache::freeSlot(long long pageNumber){
+    auto iter=slots.find(pageNumber);
+    if(iter==slots.end())return;
+    Slot slot=iter->second;
+    slots.erase(iter);
+    storedBytes-=slot.capacity;
+    long long free=0;
+    pwrite(slotFd,&free,sizeof(free),slot.offset); // 槽头的页号置0
+    freeSlots[slot.capacity].push_back(slot.offset);
+}
+
+unsigned int PageCache::slotChecksum(const char* data,int length){
+    // FNV-1a
+    unsigned int h=2166136261u;
+    for(int i=0;i<length;i++){
+        h^=(unsigned char)data[i];
+        h*=16777619u;
+    }
+    return h;
+}
+
+void PageCache::sync(){
+    {
+        std::unique_lock<std::mutex> lock(resourceLock);
+        for(auto iter=cache.begin();iter!=cache.end();iter++){
+            Page* page=iter->second;
+            page->writeLatch();
+            if(page->isDirty())flush(page);
+            page->writeUnlatch();
+        }
+    }
+    fdatasync(fd);
+    if(slotFd>=0)fdatasync(slotFd);
+}
+
+void PageCache::readAt(long long offset,char* data,long long length){
+    long long done=0;
+    while(done<length){
+        long long n=pread(fd,data+done,length-done,offset+done);
+        if(n<=0)break; // 读到文件末尾
+        done+=n;
+    }
+    std::fill(data+done,data+length,0);
+}
+
+void PageCache::writeAt(long long offset,const char* data,long long length){
+    char* bounce=nullptr;
+    if(mode==direct&&reinterpret_cast<std::uintptr_t>(data)%pageSize!=0){
+        bounce=static_cast<char*>(std::aligned_alloc(pageSize,length));
+        std::copy(data,data+length,bounce);
+        data=bounce;
+    }
+    long long done=0;
+    while(done<length){
+        long long n=pwrite(fd,data+done,length-done,offset+done);
+        if(n<0){
+            std::free(bounce);
+            throw "failed to write .db";
+        }
+        done+=n;
+    }
+    std::free(bounce);
 }
 
 PageCache::~PageCache() {
-    // 关闭缓存，写回所有资源
+    // 先停止预读线程，再关闭缓存，写回所有资源
+    {
+        std::unique_lock<std::mutex> lock(requestLock);
+        prefetcherStopping=true;
+    }
+    requestWake.notify_all();
+    if(prefetcher.joinable())prefetcher.join();
     std::unique_lock<std::mutex> lock(resourceLock);
     for(auto iter=cache.begin();iter!=cache.end();iter++){
         releaseForCache(iter->second);
     }
-    file.close();
+    if(fd>=0){
+        fdatasync(fd);
+        close(fd);
+    }
+    if(slotFd>=0){
+        fdatasync(slotFd);
+        close(slotFd);
+    }
+#ifdef __linux__
+    if(mapBase!=nullptr)munmap(mapBase,mapReserved);
+#endif
+}
+
+FrameArena::~FrameArena(){
+    if(base==nullptr)return;
+#ifdef __linux__
+    if(mapped){
+        munmap(base,length);
+        return;
+    }
+#endif
+    std::free(base);
+}
+
+void FrameArena::init(long long frameNumber,int frameSize,bool hugePages,NumaPolicy policy){
+    this->frameNumber=frameNumber;
+    this->frameSize=frameSize;
+    length=frameNumber*frameSize;
+    if(length==0)return;
+#ifdef __linux__
+    if(hugePages){
+        // 优先使用预留的大页，没有预留时退回普通映射并建议内核使用透明大页
+        long long hugeLength=(length+hugePageSize-1)/hugePageSize*hugePageSize;
+        void* p=mmap(nullptr,hugeLength,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB,-1,0);
+        if(p!=MAP_FAILED){
+            base=static_cast<char*>(p);
+            length=hugeLength;
+            huge=true;
+        }
+    }
+    if(base==nullptr){
+        void* p=mmap(nullptr,length,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+        if(p==MAP_FAILED)throw "failed to allocate page frames";
+        base=static_cast<char*>(p);
+        if(hugePages)madvise(base,length,MADV_HUGEPAGE);
+    }
+    mapped=true;
+    bindNodes(policy);
+#else
+    base=static_cast<char*>(std::aligned_alloc(frameSize,length));
+    if(base==nullptr)throw "failed to allocate page frames";
+#endif
+    // 页帧按节点分成nodes份，每份的空闲链表逆序存放，使得低地址的页帧先被使用
+    freeFrames.assign(nodes,std::vector<char*>());
+    long long perNode=(frameNumber+nodes-1)/nodes;
+    for(long long i=frameNumber-1;i>=0;i--){
+        freeFrames[i/perNode].push_back(base+i*frameSize);
+    }
+}
+
+char* FrameArena::acquire(){
+    std::unique_lock<std::mutex> lock(frameLock);
+    int node=nodes>1?currentNode()%nodes:0;
+    for(int i=0;i<nodes;i++){
+        // 本节点没有空闲页帧时，再从其他节点借用
+        std::vector<char*>& list=freeFrames[(node+i)%nodes];
+        if(!list.empty()){
+            char* frame=list.back();
+            list.pop_back();
+            return frame;
+        }
+    }
+    return nullptr;
+}
+
+void FrameArena::release(char* frame,bool discard){
+    if(frame==nullptr)return;
+#ifdef __linux__
+    if(discard&&mapped&&!huge)madvise(frame,frameSize,MADV_DONTNEED); // 大页不能按4KB归还
+#endif
+    long long perNode=(frameNumber+nodes-1)/nodes;
+    long long index=(frame-base)/frameSize;
+    std::unique_lock<std::mutex> lock(frameLock);
+    freeFrames[index/perNode].push_back(frame);
+}
+
+int FrameArena::nodeNumber(){
+    // /sys/devices/system/node/online 的内容形如 "0" 或 "0-3"
+    std::ifstream online("/sys/devices/system/node/online");
+    std::string range;
+    if(!(online>>range))return 1;
+    std::size_t dash=range.find_last_of("-,");
+    int last=std::atoi(range.c_str()+(dash==std::string::npos?0:dash+1));
+    return last+1;
+}
+
+int FrameArena::currentNode(){
+#if defined(__linux__)&&defined(SYS_getcpu)
+    unsigned cpu=0,node=0;
+    if(syscall(SYS_getcpu,&cpu,&node,nullptr)==0)return node;
+#endif
+    return 0;
+}
+
+void FrameArena::bindNodes(NumaPolicy policy){
+    nodes=1;
+#if defined(__linux__)&&defined(SYS_mbind)
+    int number=nodeNumber();
+    if(policy==local||number<=1||number>64)return;
+    const int bindPolicy=2; // MPOL_BIND
+    const int interleavePolicy=3; // MPOL_INTERLEAVE
+    if(policy==interleave){
+        unsigned long mask=(number==64)?~0ul:((1ul<<number)-1);
+        syscall(SYS_mbind,base,length,interleavePolicy,&mask,number+1,0);
+        return;
+    }
+    // 按节点划分：第i份页帧绑定到节点i；每份的边界按页帧对齐，绑定失败时该份仍可正常使用
+    long long perNode=(frameNumber+number-1)/number;
+    for(int i=0;i<number;i++){
+        long long first=i*perNode;
+        if(first>=frameNumber)break;
+        long long size=std::min(perNode,frameNumber-first)*frameSize;
+        unsigned long mask=1ul<<i;
+        syscall(SYS_mbind,base+first*frameSize,size,bindPolicy,&mask,number+1,0);
+    }
+    nodes=number;
+#endif
 }
 
 static std::shared_ptr<PageIndex> pageIndex=nullptr;
@@ -248,6 +1073,7 @@ void PageIndex::init(){
 void PageIndex::add(int pageNumber,int freeSpace){
     std::unique_lock<std::mutex> lock(pagesLock);
     int number=freeSpace/intervalSize;
+    if(number>levelNum)number=levelNum; // 空闲空间超过levelNum*intervalSize的页都放在最后一级
     pageList[number].emplace_back(pageNumber,freeSpace);
 }
 
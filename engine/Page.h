@@ -5,23 +5,56 @@
 #include <list>
 #include <unordered_map>
 #include <fstream>
+#include <filesystem>
 #include <atomic>
 #include <mutex>
 #include <thread>
+#include <condition_variable>
 #include <random>
 #include <memory>
+#include <shared_mutex>
+#include <cstdlib>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <deque>
+#include <algorithm>
+#include <functional>
+#include "Pool.h"
+#include "Compress.h"
+#include "Memory.h"
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
 
 class Page {
 public:
-    Page(long long pageNumber, std::vector<char>& data,int pageSize);
+    friend class PageCache;
+    Page()=default; // 供对象池使用，取出后需调用reset
+    Page(long long pageNumber, std::vector<char>& data,int pageSize); // 独立页面，数据拷贝到页面自带的缓冲区中
+    Page(long long pageNumber,char* frame); // 以页帧区域中的一个页帧作为数据缓冲区
+    void reset(long long pageNumber,char* frame); // 复用一个页面对象：设置页号和页帧，清除脏标志
+    char* getFrame(); // 页面使用的页帧，独立页面返回nullptr
     void setDirty(bool dirty);
     bool isDirty();
     long long getPageNumber();
     char* getData();
+    void readLatch(); // 加页面读闩锁，读取页面上的多条数据时使用，保证读到的都是完整修改后的数据
+    void readUnlatch();
+    void writeLatch(); // 加页面写闩锁，修改页面数据时使用
+    void writeUnlatch();
 private:
-    long long pageNumber; // 页号
-    std::vector<char> data; // 实际存储的数据
-    bool dirty; // 是否为脏页
+    long long pageNumber=0; // 页号
+    char* data=nullptr; // 实际存储的数据（页帧或storage）
+    char* frame=nullptr; // 页帧
+    std::vector<char> storage; // 独立页面自带的缓冲区
+    Page* prev=nullptr; // 未被引用的页面链表中的前一个页面
+    Page* next=nullptr;
+    bool dirty=false; // 是否为脏页
+    std::shared_mutex latch; // 页面闩锁
 };
 
 // 页面信息（页号及空闲空间大小）
@@ -43,6 +76,7 @@ public:
     static bool check(Page* firstPage); // 有效性检查
     // 普通页管理
     static void initPage(Page* page); // 初始化一个普通页
+    static bool isInitialized(Page* page); // 普通页是否已经初始化（预留后未写出就崩溃的页面全为0）
     static void setFSO(Page* page,short offset); // 设置一个页的FSO
     static short getFSO(Page* page); // 获取一个页的FSO（空闲空间偏移）
     static short insertData(Page* page,std::vector<char>& data); // 插入数据，并返回新的FSO
@@ -54,19 +88,90 @@ private:
     static const short offsetLength=sizeof(short); // 偏移量长度
 };
 
+// 页帧区域：启动时一次性申请的一块4KB对齐的连续内存，切分为定长页帧供缓存的页面使用
+// 页帧地址按页对齐，可以直接用于O_DIRECT读写；可选使用2MB大页以减少TLB缺失
+// 多NUMA节点时，可以将页帧交错分布在各节点上（interleave），或者按节点划分（partition），此时优先从当前线程所在节点取页帧
+class FrameArena{
+public:
+    enum NumaPolicy{local,interleave,partition};
+    FrameArena()=default;
+    ~FrameArena();
+    void init(long long frameNumber,int frameSize,bool hugePages,NumaPolicy policy); // 申请frameNumber个页帧
+    char* acquire(); // 取一个空闲页帧，没有空闲页帧时返回nullptr
+    void release(char* frame,bool discard=false); // 归还一个页帧，discard为true时同时把页帧占用的物理内存还给系统
+    long long getFrameNumber(){return frameNumber;}
+    bool isHuge(){return huge;} // 是否使用了大页
+
+    FrameArena(const FrameArena&) = delete; // 禁用拷贝构造函数
+    FrameArena& operator=(const FrameArena&) = delete; // 禁用赋值运算符
+private:
+    static int nodeNumber(); // 系统的NUMA节点个数
+    static int currentNode(); // 当前线程所在的NUMA节点
+    void bindNodes(NumaPolicy policy); // 设置页帧内存的NUMA策略，需在内存被首次访问前调用
+
+    static const long long hugePageSize=1ll<<21; // 大页大小（2MB）
+    char* base=nullptr; // 区域起始地址
+    long long length=0; // 区域长度
+    bool mapped=false; // 是否由mmap申请
+    bool huge=false;
+    long long frameNumber=0;
+    int frameSize=0;
+    int nodes=1; // 页帧按节点划分的份数
+    std::vector<std::vector<char*>> freeFrames; // 每个节点的空闲页帧
+    std::mutex frameLock;
+};
+
 class PageIndex; // 声明PageIndex类
 class PageCache {
 public:
     friend class PageIndex;
 
+    // 数据文件的读写方式
+    // buffered：经过操作系统的页缓存读写
+    // direct：以O_DIRECT打开，绕过操作系统的页缓存，PageCache是页面唯一的缓存，写回时机完全由PageCache决定；页帧按页对齐，可以直接读写
+    // mapped：将数据文件私有映射（MAP_PRIVATE）到内存中，获取页面只是计算地址，不拷贝数据；修改只作用于私有副本，由PageCache在写回时从映射中写入文件，保证先写日志后写页面
+    enum FileMode{buffered,direct,mapped};
+
+    // 预读统计
+    struct PrefetchStats{
+        long long reads; // 缓存未命中时读文件的次数（一次预读只算一次）
+        long long prefetched; // 预读进来的页面数
+        long long hits; // 被使用的预读页面数
+        long long wasted; // 没被使用就被丢弃的预读页面数
+    };
+
+    // 页面压缩统计
+    struct CompressionStats{
+        long long pages; // 压缩存放的页面数
+        long long rawBytes; // 这些页面未压缩时的大小
+        long long storedBytes; // 这些页面实际占用的槽的大小
+    };
+
     static std::shared_ptr<PageCache> instance(); // 获取PageCache的单例对象
-    void init(long long memory); // 初始化PageCache,memory是给缓存分配的内存空间的长度
+    void setFileMode(FileMode mode); // 设置数据文件的读写方式，需要在init之前调用
+    FileMode getFileMode(); // 实际使用的读写方式（文件系统不支持O_DIRECT时退回buffered）
+    void init(long long memory,bool hugePages=false,FrameArena::NumaPolicy policy=FrameArena::local); // 初始化PageCache,memory是给缓存分配的内存空间的长度，缓存的页帧一次性申请
 
     long long getPageNumbers(); // 获取当前文件中包含的页面个数
     Page* get(long long pageNumber); // 从缓存中获取一个页面，如果不在缓存中则从文件中载入
-    void release(long long pageNumber); // 释放一个页面，如果没有其他使用者引用该页面，将其从缓存中移除
+    void release(long long pageNumber); // 释放一个页面，如果没有其他使用者引用该页面，它仍留在缓存中，直到内存不足时被逐出
+    long long evict(long long bytes); // 按最近最少使用的顺序逐出未被引用的页面（以及预读的页面），直到释放bytes字节，返回实际释放的字节数
     long long newPage(std::vector<char>& data); // 在文件末尾创建一个新页面，并返回其页号
+    long long newPages(std::vector<char>& data); // 在文件末尾一次创建data.size()/pageSize个连续的新页面，只写一次文件，返回第一个页面的页号
+    long long reservePages(int number); // 预留number个连续的页号，返回第一个页号；预留的页面之后需要用writePages写出
+    void writePages(long long firstPageNumber,const char* data,int number); // 将number个连续页面一次写入文件
     void truncate(long long newPageNumber); // 扩展文件，使其可以容纳maxPageNumber个页面
+    void sync(); // 写回缓存中所有的脏页，并将文件数据落盘
+    void setReadahead(int pages); // 设置每次预读的页面数，0表示关闭预读
+    void scanHint(long long first,long long last); // 提示即将顺序读取[first,last]中的页面，这些页面缺失时直接预读，不必等待顺序访问被检测出来
+    void clearScanHint(long long first,long long last); // 撤销scanHint
+    void prefetch(long long first,int number); // 提示即将读取从first开始的number个页面，不等待读入完成（例如索引扫描预取后续的叶子）；direct模式下由后台的预读线程读入
+    PrefetchStats getPrefetchStats(); // 获取预读统计
+    void setCompression(bool enable); // 全局压缩开关，开启后所有页面写回时都尝试压缩
+    void setPageCompression(long long pageNumber,bool enable); // 单个页面的压缩开关，优先于压缩策略和全局开关
+    using CompressionPolicy=std::function<bool(const char* data)>; // 压缩策略，参数为页面数据，返回true时压缩；不能加锁等待PageCache
+    void setCompressionPolicy(CompressionPolicy policy); // 按页面内容决定写回时是否压缩（例如压缩整张表的页面），策略返回false时再看全局开关
+    CompressionStats getCompressionStats(); // 获取压缩统计
     static int getPageSize(){return pageSize;}
 
     ~PageCache();
@@ -75,19 +180,107 @@ public:
 private:
     PageCache() = default; // 禁用外部构造
     void flush(Page* page); // 将一个页面刷到文件中
+    void readAt(long long offset,char* data,long long length); // 从文件offset处读取length字节，文件末尾之后的部分填0
+    void mapFile(); // mapped模式下预留地址空间，并映射文件的现有部分
+    void extendMapping(long long pageNumber); // 文件变长后，把映射扩展到前pageNumber个页面（调用时需持有fileLock）
+    void shrinkMapping(long long pageNumber); // 文件截短后，取消第pageNumber个页面之后的映射（调用时需持有fileLock）
+    bool isMapped(Page* page); // 页面数据是否直接位于映射中
+    int readaheadLength(long long key); // 页面key缺失时应当连带预读的页面数：在扫描提示范围内，或者本线程连续顺序缺页时预读
+    std::vector<long long> claimPrefetch(long long key,int number); // 选出key之后连续的、不在缓存中也未被预读的页面，并将其标记为正在获取
+    char* takePrefetched(long long key); // 取出页面key的预读页帧，没有则返回nullptr
+    void installPrefetched(const std::vector<long long>& claimed,char** buffers,int number,long long generation); // 将读入的前number个页面放入预读页面，并撤销所有claimed页面的正在获取标记
+    void dropPrefetched(long long first,long long last); // 丢弃[first,last]中的预读页面（文件中这些页面被改写时调用）
+    void readPages(long long firstPageNumber,char** buffers,int number); // 用一次分散读把连续的number个页面读入各自的页帧
+    void readAhead(long long first,int number); // 把从first开始的number个页面中连续的、不在缓存中的页面一次读入预读页面
+    void prefetchLoop(); // 预读线程的主循环：依次处理prefetchRequests中的请求
+    char* acquireFrame(); // 为缓存的页面取一个页帧，页帧用完时先逐出未被引用的页面
+    char* acquirePrefetchFrame(); // 为预读取一个页帧并计入内存预算，预算或页帧不足时返回nullptr，不会逐出其他页面
+    void freePrefetchFrame(char* frame); // 归还一个预读页帧及其内存预算
+    void pushUnpinned(Page* page); // 页面的引用计数降为0，加入未被引用的页面链表的头部（调用时需持有resourceLock）
+    void removeUnpinned(Page* page); // 页面重新被引用或被逐出，从链表中移除（调用时需持有resourceLock）
+    void dropUnpinned(Page* page); // 不写回，直接丢弃一个未被引用的页面（文件中的页面被直接改写或截掉时使用，调用时需持有resourceLock）
+
+    // 压缩页面存放在槽文件（.dbz）中，每个槽为：[SlotHeader] [压缩数据]，槽的大小按slotAlign对齐；页面在.db中原来的位置被打洞，不再占用磁盘空间
+    // 槽文件可以顺序扫描重建页号到槽的映射：页号为0的槽是空闲槽，同一页面有多个槽时以写序号最大的为准，校验和不符的槽视为空闲
+    struct SlotHeader{
+        long long pageNumber; // 页号，为0表示空闲槽
+        long long seq; // 写序号
+        int capacity; // 槽的大小（含槽头）
+        int length; // 压缩数据的长度
+        unsigned int checksum; // 压缩数据的校验和
+        int reserved;
+    };
+    // 一个页面所在的槽
+    struct Slot{
+        long long offset; // 槽在槽文件中的偏移
+        int capacity; // 槽的大小
+        int length; // 压缩数据的长度
+        long long seq; // 写序号
+    };
+    void openSlots(bool create); // 打开槽文件并重建映射，create为true时清空槽文件
+    bool shouldCompress(Page* page); // 页面写回时是否尝试压缩
+    bool isCompressed(long long pageNumber); // 页面是否压缩存放
+    bool readSlot(long long pageNumber,char* data); // 如果页面压缩存放，从槽中读出并解压到data，返回true
+    bool writeSlot(Page* page); // 压缩页面并写入一个新槽，压缩后节省不到一个对齐单位时返回false
+    void freeSlot(long long pageNumber); // 释放页面的槽（调用时需持有slotLock）
+    static unsigned int slotChecksum(const char* data,int length);
+    void writeAt(long long offset,const char* data,long long length); // 向文件offset处写入length字节；direct模式下未对齐的数据经过对齐的中转缓冲区写入
     Page* getForCache(long long key); // 根据pageNumber（key）从数据库文件中读取页的数据，并包裹成Page返回。当键值为key的资源不在缓存中时，资源的获取方式
     void releaseForCache(Page* page); // 如果是脏页，则需要把页中存储的数据刷入磁盘。当资源被逐出缓存时的写入行为
-    std::fstream file; // 数据存储文件
+    int fd=-1; // 数据存储文件
+    FileMode mode=buffered; // 数据文件的读写方式
+    char* mapBase=nullptr; // mapped模式下预留的地址空间的起始地址
+    long long mapReserved=0; // 预留的地址空间长度
+    std::atomic<long long> mappedPages{0}; // 已映射的页面数，之后的页面仍从文件读入页帧
+    static const long long minMapReserved=1ll<<36; // 最少预留的地址空间（64GB）
+    FrameArena frames; // 缓存页面使用的页帧
 
     std::unordered_map<long long,Page*> cache; // 键值到页面的映射
     std::unordered_map<long long,int> references; // 键值到该页面的引用的个数的映射
     std::unordered_map<long long,bool> getting; // 是否有其他进程正在获取该页面
     static const int pageSize=(1<<12); // 页面大小（这里为4KB）
-    long long maxPageNumber; // 缓存最大可缓存的页面数
+    long long maxPageNumber; // 页帧的个数
+    int memoryConsumer=-1; // 在MemoryGovernor中的使用者编号
+    std::shared_ptr<MemoryGovernor> memoryGovernor; // 持有MemoryGovernor：进程退出时静态对象的析构顺序不确定，析构中写回页面时仍要归还内存
+    Page* unpinnedHead=nullptr; // 未被引用的页面链表，头部是最近释放的页面
+    Page* unpinnedTail=nullptr;
     std::atomic<long long> pageNumbers; // 文件包含的页面总数
     long long count=0; // 缓存中当前包含的页面个数
 
-    std::mutex fileLock; // 文件访问互斥锁
+    std::unordered_map<long long,char*> prefetched; // 预读进来、尚未被获取的页面，页帧不计入缓存的引用计数
+    std::deque<long long> prefetchOrder; // 预读的先后顺序，预读页面过多时先丢弃最早的
+    std::vector<std::pair<long long,long long>> scanHints; // 扫描提示的页号范围
+    std::mutex prefetchLock; // 预读状态锁，加锁顺序总是先resourceLock后prefetchLock
+    std::atomic<int> readahead{32}; // 每次预读的页面数
+    static const int sequentialThreshold=2; // 连续顺序缺页达到该次数后开始预读
+    static const int prefetchCapacity=256; // 最多同时保留的预读页面数
+    std::atomic<long long> writeGeneration{0}; // 页面绕过缓存直接写入文件的次数，预读期间发生变化则丢弃预读结果
+    std::atomic<long long> missReads{0};
+    std::atomic<long long> prefetchedPages{0};
+    std::atomic<long long> prefetchHits{0};
+    std::atomic<long long> prefetchWasted{0};
+    // direct模式下prefetch只登记请求，由预读线程在后台读入；首次prefetch时启动
+    std::deque<std::pair<long long,int>> prefetchRequests; // 待处理的预读请求（起始页号，页数），相邻的请求合并为一个
+    std::thread prefetcher; // 预读线程
+    bool prefetcherStopping=false;
+    std::mutex requestLock; // 预读请求锁，不与其他锁嵌套
+    std::condition_variable requestWake;
+    static const int maxPrefetchRequests=64; // 预读线程跟不上时丢弃新的请求
+    static const int maxPrefetchRun=64; // 合并后的一个请求最多包含的页面数
+
+    int slotFd=-1; // 槽文件
+    std::unordered_map<long long,Slot> slots; // 页号到槽的映射
+    std::unordered_map<int,std::vector<long long>> freeSlots; // 槽大小到空闲槽偏移的映射
+    long long slotFileEnd=0; // 槽文件的长度
+    long long slotSeq=0; // 最大的写序号
+    long long storedBytes=0; // 所有槽的总大小
+    std::atomic<bool> compression{false}; // 全局压缩开关
+    std::unordered_map<long long,bool> pageCompression; // 单个页面的压缩开关
+    CompressionPolicy compressionPolicy; // 压缩策略，没有时为空
+    std::mutex slotLock; // 槽映射锁，加锁顺序总是先resourceLock、prefetchLock后slotLock
+    static const int slotAlign=512; // 槽大小的对齐单位
+
+    std::mutex fileLock; // 文件长度修改互斥锁；页面的读写使用pread/pwrite，不需要加锁
     std::mutex resourceLock; // 资源访问互斥锁
 };
 
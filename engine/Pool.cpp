@@ -0,0 +1,40 @@
+#include "Pool.h"
+
+std::atomic<long long> Arena::allocations{0};
+
+Arena::~Arena(){
+    for(Chunk& chunk:chunks)delete[] chunk.data;
+}
+
+char* Arena::allocate(int size){
+    size=(size+7)&~7;
+    while(current<(int)chunks.size()){
+        if(used+size<=chunks[current].size){
+            char* p=chunks[current].data+used;
+            used+=size;
+            return p;
+        }
+        // 当前块放不下，换到下一个保留的块
+        current++;
+        used=0;
+    }
+    int newSize=size>chunkSize?size:chunkSize;
+    chunks.push_back({new char[newSize],newSize});
+    allocations.fetch_add(1,std::memory_order_relaxed);
+    current=chunks.size()-1;
+    used=size;
+    return chunks[current].data;
+}
+
+void Arena::reset(){
+    while((int)chunks.size()>maxRetainedChunks){
+        delete[] chunks.back().data;
+        chunks.pop_back();
+    }
+    current=0;
+    used=0;
+}
+
+long long Arena::getAllocations(){
+    return allocations.load();
+}
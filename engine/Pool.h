@@ -0,0 +1,107 @@
+#ifndef POOL
+#define POOL
+
+#include <vector>
+#include <atomic>
+
+// 对象池的分配统计
+struct PoolStats{
+    long long allocations; // 池中没有空闲对象、真正new出来的次数
+    long long acquires; // 从池中取出对象的次数
+    long long releases; // 归还对象的次数
+};
+
+// 类型化的对象池：每个线程有自己的空闲链表，取出和归还都不加锁
+// 归还的对象不析构，保留其内部缓冲区（vector的容量等）以便下次复用，因此取出后需要由调用者重新初始化
+// 稳态下acquires增长而allocations不变，说明热路径上没有发生堆分配
+template<typename T>
+class ObjectPool{
+public:
+    static T* acquire(); // 取出一个对象，空闲链表为空时才new
+    static void release(T* object); // 归还一个对象，空闲链表已满或线程正在退出时直接delete
+    static PoolStats stats(); // 获取分配统计
+private:
+    // 线程的空闲链表，线程退出时释放其中的所有对象
+    struct FreeList{
+        std::vector<T*> objects;
+        ~FreeList(){
+            destroyed=true;
+            for(T* object:objects)delete object;
+        }
+    };
+    static FreeList& freeList();
+
+    static const int maxFreeObjects=4096; // 每个线程最多缓存的空闲对象个数
+    static inline thread_local bool destroyed=false; // 本线程的空闲链表是否已经析构（静态对象析构时仍可能归还对象）
+    static inline std::atomic<long long> allocations{0};
+    static inline std::atomic<long long> acquires{0};
+    static inline std::atomic<long long> releases{0};
+};
+
+template<typename T>
+typename ObjectPool<T>::FreeList& ObjectPool<T>::freeList(){
+    static thread_local FreeList list;
+    return list;
+}
+
+template<typename T>
+T* ObjectPool<T>::acquire(){
+    acquires.fetch_add(1,std::memory_order_relaxed);
+    if(!destroyed){
+        FreeList& list=freeList();
+        if(!list.objects.empty()){
+            T* object=list.objects.back();
+            list.objects.pop_back();
+            return object;
+        }
+    }
+    allocations.fetch_add(1,std::memory_order_relaxed);
+    return new T;
+}
+
+template<typename T>
+void ObjectPool<T>::release(T* object){
+    if(object==nullptr)return;
+    releases.fetch_add(1,std::memory_order_relaxed);
+    if(!destroyed){
+        FreeList& list=freeList();
+        if((int)list.objects.size()<maxFreeObjects){
+            list.objects.push_back(object);
+            return;
+        }
+    }
+    delete object;
+}
+
+template<typename T>
+PoolStats ObjectPool<T>::stats(){
+    return {allocations.load(),acquires.load(),releases.load()};
+}
+
+// 区域分配器：从若干大块中顺序切分内存，不单独释放，reset()后整体复用
+// 每个事务持有一个，用于快照和日志记录等生命周期不超过事务的缓冲区
+class Arena{
+public:
+    Arena()=default;
+    ~Arena();
+    char* allocate(int size); // 分配size字节，按8字节对齐
+    void reset(); // 丢弃所有分配，保留前几个块以便复用
+    static long long getAllocations(); // 所有Arena向系统申请块的次数
+
+    Arena(const Arena&) = delete; // 禁用拷贝构造函数
+    Arena& operator=(const Arena&) = delete; // 禁用赋值运算符
+private:
+    struct Chunk{
+        char* data;
+        int size;
+    };
+    std::vector<Chunk> chunks; // 已申请的块
+    int current=0; // 当前正在切分的块
+    int used=0; // 当前块已使用的字节数
+
+    static const int chunkSize=4096; // 默认块大小
+    static const int maxRetainedChunks=16; // reset()时最多保留的块数
+    static std::atomic<long long> allocations;
+};
+
+#endif
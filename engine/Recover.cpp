@@ -35,20 +35,24 @@ bool Logger::init() {
     return true;
 }
 
-void Logger::log(std::vector<char> data){
-    int dataSize=data.size();
+void Logger::log(const std::vector<char>& data){
+    log(data.data(),data.size());
+}
+
+void Logger::log(const char* data,int size){
+    int dataSize=size;
     char* p=reinterpret_cast<char*>(&dataSize);
-    int checkSum= calCheckSum(0,data);
+    int checkSum= calCheckSum(0,data,size);
     char* pp=reinterpret_cast<char*>(&checkSum);
-    std::vector<char> log(dataLength+checkSumLength+dataSize);
-    std::copy(p,p+sizeof(int),log.begin());
-    std::copy(pp,pp+sizeof(int),log.begin()+dataLength);
-    std::copy(data.begin(),data.end(),log.begin()+dataLength+checkSumLength);
 
     std::unique_lock<std::mutex> lock(fileLock);
+    buffer.resize(dataLength+checkSumLength+dataSize);
+    std::copy(p,p+sizeof(int),buffer.begin());
+    std::copy(pp,pp+sizeof(int),buffer.begin()+dataLength);
+    std::copy(data,data+size,buffer.begin()+dataLength+checkSumLength);
     file.seekp(0,std::ios::end);
-    file.write(&(log[0]),dataLength+checkSumLength+dataSize);
-    updateXChecksum(log);
+    file.write(&(buffer[0]),dataLength+checkSumLength+dataSize);
+    updateXChecksum(buffer);
 }
 
 std::vector<char> Logger::next(){
@@ -66,8 +70,12 @@ Logger::~Logger() {
 }
 
 int Logger::calCheckSum(int checkSum, std::vector<char>& log) {
-    for(char c:log){
-        checkSum=checkSum*seed+c;
+    return calCheckSum(checkSum,log.data(),log.size());
+}
+
+int Logger::calCheckSum(int checkSum, const char* log,int size) {
+    for(int i=0;i<size;i++){
+        checkSum=checkSum*seed+log[i];
     }
     return checkSum;
 }
@@ -132,6 +140,11 @@ void Recover::recover(){
             if(ili.pageNumber>maxPageNumber){
                 maxPageNumber=ili.pageNumber;
             }
+        }else if(log[0]==pageTypeLog){
+            PageLogInfo pli= parsePageLog(log);
+            if(pli.pageNumber>maxPageNumber){
+                maxPageNumber=pli.pageNumber;
+            }
         }else{
             UpdateLogInfo uli= parseUpdateLog(log);
             if(uli.pageNumber>maxPageNumber){
@@ -145,20 +158,38 @@ void Recover::recover(){
     undoTransactions();
 }
 
-std::vector<char> Recover::updateLog(long long xid, DataItem& di){
-    std::vector<char> log(typeLength+xidLength+uidLength+oldRawLength+di.dataItem.size()+di.oldDataItem.size());
+int Recover::updateLogSize(DataItem& di){
+    return typeLength+xidLength+uidLength+oldRawLength+di.length+di.oldDataItem.size();
+}
+
+void Recover::updateLog(long long xid, DataItem& di,char* log){
     log[0]=updateTypeLog;
     char* p=reinterpret_cast<char*>(&xid);
-    std::copy(p,p+xidLength,log.begin()+typeLength);
+    std::copy(p,p+xidLength,log+typeLength);
     long long uid=di.uid;
     char* pp=reinterpret_cast<char*>(&uid);
-    std::copy(pp,pp+uidLength,log.begin()+typeLength+xidLength);
+    std::copy(pp,pp+uidLength,log+typeLength+xidLength);
     short oldRawSize=di.oldDataItem.size();
     char* ppp=reinterpret_cast<char*>(&oldRawSize);
-    std::copy(ppp,ppp+oldRawLength,log.begin()+typeLength+xidLength+uidLength);
+    std::copy(ppp,ppp+oldRawLength,log+typeLength+xidLength+uidLength);
+
+    std::copy(di.oldDataItem.begin(),di.oldDataItem.end(),log+typeLength+xidLength+uidLength+oldRawLength);
+    std::copy(di.raw(),di.raw()+di.length,log+typeLength+xidLength+uidLength+oldRawLength+oldRawSize);
+}
 
-    std::copy(di.oldDataItem.begin(),di.oldDataItem.end(),log.begin()+typeLength+xidLength+uidLength+oldRawLength);
-    std::copy(di.dataItem.begin(),di.dataItem.end(),log.begin()+typeLength+xidLength+uidLength+oldRawLength+oldRawSize);
+std::vector<char> Recover::rangeLog(long long xid, long long pageNumber, short offset, const char* oldData, const char* newData, short length){
+    // 与DataItem的更新日志格式相同，uid指向页面上的任意位置，重做和撤销都是按偏移拷贝
+    std::vector<char> log(typeLength+xidLength+uidLength+oldRawLength+2*length);
+    log[0]=updateTypeLog;
+    char* p=reinterpret_cast<char*>(&xid);
+    std::copy(p,p+xidLength,log.begin()+typeLength);
+    long long uid=pageNumber<<32|(long long)offset;
+    char* pp=reinterpret_cast<char*>(&uid);
+    std::copy(pp,pp+uidLength,log.begin()+typeLength+xidLength);
+    char* ppp=reinterpret_cast<char*>(&length);
+    std::copy(ppp,ppp+oldRawLength,log.begin()+typeLength+xidLength+uidLength);
+    std::copy(oldData,oldData+length,log.begin()+typeLength+xidLength+uidLength+oldRawLength);
+    std::copy(newData,newData+length,log.begin()+typeLength+xidLength+uidLength+oldRawLength+length);
     return log;
 }
 
@@ -177,6 +208,17 @@ std::vector<char> Recover::insertLog(long long xid, Page* page, std::vector<char
     return log;
 }
 
+std::vector<char> Recover::pageLog(long long xid, long long pageNumber, char* raw, short length){
+    std::vector<char> log(typeLength+xidLength+pageNumberLength+length);
+    log[0]=pageTypeLog;
+    char* p=reinterpret_cast<char*>(&xid);
+    std::copy(p,p+xidLength,log.begin()+typeLength);
+    char* pp=reinterpret_cast<char*>(&pageNumber);
+    std::copy(pp,pp+pageNumberLength,log.begin()+typeLength+xidLength);
+    std::copy(raw,raw+length,log.begin()+typeLength+xidLength+pageNumberLength);
+    return log;
+}
+
 void Recover::redoTransactions() {
     Logger::instance()->reset();
     while (true){
@@ -187,6 +229,11 @@ void Recover::redoTransactions() {
             if(!TransactionManager::instance()->isActive(ili.xid)){
                 doInsertLog(log,redo);
             }
+        }else if(log[0]==pageTypeLog){
+            PageLogInfo pli= parsePageLog(log);
+            if(!TransactionManager::instance()->isActive(pli.xid)){
+                doPageLog(log,redo);
+            }
         }else{
             UpdateLogInfo uli= parseUpdateLog(log);
             if(!TransactionManager::instance()->isActive(uli.xid)){
@@ -207,6 +254,11 @@ void Recover::undoTransactions() {
             if(TransactionManager::instance()->isActive(ili.xid)){
                 logCache[ili.xid].push_back(log);
             }
+        }else if(log[0]==pageTypeLog){
+            PageLogInfo pli= parsePageLog(log);
+            if(TransactionManager::instance()->isActive(pli.xid)){
+                logCache[pli.xid].push_back(log);
+            }
         }else{
             UpdateLogInfo uli= parseUpdateLog(log);
             if(TransactionManager::instance()->isActive(uli.xid)){
@@ -218,6 +270,8 @@ void Recover::undoTransactions() {
         for(auto logIter=iter->second.rbegin();logIter!=iter->second.rend();logIter++){
             if((*logIter)[0]==insertTypeLog){
                 doInsertLog(*logIter,undo);
+            }else if((*logIter)[0]==pageTypeLog){
+                doPageLog(*logIter,undo);
             }else{
                 doUpdateLog(*logIter,undo);
             }
@@ -236,8 +290,8 @@ Recover::UpdateLogInfo Recover::parseUpdateLog(std::vector<char>& log){
     uli.pageNumber=(int)(uid & ((1ll<<32)-1));
     short oldRawSize=0;
     std::copy(log.begin()+typeLength+xidLength+uidLength,log.begin()+typeLength+xidLength+uidLength+oldRawLength,reinterpret_cast<char*>(&oldRawSize));
-    std::copy(log.begin()+typeLength+xidLength+uidLength+oldRawLength,log.begin()+typeLength+xidLength+uidLength+oldRawLength+oldRawSize,uli.oldData.begin());
-    std::copy(log.begin()+typeLength+xidLength+uidLength+oldRawLength+oldRawSize,log.end(),uli.newData.begin());
+    uli.oldData.assign(log.begin()+typeLength+xidLength+uidLength+oldRawLength,log.begin()+typeLength+xidLength+uidLength+oldRawLength+oldRawSize);
+    uli.newData.assign(log.begin()+typeLength+xidLength+uidLength+oldRawLength+oldRawSize,log.end());
     return uli;
 }
 
@@ -262,8 +316,8 @@ Recover::InsertLogInfo Recover::parseInsertLog(std::vector<char>& log){
     InsertLogInfo ili;
     std::copy(log.begin()+typeLength,log.begin()+typeLength+xidLength,reinterpret_cast<char*>(&ili.xid));
     std::copy(log.begin()+typeLength+xidLength,log.begin()+typeLength+xidLength+pageNumberLength,reinterpret_cast<char*>(&ili.pageNumber));
-    std::copy(log.begin()+typeLength+xidLength+pageNumberLength,log.begin()+typeLength+xidLength+xidLength+pageNumberLength+offsetLength,reinterpret_cast<char*>(&ili.offset));
-    std::copy(log.begin()+typeLength+xidLength+pageNumberLength+offsetLength,log.end(),ili.data.begin());
+    std::copy(log.begin()+typeLength+xidLength+pageNumberLength,log.begin()+typeLength+xidLength+pageNumberLength+offsetLength,reinterpret_cast<char*>(&ili.offset));
+    ili.data.assign(log.begin()+typeLength+xidLength+pageNumberLength+offsetLength,log.end());
     return ili;
 }
 
@@ -271,8 +325,36 @@ void Recover::doInsertLog(std::vector<char>& log, int flag){
     InsertLogInfo ili= parseInsertLog(log);
     Page* page=PageCache::instance()->get(ili.pageNumber);
     if(flag==undo){
-        ili.data[0]=1; // 撤销插入，因此将相应的有效位设为无效
+        ili.data[0]|=1; // 撤销插入，因此将相应的有效位设为无效
     }
     PageManager::updateData(page,ili.data,ili.offset);
     PageCache::instance()->release(ili.pageNumber);
-}
\ No newline at end of file
+}
+
+Recover::PageLogInfo Recover::parsePageLog(std::vector<char>& log){
+    PageLogInfo pli;
+    std::copy(log.begin()+typeLength,log.begin()+typeLength+xidLength,reinterpret_cast<char*>(&pli.xid));
+    std::copy(log.begin()+typeLength+xidLength,log.begin()+typeLength+xidLength+pageNumberLength,reinterpret_cast<char*>(&pli.pageNumber));
+    pli.data.assign(log.begin()+typeLength+xidLength+pageNumberLength,log.end());
+    return pli;
+}
+
+void Recover::doPageLog(std::vector<char>& log, int flag){
+    PageLogInfo pli= parsePageLog(log);
+    if(flag==undo){
+        // 撤销整页插入，将页面上每个DataItem的有效位设为无效
+        short fso=0;
+        std::copy(pli.data.begin(),pli.data.begin()+offsetLength,reinterpret_cast<char*>(&fso));
+        const int headerLength=DataItem::validFlagLen+DataItem::dataSizeLen;
+        short offset=offsetLength;
+        while(offset+headerLength<=fso){
+            short dataSize=0;
+            std::copy(pli.data.begin()+offset+DataItem::validFlagLen,pli.data.begin()+offset+headerLength,reinterpret_cast<char*>(&dataSize));
+            pli.data[offset]|=DataItem::invalidFlag;
+            offset+=headerLength+dataSize;
+        }
+    }
+    Page* page=PageCache::instance()->get(pli.pageNumber);
+    PageManager::updateData(page,pli.data,0);
+    PageCache::instance()->release(pli.pageNumber);
+}
@@ -21,7 +21,8 @@ public:
     static std::shared_ptr<Logger> instance(); // 获取Logger的单例对象
     bool init(); // 初始化Logger
 
-    void log(std::vector<char> data); // 提交一条日志
+    void log(const std::vector<char>& data); // 提交一条日志
+    void log(const char* data,int size); // 提交一条日志，日志帧在复用的缓冲区中组装
     std::vector<char> next(); // 获取下一条日志
     void reset(); // 重置position的位置
 
@@ -31,6 +32,7 @@ public:
 private:
     Logger() = default; // 禁用外部构造
     int calCheckSum(int checkSum, std::vector<char>& log); // 在校验和checkSum的基础上继续计算校验和
+    int calCheckSum(int checkSum, const char* log,int size);
     void updateXChecksum(std::vector<char>& log); // 添加一条新日志后需要重新计算并更新校验和
     void checkAndRemoveTail(); // 检查log文件并移除bad tail
     std::vector<char> nextLog(); // 取下一条日志
@@ -41,6 +43,7 @@ private:
 
     long long position; // 当前日志指针的位置
     int xChecksum; // 所有日志的校验和
+    std::vector<char> buffer; // 组装日志帧的缓冲区，在fileLock下复用
     std::fstream file; // 日志文件
     std::mutex fileLock; // 文件访问互斥锁
 };
@@ -60,10 +63,18 @@ public:
         short offset;
         std::vector<char> data;
     };
+    struct PageLogInfo {
+        long long xid;
+        long long pageNumber;
+        std::vector<char> data;
+    };
 
     static void recover(); // 从日志中恢复
-    static std::vector<char> updateLog(long long xid, DataItem& di); // 生成一条更新日志
+    static int updateLogSize(DataItem& di); // 一条更新日志的长度
+    static void updateLog(long long xid, DataItem& di,char* log); // 在log处生成一条更新日志，log至少有updateLogSize(di)字节
     static std::vector<char> insertLog(long long xid, Page* page, std::vector<char>& raw); // 生成一条插入日志
+    static std::vector<char> pageLog(long long xid, long long pageNumber, char* raw, short length); // 生成一条页面日志，记录一个新页面的前length个字节
+    static std::vector<char> rangeLog(long long xid, long long pageNumber, short offset, const char* oldData, const char* newData, short length); // 为页面上[offset,offset+length)的修改生成一条更新日志（例如PAX页面上分散在各个小页中的修改）
 
 private:
     Recover() = default; // 禁用外部构造
@@ -73,13 +84,17 @@ private:
     static void doUpdateLog(std::vector<char>& log, int flag); // 执行更新日志
     static InsertLogInfo parseInsertLog(std::vector<char>& log); // 解析插入日志
     static void doInsertLog(std::vector<char>& log, int flag); // 执行插入日志
+    static PageLogInfo parsePageLog(std::vector<char>& log); // 解析页面日志
+    static void doPageLog(std::vector<char>& log, int flag); // 执行页面日志
 
     static const char updateTypeLog = 0;
     static const char insertTypeLog = 1;
+    static const char pageTypeLog = 2;
     static const int redo = 0;
     static const int undo = 1;
     // 更新日志的格式：[LogType] [XID] [UID] [OldRawLen] [OldRaw] [NewRaw]
     // 插入日志的格式：[LogType] [XID] [PageNumber] [Offset] [Raw]
+    // 页面日志的格式：[LogType] [XID] [PageNumber] [Raw]，Raw为批量插入时整页写入的新页面从页首到FSO的内容
     static const int typeLength=sizeof(char);
     static const int xidLength=sizeof(long long);
     static const int uidLength=sizeof(long long);
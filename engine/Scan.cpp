@@ -0,0 +1,143 @@
+#include "Scan.h"
+
+static std::shared_ptr<WorkerPool> workerPool=nullptr;
+static std::mutex mutex;
+
+std::shared_ptr<WorkerPool> WorkerPool::instance(){
+    // 懒汉模式
+    // 使用双重检查保证线程安全
+    if(workerPool==nullptr){
+        std::unique_lock<std::mutex> lock(mutex); // 访问临界区之前需要加锁
+        if(workerPool==nullptr){
+            workerPool=std::shared_ptr<WorkerPool>(new WorkerPool());
+        }
+    }
+    return workerPool;
+}
+
+void WorkerPool::init(int threadNumber){
+    std::unique_lock<std::mutex> lock(initLock);
+    if(!threads.empty())return;
+    if(threadNumber<=0)threadNumber=std::max(1u,std::thread::hardware_concurrency());
+    for(int i=0;i<threadNumber;i++){
+        queues.push_back(std::unique_ptr<Queue>(new Queue()));
+    }
+    for(int i=0;i<threadNumber;i++){
+        threads.emplace_back(&WorkerPool::work,this,i);
+    }
+}
+
+int WorkerPool::getThreadNumber(){
+    std::unique_lock<std::mutex> lock(initLock);
+    return threads.size();
+}
+
+long long WorkerPool::getSteals(){
+    return steals.load();
+}
+
+void WorkerPool::run(std::vector<Task>& tasks){
+    if(tasks.empty())return;
+    init();
+    int n=queues.size();
+    Job job;
+    job.remaining=tasks.size();
+    // 第i个任务放入第i*n/size个队列，每个队列分到连续的一段
+    for(int i=0;i<(int)tasks.size();i++){
+        Queue& queue=*queues[(long long)i*n/tasks.size()];
+        std::unique_lock<std::mutex> lock(queue.lock);
+        queue.items.push_back({&tasks[i],&job});
+    }
+    {
+        std::unique_lock<std::mutex> lock(sleepLock);
+        pending+=tasks.size();
+    }
+    wake.notify_all();
+    std::unique_lock<std::mutex> lock(job.lock);
+    job.done.wait(lock,[&job]{return job.remaining==0;});
+    if(job.error)std::rethrow_exception(job.error);
+}
+
+bool WorkerPool::take(int worker,Item& item){
+    int n=queues.size();
+    for(int i=0;i<n;i++){
+        Queue& queue=*queues[(worker+i)%n];
+        std::unique_lock<std::mutex> lock(queue.lock);
+        if(queue.items.empty())continue;
+        if(i==0){
+            item=queue.items.front();
+            queue.items.pop_front();
+        }else{
+            item=queue.items.back();
+            queue.items.pop_back();
+            steals++;
+        }
+        pending--;
+        return true;
+    }
+    return false;
+}
+
+void WorkerPool::execute(int worker,Item& item){
+    try{
+        (*item.task)(worker);
+    }catch(...){
+        std::unique_lock<std::mutex> lock(item.job->lock);
+        if(!item.job->error)item.job->error=std::current_exception();
+    }
+    // 计数必须在job的锁下递减并唤醒：run一旦看到remaining为0就会返回并销毁栈上的job，锁外递减之后job可能已经不存在
+    Job* job=item.job;
+    std::unique_lock<std::mutex> lock(job->lock);
+    if(--job->remaining==0)job->done.notify_all();
+}
+
+void WorkerPool::work(int worker){
+    while(true){
+        Item item;
+        if(take(worker,item)){
+            execute(worker,item);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepLock);
+        wake.wait(lock,[this]{return stopping||pending>0;});
+        if(stopping&&pending<=0)return;
+    }
+}
+
+WorkerPool::~WorkerPool(){
+    {
+        std::unique_lock<std::mutex> lock(sleepLock);
+        stopping=true;
+    }
+    wake.notify_all();
+    for(std::thread& thread:threads)thread.join();
+}
+
+ParallelScan::ParallelScan(long long xid,Table* table,const std::vector<int>& columns,int morselPages):xid(xid),table(table),columns(columns),morselPages(morselPages){
+    if(morselPages<=0)throw "bad morsel size";
+}
+
+void ParallelScan::run(const std::function<void(int worker,ColumnBatch& batch)>& consumer){
+    std::shared_ptr<WorkerPool> pool=WorkerPool::instance();
+    pool->init();
+    // 第一页是特殊页，数据页从第2页开始；扫描开始之后新增的页面上不会有对该快照可见的其他事务的行
+    long long last=PageCache::instance()->getPageNumbers();
+    std::vector<ColumnBatch> batches(pool->getThreadNumber());
+    for(ColumnBatch& batch:batches)batch.reset(table,columns);
+    // 乐观事务的读集不能被多个工作线程同时修改：每个工作线程先收集自己读出的uid，全部扫描完成后再合并
+    bool optimistic=VersionManager::instance()->getTransaction(xid)->level==Transaction::optimistic;
+    std::vector<std::vector<long long>> reads(optimistic?pool->getThreadNumber():0);
+    std::vector<WorkerPool::Task> tasks;
+    for(long long first=2;first<=last;first+=morselPages){
+        int number=std::min((long long)morselPages,last-first+1);
+        tasks.push_back([this,first,number,optimistic,&batches,&reads,&consumer](int worker){
+            ColumnBatch& batch=batches[worker];
+            batch.clear();
+            TableManager::instance()->scanPages(xid,table,first,number,batch,false);
+            if(optimistic)reads[worker].insert(reads[worker].end(),batch.uids.begin(),batch.uids.end());
+            if(batch.rows>0)consumer(worker,batch);
+        });
+    }
+    pool->run(tasks);
+    for(std::vector<long long>& uids:reads)TableManager::instance()->recordReads(xid,uids);
+}
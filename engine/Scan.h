@@ -0,0 +1,72 @@
+#ifndef SCAN
+#define SCAN
+
+#include <functional>
+#include <thread>
+#include <exception>
+#include "Table.h"
+
+// 工作线程池：每个工作线程有自己的任务队列，一组任务按连续的区段分到各个队列中
+// 工作线程从自己队列的队首依次取任务（按页号递增的顺序扫描）；自己的队列空了就从其他队列的队尾窃取，窃取到的是对方最后才会处理的任务
+// 同一时刻可以有多个查询各自提交任务组，任务组之间共享工作线程
+class WorkerPool{
+public:
+    using Task=std::function<void(int worker)>; // 任务，参数为执行它的工作线程编号
+
+    static std::shared_ptr<WorkerPool> instance(); // 获取WorkerPool的单例对象
+    void init(int threadNumber=0); // 启动threadNumber个工作线程，0表示按CPU核数；已启动时不做任何事
+    int getThreadNumber();
+    void run(std::vector<Task>& tasks); // 执行一组任务并等待全部完成；有任务抛出异常时，在全部完成后重新抛出第一个异常。不能在任务中调用
+    long long getSteals(); // 累计窃取到的任务数
+
+    ~WorkerPool();
+    WorkerPool(const WorkerPool&) = delete; // 禁用拷贝构造函数
+    WorkerPool& operator=(const WorkerPool&) = delete; // 禁用赋值运算符
+private:
+    // 一次run提交的任务组
+    struct Job{
+        int remaining; // 尚未完成的任务数，只在lock下访问
+        std::exception_ptr error; // 第一个异常
+        std::mutex lock;
+        std::condition_variable done;
+    };
+    struct Item{
+        Task* task;
+        Job* job;
+    };
+    struct Queue{
+        std::deque<Item> items;
+        std::mutex lock;
+    };
+
+    WorkerPool() = default; // 禁用外部构造
+    void work(int worker); // 工作线程的主循环
+    bool take(int worker,Item& item); // 先从自己的队首取，再从其他队列的队尾窃取
+    void execute(int worker,Item& item);
+
+    std::vector<std::unique_ptr<Queue>> queues; // 每个工作线程的队列
+    std::vector<std::thread> threads;
+    std::atomic<long long> pending{0}; // 已入队尚未被取走的任务数
+    std::atomic<long long> steals{0};
+    bool stopping=false;
+    std::mutex sleepLock; // 空闲线程在wake上等待
+    std::condition_variable wake;
+    std::mutex initLock;
+};
+
+// 并行全表扫描（morsel驱动）：把数据页的页号区间切成固定页数的morsel，每个morsel是WorkerPool中的一个任务
+// 每个工作线程复用一个ColumnBatch，读完一个morsel中所有页面上对事务可见的行后交给consumer
+// 所有工作线程使用同一个事务（同一个快照）判断可见性，扫描期间不修改事务的状态（乐观事务读出的uid在扫描结束后才记入读集）；consumer在工作线程中并发调用，需要自行同步（例如按worker编号分别聚合，最后合并）
+class ParallelScan{
+public:
+    static const int defaultMorselPages=32;
+    ParallelScan(long long xid,Table* table,const std::vector<int>& columns,int morselPages=defaultMorselPages);
+    void run(const std::function<void(int worker,ColumnBatch& batch)>& consumer); // 扫描全表，返回时所有morsel都已交给consumer
+private:
+    long long xid;
+    Table* table;
+    std::vector<int> columns; // 要读取的列
+    int morselPages; // 每个morsel的页数
+};
+
+#endif
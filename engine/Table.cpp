@@ -1 +1,687 @@
 #include "Table.h"
+
+static std::shared_ptr<TableManager> tableManager=nullptr;
+static std::mutex mutex;
+
+// 块中的值不保证对齐，经memcpy读写
+template<typename T>
+static T load(const char* p){
+    T value;
+    std::memcpy(&value,p,sizeof(T));
+    return value;
+}
+
+template<typename T>
+static void save(char* p,T value){
+    std::memcpy(p,&value,sizeof(T));
+}
+
+int Column::widthOf(Type type){
+    switch(type){
+        case int32:return sizeof(int);
+        case int64:return sizeof(long long);
+        case float64:return sizeof(double);
+        default:return 2*sizeof(unsigned short); // 变长列的槽：偏移和长度
+    }
+}
+
+Table::Table(const std::string& name,const std::vector<std::pair<std::string,Column::Type>>& columns):name(name){
+    for(auto& column:columns){
+        this->columns.push_back({column.first,column.second,fixedSize});
+        fixedSize+=Column::widthOf(column.second);
+    }
+}
+
+const std::string& Table::getName(){
+    return name;
+}
+
+Table::Layout Table::getLayout(){
+    return layout;
+}
+
+bool Table::isCompressed(){
+    return compressed;
+}
+
+long long Table::getUid(){
+    return uid;
+}
+
+int Table::getColumnNumber(){
+    return columns.size();
+}
+
+Column& Table::getColumn(int i){
+    return columns[i];
+}
+
+int Table::columnIndex(const std::string& name){
+    for(int i=0;i<(int)columns.size();i++){
+        if(columns[i].name==name)return i;
+    }
+    return -1;
+}
+
+int Table::getFixedSize(){
+    return fixedSize;
+}
+
+void Table::layoutPax(){
+    // 按每行的XCRT、XDEL和定长区估算容量，每个字符串列再为变长区预留16字节；字符串更长时块会先被变长区填满
+    int strings=0;
+    for(Column& column:columns){
+        if(column.type==Column::string)strings++;
+    }
+    int perRow=2*sizeof(long long)+fixedSize+16*strings;
+    paxCapacity=(PaxBlock::blockSize()-PaxBlock::headerSize)/perRow;
+    if(paxCapacity<=0)throw "row is too wide for pax layout";
+    xdelOffset=PaxBlock::xcrtOffset+paxCapacity*sizeof(long long);
+    int offset=xdelOffset+paxCapacity*sizeof(long long);
+    minipages.clear();
+    for(Column& column:columns){
+        minipages.push_back(offset);
+        offset+=paxCapacity*Column::widthOf(column.type);
+    }
+    varBottom=offset;
+}
+
+// 目录项结构：[Next] [NameLength] [Name] [ColumnNumber] {[Type] [NameLength] [Name]}... [Layout]
+// Next 8字节；NameLength、ColumnNumber 2字节；Type、Layout 1字节；没有Layout的目录项（旧版本创建）为row
+std::vector<char> Table::encode(){
+    std::vector<char> raw;
+    auto append=[&raw](const void* p,int n){
+        const char* c=reinterpret_cast<const char*>(p);
+        raw.insert(raw.end(),c,c+n);
+    };
+    append(&next,sizeof(next));
+    short length=name.size();
+    append(&length,sizeof(length));
+    append(name.data(),length);
+    short number=columns.size();
+    append(&number,sizeof(number));
+    for(Column& column:columns){
+        char type=column.type;
+        append(&type,sizeof(type));
+        length=column.name.size();
+        append(&length,sizeof(length));
+        append(column.name.data(),length);
+    }
+    char layout=this->layout;
+    append(&layout,sizeof(layout));
+    char compressed=this->compressed;
+    append(&compressed,sizeof(compressed));
+    return raw;
+}
+
+Table* Table::decode(const char* data,int length){
+    const char* p=data;
+    const char* end=data+length;
+    auto take=[&p,end](void* out,int n){
+        if(p+n>end)throw "bad table entry";
+        std::memcpy(out,p,n);
+        p+=n;
+    };
+    long long next;
+    take(&next,sizeof(next));
+    short nameLength;
+    take(&nameLength,sizeof(nameLength));
+    std::string name(nameLength,0);
+    take(&(name[0]),nameLength);
+    short number;
+    take(&number,sizeof(number));
+    std::vector<std::pair<std::string,Column::Type>> columns;
+    for(int i=0;i<number;i++){
+        char type;
+        take(&type,sizeof(type));
+        take(&nameLength,sizeof(nameLength));
+        std::string columnName(nameLength,0);
+        take(&(columnName[0]),nameLength);
+        columns.push_back({columnName,(Column::Type)type});
+    }
+    // 较早的目录项没有存储方式和压缩标志
+    char layout=row;
+    if(p<end)take(&layout,sizeof(layout));
+    char compressed=0;
+    if(p<end)take(&compressed,sizeof(compressed));
+    Table* table=new Table(name,columns);
+    table->next=next;
+    table->layout=(Layout)layout;
+    table->compressed=compressed!=0;
+    if(table->layout==pax)table->layoutPax();
+    return table;
+}
+
+int PaxBlock::blockSize(){
+    return PageCache::getPageSize()-sizeof(short)-DataItem::validFlagLen-DataItem::dataSizeLen;
+}
+
+char* PaxBlock::locate(Page* page){
+    char* raw=page->getData()+sizeof(short);
+    if((raw[0]&(DataItem::invalidFlag|DataItem::versionedFlag))!=0)return nullptr;
+    if(load<short>(raw+DataItem::validFlagLen)!=blockSize())return nullptr;
+    char* block=raw+DataItem::validFlagLen+DataItem::dataSizeLen;
+    if(load<int>(block)!=magic)return nullptr;
+    return block;
+}
+
+long long PaxBlock::tableOf(const char* block){
+    return load<long long>(block+8);
+}
+
+int PaxBlock::count(const char* block){
+    return load<unsigned short>(block+16);
+}
+
+int PaxBlock::varTop(const char* block){
+    return load<unsigned short>(block+18);
+}
+
+void PaxBlock::setHeader(char* block,int count,int varTop){
+    save<unsigned short>(block+16,count);
+    save<unsigned short>(block+18,varTop);
+}
+
+std::vector<char> PaxBlock::empty(Table* table){
+    std::vector<char> block(blockSize(),0);
+    save<int>(block.data(),magic);
+    save<long long>(block.data()+8,table->uid);
+    setHeader(block.data(),0,blockSize());
+    return block;
+}
+
+void ColumnBatch::reset(Table* table,const std::vector<int>& columns){
+    this->columns=columns;
+    types.clear();
+    for(int column:columns)types.push_back(table->getColumn(column).type);
+    values.assign(columns.size(),std::vector<char>());
+    clear();
+}
+
+void ColumnBatch::clear(){
+    for(auto& value:values)value.clear();
+    heap.clear();
+    uids.clear();
+    rows=0;
+}
+
+void ColumnBatch::append(int i,const char* value){
+    values[i].insert(values[i].end(),value,value+Column::widthOf(types[i]));
+}
+
+void ColumnBatch::appendString(int i,std::string_view value){
+    int slot[2]={(int)heap.size(),(int)value.size()};
+    const char* p=reinterpret_cast<const char*>(slot);
+    values[i].insert(values[i].end(),p,p+sizeof(slot));
+    heap.insert(heap.end(),value.begin(),value.end());
+}
+
+RowBuilder::RowBuilder(Table* table):table(table),row(table->getFixedSize(),0){
+}
+
+std::vector<char>& RowBuilder::getRow(){
+    return row;
+}
+
+void RowBuilder::clear(){
+    row.assign(table->getFixedSize(),0);
+}
+
+Row::Row(Table* table,const char* data,int length):table(table),data(data),length(length){
+}
+
+const char* Row::getData(){
+    return data;
+}
+
+int Row::getLength(){
+    return length;
+}
+
+std::shared_ptr<TableManager> TableManager::instance(){
+    // 懒汉模式
+    // 使用双重检查保证线程安全
+    if(tableManager==nullptr){
+        std::unique_lock<std::mutex> lock(mutex); // 访问临界区之前需要加锁
+        if(tableManager==nullptr){
+            tableManager=std::shared_ptr<TableManager>(new TableManager());
+        }
+    }
+    return tableManager;
+}
+
+void TableManager::init(){
+    std::unique_lock<std::shared_mutex> lock(catalogLock);
+    head=readBoot();
+    // 沿目录链读入所有的表，链上是从新到旧的顺序
+    long long xid=VersionManager::instance()->begin(Transaction::readCommitted);
+    long long uid=head;
+    ReadBatch batch;
+    try{
+        while(uid!=0){
+            VersionManager::instance()->readMany(xid,{uid},batch);
+            if(!batch.found(0))throw "table entry not found";
+            Table* table=Table::decode(batch.data(0),batch.length(0));
+            table->uid=uid;
+            tables[table->name]=table;
+            order.insert(order.begin(),table);
+            uid=table->next;
+        }
+    }catch(...){
+        VersionManager::instance()->abort(xid);
+        throw;
+    }
+    VersionManager::instance()->commit(xid);
+}
+
+TableManager::~TableManager(){
+    for(Table* table:order)delete table;
+}
+
+Table* TableManager::createTable(const std::string& name,const std::vector<std::pair<std::string,Column::Type>>& columns,Table::Layout layout,bool compressed){
+    if(columns.empty())throw "table has no columns";
+    if(compressed&&layout!=Table::pax)throw "only pax tables can be compressed"; // row表的页面由多张表共用
+    std::unique_lock<std::shared_mutex> lock(catalogLock);
+    if(tables.count(name)!=0)throw "table already exists";
+    Table* table=new Table(name,columns);
+    table->next=head;
+    table->layout=layout;
+    table->compressed=compressed;
+    if(layout==Table::pax){
+        try{
+            table->layoutPax();
+        }catch(...){
+            delete table;
+            throw;
+        }
+    }
+    std::vector<char> raw=table->encode();
+    long long xid=VersionManager::instance()->begin(Transaction::readCommitted);
+    try{
+        table->uid=VersionManager::instance()->insert(xid,raw);
+        VersionManager::instance()->commit(xid);
+    }catch(...){
+        VersionManager::instance()->abort(xid);
+        delete table;
+        throw;
+    }
+    // 目录项提交之后才更新.bt；在此之前崩溃只会留下一个无法到达的目录项
+    writeBoot(table->uid);
+    head=table->uid;
+    tables[name]=table;
+    order.push_back(table);
+    return table;
+}
+
+Table* TableManager::getTable(const std::string& name){
+    std::shared_lock<std::shared_mutex> lock(catalogLock);
+    auto iter=tables.find(name);
+    return iter==tables.end()?nullptr:iter->second;
+}
+
+std::vector<Table*> TableManager::getTables(){
+    std::shared_lock<std::shared_mutex> lock(catalogLock);
+    return order;
+}
+
+long long TableManager::insert(long long xid,Table* table,std::vector<char>& row){
+    std::vector<std::vector<char>> rows(1,row);
+    return insertMany(xid,table,rows)[0];
+}
+
+std::vector<long long> TableManager::insertMany(long long xid,Table* table,std::vector<std::vector<char>>& rows){
+    for(auto& row:rows){
+        if((int)row.size()<table->getFixedSize())throw "row is too short";
+    }
+    if(table->layout==Table::pax)return insertPax(xid,table,rows);
+    // row表的每行前加上表的uid
+    std::vector<std::vector<char>> payloads;
+    payloads.reserve(rows.size());
+    for(auto& row:rows){
+        std::vector<char> payload(sizeof(long long));
+        save<long long>(payload.data(),table->uid);
+        payload.insert(payload.end(),row.begin(),row.end());
+        payloads.push_back(std::move(payload));
+    }
+    if(payloads.size()==1)return {VersionManager::instance()->insert(xid,payloads[0])};
+    return VersionManager::instance()->bulkInsert(xid,payloads);
+}
+
+std::vector<long long> TableManager::insertPax(long long xid,Table* table,std::vector<std::vector<char>>& rows){
+    VersionManager::instance()->getTransaction(xid); // 检查事务是否活跃
+    int number=table->getColumnNumber();
+    // 每行变长数据的总长度，同时检查字符串槽是否越界
+    std::vector<int> varSizes;
+    for(auto& row:rows){
+        int size=0;
+        for(int c=0;c<number;c++){
+            Column& column=table->getColumn(c);
+            if(column.type!=Column::string)continue;
+            unsigned short position=load<unsigned short>(row.data()+column.offset);
+            unsigned short length=load<unsigned short>(row.data()+column.offset+sizeof(position));
+            if(length>0&&position+length>(int)row.size())throw "bad row";
+            size+=length;
+        }
+        varSizes.push_back(size);
+    }
+
+    std::vector<long long> uids;
+    std::unique_lock<std::mutex> lock(table->insertLock);
+    int i=0;
+    while(i<(int)rows.size()){
+        if(table->openBlock==0){
+            std::vector<char> block=PaxBlock::empty(table);
+            table->openBlock=DataManager::instance()->insert(TransactionManager::supperXID,block,false,table->compressed);
+        }
+        long long pageNumber=table->openBlock>>32;
+        Page* page=PageCache::instance()->get(pageNumber);
+        page->writeLatch();
+        char* block=PaxBlock::locate(page);
+        int count=PaxBlock::count(block);
+        int varTop=PaxBlock::varTop(block);
+        // 尽可能多地把行放入当前块
+        int n=0;
+        int newVarTop=varTop;
+        while(i+n<(int)rows.size()&&count+n<table->paxCapacity&&newVarTop-varSizes[i+n]>=table->varBottom){
+            newVarTop-=varSizes[i+n];
+            n++;
+        }
+        if(n==0){
+            page->writeUnlatch();
+            PageCache::instance()->release(pageNumber);
+            if(count==0)throw "row is too large";
+            table->openBlock=0;
+            continue;
+        }
+
+        // 在块之外构造每个小页中新写入的部分和新的变长区，先记录日志再一次拷入页面
+        short base=block-page->getData(); // 块在页面中的偏移
+        std::vector<std::vector<char>> images(number);
+        for(int c=0;c<number;c++){
+            images[c].resize(n*Column::widthOf(table->getColumn(c).type));
+        }
+        std::vector<char> var(varTop-newVarTop);
+        int top=varTop;
+        for(int r=0;r<n;r++){
+            std::vector<char>& row=rows[i+r];
+            for(int c=0;c<number;c++){
+                Column& column=table->getColumn(c);
+                int width=Column::widthOf(column.type);
+                if(column.type!=Column::string){
+                    std::memcpy(images[c].data()+r*width,row.data()+column.offset,width);
+                    continue;
+                }
+                std::string_view value=ColumnCodec<std::string_view>::decode(row.data(),column.offset);
+                top-=value.size();
+                std::memcpy(var.data()+(top-newVarTop),value.data(),value.size());
+                unsigned short slot[2]={(unsigned short)top,(unsigned short)value.size()};
+                std::memcpy(images[c].data()+r*width,slot,sizeof(slot));
+            }
+        }
+        std::vector<char> xcrt(n*sizeof(long long));
+        for(int r=0;r<n;r++)save<long long>(xcrt.data()+r*sizeof(long long),xid);
+        char header[4];
+        save<unsigned short>(header,count+n);
+        save<unsigned short>(header+2,newVarTop);
+
+        auto apply=[&](long long logXid,int offset,const std::vector<char>& image){
+            if(image.empty())return;
+            std::vector<char> log=Recover::rangeLog(logXid,pageNumber,base+offset,block+offset,image.data(),image.size());
+            Logger::instance()->log(log);
+            std::memcpy(block+offset,image.data(),image.size());
+        };
+        for(int c=0;c<number;c++){
+            apply(TransactionManager::supperXID,table->minipages[c]+count*Column::widthOf(table->getColumn(c).type),images[c]);
+        }
+        apply(TransactionManager::supperXID,newVarTop,var);
+        apply(TransactionManager::supperXID,16,std::vector<char>(header,header+sizeof(header)));
+        // 只有XCRT记录在插入的事务下，事务在崩溃时未结束则撤销为0，该行成为未使用的行
+        apply(xid,PaxBlock::xcrtOffset+count*sizeof(long long),xcrt);
+        page->setDirty(true);
+        page->writeUnlatch();
+        PageCache::instance()->release(pageNumber);
+
+        for(int r=0;r<n;r++){
+            uids.push_back(pageNumber<<32|PaxBlock::paxFlag|(count+r));
+        }
+        if(count+n==table->paxCapacity)table->openBlock=0;
+        i+=n;
+    }
+    return uids;
+}
+
+bool TableManager::read(long long xid,Table* table,long long uid,std::vector<char>& row){
+    if(table->layout==Table::pax){
+        Transaction* t=VersionManager::instance()->getTransaction(xid);
+        return readPax(t,table,uid,row);
+    }
+    if((uid&PaxBlock::paxFlag)!=0)return false; // PAX行的uid不指向DataItem
+    ReadBatch batch;
+    VersionManager::instance()->readMany(xid,{uid},batch);
+    if(!batch.found(0)||batch.length(0)<(int)sizeof(long long))return false;
+    if(load<long long>(batch.data(0))!=table->uid)return false;
+    row.assign(batch.data(0)+sizeof(long long),batch.data(0)+batch.length(0));
+    return true;
+}
+
+bool TableManager::readPax(Transaction* t,Table* table,long long uid,std::vector<char>& row){
+    if((uid&PaxBlock::paxFlag)==0)return false;
+    long long pageNumber=uid>>32;
+    int slot=uid&0xffff;
+    if(t->level==Transaction::optimistic)t->readSet.insert(uid);
+    Page* page=PageCache::instance()->get(pageNumber);
+    page->readLatch();
+    char* block=PaxBlock::locate(page);
+    bool found=block!=nullptr&&PaxBlock::tableOf(block)==table->uid&&slot<PaxBlock::count(block);
+    if(found){
+        long long xcrt=load<long long>(block+PaxBlock::xcrtOffset+slot*sizeof(long long));
+        long long xdel=load<long long>(block+table->xdelOffset+slot*sizeof(long long));
+        found=xcrt!=0&&Visibility::isVisible(t,xcrt,xdel);
+    }
+    if(found){
+        // 按行格式重新拼出这一行
+        row.assign(table->getFixedSize(),0);
+        for(int c=0;c<table->getColumnNumber();c++){
+            Column& column=table->getColumn(c);
+            int width=Column::widthOf(column.type);
+            const char* value=block+table->minipages[c]+slot*width;
+            if(column.type!=Column::string){
+                std::memcpy(row.data()+column.offset,value,width);
+                continue;
+            }
+            unsigned short position=load<unsigned short>(value);
+            unsigned short length=load<unsigned short>(value+sizeof(position));
+            ColumnCodec<std::string_view>::encode(row,column.offset,std::string_view(block+position,length));
+        }
+    }
+    page->readUnlatch();
+    PageCache::instance()->release(pageNumber);
+    return found;
+}
+
+bool TableManager::del(long long xid,Table* table,long long uid){
+    if(table->layout==Table::pax){
+        Transaction* t=VersionManager::instance()->getTransaction(xid);
+        return delPax(t,table,uid);
+    }
+    std::vector<char> row;
+    if(!read(xid,table,uid,row))return false;
+    return VersionManager::instance()->del(xid,uid);
+}
+
+bool TableManager::delPax(Transaction* t,Table* table,long long uid){
+    std::vector<char> row;
+    if(!readPax(t,table,uid,row))return false;
+    if(t->level!=Transaction::optimistic){
+        // 与VersionManager::del相同：乐观模式不经过锁表，冲突留到写XDEL和提交验证时发现
+        try{
+            LockTable::instance()->add(t->xid,uid);
+        }catch(const char* e){
+            VersionManager::instance()->autoAbort(t);
+            throw;
+        }
+    }
+    long long pageNumber=uid>>32;
+    int slot=uid&0xffff;
+    Page* page=PageCache::instance()->get(pageNumber);
+    page->writeLatch();
+    char* block=PaxBlock::locate(page);
+    int offset=table->xdelOffset+slot*sizeof(long long);
+    long long owner=load<long long>(block+offset);
+    bool result=false;
+    if(owner==t->xid)result=false;
+    else if(!Entry::isClaimable(owner)){
+        // 与Entry::claimXDEL相同：该行正在被另一个活跃事务删除，或已被一个已提交的事务删除
+        page->writeUnlatch();
+        PageCache::instance()->release(pageNumber);
+        VersionManager::instance()->autoAbort(t);
+        throw "concurrent update";
+    }else{
+        char xdel[sizeof(long long)];
+        save<long long>(xdel,t->xid);
+        short base=block-page->getData();
+        std::vector<char> log=Recover::rangeLog(t->xid,pageNumber,base+offset,block+offset,xdel,sizeof(xdel));
+        Logger::instance()->log(log);
+        std::memcpy(block+offset,xdel,sizeof(xdel));
+        page->setDirty(true);
+        t->writeSet.insert(uid);
+        result=true;
+    }
+    page->writeUnlatch();
+    PageCache::instance()->release(pageNumber);
+    return result;
+}
+
+void TableManager::scanPage(long long xid,Table* table,long long pageNumber,ColumnBatch& batch){
+    scanPages(xid,table,pageNumber,1,batch);
+}
+
+void TableManager::scanPages(long long xid,Table* table,long long first,int number,ColumnBatch& batch,bool record){
+    if(first<2){
+        number-=2-first;
+        first=2;
+    }
+    if(number<=0)return;
+    Transaction* t=VersionManager::instance()->getTransaction(xid);
+    int scanned=batch.uids.size(); // 本次扫描追加的行从这里开始
+    long long last=first+number-1;
+    PageCache::instance()->scanHint(first,last);
+    try{
+        for(long long pageNumber=first;pageNumber<=last;pageNumber++){
+            Page* page=PageCache::instance()->get(pageNumber);
+            try{
+                if(table->layout==Table::pax)scanPaxPage(t,table,page,batch);
+                else scanRowPage(t,table,page,batch);
+            }catch(...){
+                PageCache::instance()->release(pageNumber);
+                throw;
+            }
+            PageCache::instance()->release(pageNumber);
+        }
+    }catch(...){
+        PageCache::instance()->clearScanHint(first,last);
+        throw;
+    }
+    PageCache::instance()->clearScanHint(first,last);
+    // 和逐行读取一样，扫描读到的行也要参与乐观验证，否则扫描期间被删除的行不会使事务撤销
+    if(record&&t->level==Transaction::optimistic)t->readSet.insert(batch.uids.begin()+scanned,batch.uids.end());
+}
+
+void TableManager::recordReads(long long xid,const std::vector<long long>& uids){
+    Transaction* t=VersionManager::instance()->getTransaction(xid);
+    if(t->level==Transaction::optimistic)t->readSet.insert(uids.begin(),uids.end());
+}
+
+void TableManager::scanPaxPage(Transaction* t,Table* table,Page* page,ColumnBatch& batch){
+    page->readLatch();
+    char* block=PaxBlock::locate(page);
+    if(block==nullptr||PaxBlock::tableOf(block)!=table->uid){
+        page->readUnlatch();
+        return;
+    }
+    int n=PaxBlock::count(block);
+    // 拷出XCRT和XDEL小页，整块批量判断可见性；XCRT为0的行是未使用的行
+    std::vector<long long> xcrt(n),xdel(n);
+    std::memcpy(xcrt.data(),block+PaxBlock::xcrtOffset,n*sizeof(long long));
+    std::memcpy(xdel.data(),block+table->xdelOffset,n*sizeof(long long));
+    std::vector<char> visible(n);
+    Visibility::evaluate(t,xcrt.data(),xdel.data(),n,visible.data());
+    for(int r=0;r<n;r++){
+        if(xcrt[r]==0)visible[r]=0;
+    }
+    // 只读取要求的列的小页
+    for(int i=0;i<(int)batch.columns.size();i++){
+        Column& column=table->getColumn(batch.columns[i]);
+        int width=Column::widthOf(column.type);
+        const char* minipage=block+table->minipages[batch.columns[i]];
+        for(int r=0;r<n;r++){
+            if(!visible[r])continue;
+            if(column.type!=Column::string){
+                batch.append(i,minipage+r*width);
+                continue;
+            }
+            unsigned short position=load<unsigned short>(minipage+r*width);
+            unsigned short length=load<unsigned short>(minipage+r*width+sizeof(position));
+            batch.appendString(i,std::string_view(block+position,length));
+        }
+    }
+    long long pageNumber=page->getPageNumber();
+    for(int r=0;r<n;r++){
+        if(!visible[r])continue;
+        batch.uids.push_back(pageNumber<<32|PaxBlock::paxFlag|r);
+        batch.rows++;
+    }
+    page->readUnlatch();
+}
+
+void TableManager::scanRowPage(Transaction* t,Table* table,Page* page,ColumnBatch& batch){
+    PageVersions versions;
+    Visibility::scanPage(t,page,versions);
+    // Entry的数据在插入后不再改变，可以在判断可见性之后再加读闩锁拷出
+    page->readLatch();
+    char* data=page->getData();
+    long long pageNumber=page->getPageNumber();
+    for(int e=0;e<versions.size();e++){
+        if(!versions.visible[e]||versions.lengths[e]<(int)sizeof(long long)+table->getFixedSize())continue;
+        const char* payload=data+versions.offsets[e]+DataItem::validFlagLen+DataItem::dataSizeLen+2*sizeof(long long);
+        if(load<long long>(payload)!=table->uid)continue;
+        const char* row=payload+sizeof(long long);
+        for(int i=0;i<(int)batch.columns.size();i++){
+            Column& column=table->getColumn(batch.columns[i]);
+            if(column.type!=Column::string)batch.append(i,row+column.offset);
+            else batch.appendString(i,ColumnCodec<std::string_view>::decode(row,column.offset));
+        }
+        batch.uids.push_back(pageNumber<<32|versions.offsets[e]);
+        batch.rows++;
+    }
+    page->readUnlatch();
+}
+
+long long TableManager::readBoot(){
+    std::ifstream file(".bt",std::ios::in|std::ios::binary);
+    if(!file.good())return 0;
+    long long uid=0;
+    file.read(reinterpret_cast<char*>(&uid),sizeof(uid));
+    if(file.gcount()!=sizeof(uid))throw "bad boot file";
+    return uid;
+}
+
+void TableManager::writeBoot(long long uid){
+    // 临时文件的内容落盘之后才用rename替换.bt，rename前后各同步一次目录，崩溃后.bt要么是旧的要么是新的，不会是空的或不完整的
+    int fd=open(".bt_tmp",O_WRONLY|O_CREAT|O_TRUNC,0644);
+    if(fd<0)throw "cannot write boot file";
+    bool written=write(fd,&uid,sizeof(uid))==(ssize_t)sizeof(uid)&&fsync(fd)==0;
+    close(fd);
+    if(!written)throw "cannot write boot file";
+    syncDirectory();
+    if(rename(".bt_tmp",".bt")!=0)throw "cannot write boot file";
+    syncDirectory();
+}
+
+void TableManager::syncDirectory(){
+    int fd=open(".",O_RDONLY|O_DIRECTORY);
+    if(fd<0)throw "cannot sync directory";
+    bool synced=fsync(fd)==0;
+    close(fd);
+    if(!synced)throw "cannot sync directory";
+}
@@ -1,10 +1,246 @@
 #ifndef TABLE
 #define TABLE
 
+#include <vector>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <shared_mutex>
+#include <fstream>
+#include <filesystem>
+#include <cstring>
+#include <mutex>
+#include "Version.h"
 
-class TableManager {
+// 列的定义；offset是该列在行的定长区中的偏移，建表时按列的顺序一次算好
+struct Column{
+    enum Type{int32,int64,float64,string};
+    std::string name;
+    Type type;
+    int offset; // 定长区中的偏移
+    static int widthOf(Type type); // 列在定长区中占用的字节数；变长列在定长区中只有一个4字节的槽
+};
+
+// 表的结构信息，保存在目录中
+// 行格式：[定长区] [变长尾部]。定长列按其offset直接存放在定长区中；变长列在定长区中占一个槽（2字节偏移、2字节长度），数据依次放在尾部
+// 因此读取第k列只需要一次指针偏移，不需要解析它前面的列
+// 表的存储方式在建表时选定：row按行追加，每行是一条Entry（数据前加上表的uid，按页扫描时据此区分不同的表）；pax按列存放在表独占的页面中，见PaxBlock
+class Table{
+public:
+    friend class TableManager;
+    friend class PaxBlock;
+    enum Layout{row,pax};
+    const std::string& getName();
+    Layout getLayout();
+    bool isCompressed(); // pax表的页面写回时是否压缩
+    long long getUid(); // 目录项的uid
+    int getColumnNumber();
+    Column& getColumn(int i);
+    int columnIndex(const std::string& name); // 列名对应的下标，不存在时返回-1
+    int getFixedSize(); // 定长区的长度
+private:
+    Table(const std::string& name,const std::vector<std::pair<std::string,Column::Type>>& columns);
+    std::vector<char> encode(); // 编码为目录项
+    static Table* decode(const char* data,int length); // 从目录项解码
+
+    std::string name;
+    long long uid=0; // 目录项的uid
+    long long next=0; // 目录中上一个被创建的表的目录项uid
+    std::vector<Column> columns;
+    int fixedSize=0;
+    Layout layout=row;
+    bool compressed=false; // 建表时选定，之后不能修改；压缩表的块的DataItem带有压缩标志位
+
+    // PAX布局：每个块中各小页的位置，建表时按列的宽度一次算好，所有块都相同
+    void layoutPax();
+    int paxCapacity=0; // 每个块最多存放的行数
+    int xdelOffset=0; // XDEL小页在块中的偏移（XCRT小页紧跟在块头之后）
+    std::vector<int> minipages; // 每一列的小页在块中的偏移
+    int varBottom=0; // 变长区的下界（最后一个小页的末尾）
+    long long openBlock=0; // 正在追加的块的uid，0表示没有
+    std::mutex insertLock; // 追加行的锁
+};
+
+// PAX块：PAX表的页面上只有一个占满整个页面的DataItem（由超级事务插入，不是Entry），其数据为一个块
+// 块结构：[Magic] [TableUid] [Count] [VarTop] [XCRT小页] [XDEL小页] [列0小页] ... [列N-1小页] [变长区]
+// Magic 4字节，之后4字节填充；TableUid 8字节；Count 2字节，为已分配的行数；VarTop 2字节，变长区从块的末尾向下增长，VarTop为其下界；之后4字节填充
+// 每个小页连续存放所有行的同一列（字符串列存放指向变长区的槽），XCRT和XDEL也各在自己的小页中，扫描只读到需要的列，可见性可以直接在XCRT/XDEL数组上批量判断
+// 行的uid为 页号<<32 | paxFlag | 行号；XCRT为0的行是未使用的行（插入它的事务在崩溃后被撤销）
+// 计数、变长区和列值的修改由超级事务记录日志（总是重做），只有XCRT和XDEL的修改记录在插入（删除）的事务下，撤销时只需恢复这两个小页
+// 块在页面中从第5个字节开始，不保证对齐，块中的值都经memcpy读写
+class PaxBlock{
+public:
+    static const int magic=0x31584150; // "PAX1"
+    static const int headerSize=24;
+    static const long long paxFlag=1LL<<30; // PAX行uid的标志位
+    static const int xcrtOffset=headerSize; // XCRT小页的偏移
+    static int blockSize(); // 块的长度：页面中除去FSO和DataItem头部的全部空间
+    static char* locate(Page* page); // 页面是PAX块时返回块的起始位置，否则返回nullptr
+    static long long tableOf(const char* block);
+    static int count(const char* block);
+    static int varTop(const char* block);
+    static void setHeader(char* block,int count,int varTop);
+    static std::vector<char> empty(Table* table); // 一个空块的数据
+};
+
+// 按列类型由模板生成的编解码函数：定长类型直接按偏移拷贝，字符串在定长区中保存指向尾部的槽
+template<typename T,Column::Type TYPE>
+struct FixedCodec{
+    static const Column::Type type=TYPE;
+    static void encode(std::vector<char>& row,int offset,const T& value){
+        std::memcpy(&(row[offset]),&value,sizeof(T));
+    }
+    static T decode(const char* row,int offset){
+        T value;
+        std::memcpy(&value,row+offset,sizeof(T));
+        return value;
+    }
+};
+
+template<typename T>
+struct ColumnCodec;
+
+template<>
+struct ColumnCodec<int>:FixedCodec<int,Column::int32>{};
+
+template<>
+struct ColumnCodec<long long>:FixedCodec<long long,Column::int64>{};
+
+template<>
+struct ColumnCodec<double>:FixedCodec<double,Column::float64>{};
 
+template<>
+struct ColumnCodec<std::string_view>{
+    static const Column::Type type=Column::string;
+    static void encode(std::vector<char>& row,int offset,std::string_view value){
+        if(row.size()+value.size()>65535)throw "row is too large";
+        unsigned short position=row.size();
+        unsigned short length=value.size();
+        std::memcpy(&(row[offset]),&position,sizeof(position));
+        std::memcpy(&(row[offset])+sizeof(position),&length,sizeof(length));
+        row.insert(row.end(),value.begin(),value.end());
+    }
+    static std::string_view decode(const char* row,int offset){
+        unsigned short position;
+        unsigned short length;
+        std::memcpy(&position,row+offset,sizeof(position));
+        std::memcpy(&length,row+offset+sizeof(position),sizeof(length));
+        return std::string_view(row+position,length);
+    }
 };
 
+template<>
+struct ColumnCodec<std::string>{
+    static const Column::Type type=Column::string;
+    static void encode(std::vector<char>& row,int offset,const std::string& value){
+        ColumnCodec<std::string_view>::encode(row,offset,value);
+    }
+    static std::string decode(const char* row,int offset){
+        return std::string(ColumnCodec<std::string_view>::decode(row,offset));
+    }
+};
+
+// 按列读出的一批行：每个读取的列一个数组，定长值依次存放，字符串列存放8字节的槽（在heap中的偏移和长度，各4字节）
+struct ColumnBatch{
+    std::vector<int> columns; // 读取的列在表中的下标
+    std::vector<Column::Type> types; // 读取的列的类型
+    std::vector<std::vector<char>> values; // 第i个读取的列的值
+    std::vector<char> heap; // 字符串数据
+    std::vector<long long> uids; // 每一行的uid
+    int rows=0;
+    void reset(Table* table,const std::vector<int>& columns); // 设置要读取的列，并清空
+    void clear(); // 清空数据，保留要读取的列
+    void append(int i,const char* value); // 为第i个读取的列追加一个定长值
+    void appendString(int i,std::string_view value); // 为第i个读取的列追加一个字符串
+    template<typename T>
+    T get(int i,int row){
+        if(types[i]!=ColumnCodec<T>::type)throw "column type mismatch";
+        T value;
+        std::memcpy(&value,&(values[i][row*sizeof(T)]),sizeof(T));
+        return value;
+    }
+};
+
+template<>
+inline std::string_view ColumnBatch::get<std::string_view>(int i,int row){
+    if(types[i]!=Column::string)throw "column type mismatch";
+    int slot[2];
+    std::memcpy(slot,&(values[i][row*sizeof(slot)]),sizeof(slot));
+    return std::string_view(heap.data()+slot[0],slot[1]);
+}
+
+// 构造一行数据：先按表的定长区大小分配，再逐列设置；变长列按设置的顺序追加到尾部
+class RowBuilder{
+public:
+    explicit RowBuilder(Table* table);
+    template<typename T>
+    void set(int column,const T& value){
+        Column& c=table->getColumn(column);
+        if(c.type!=ColumnCodec<T>::type)throw "column type mismatch";
+        ColumnCodec<T>::encode(row,c.offset,value);
+    }
+    std::vector<char>& getRow(); // 构造好的行
+    void clear(); // 清空，复用缓冲区构造下一行
+private:
+    Table* table;
+    std::vector<char> row;
+};
+
+// 一行数据的只读视图，不拷贝数据
+class Row{
+public:
+    Row(Table* table,const char* data,int length);
+    template<typename T>
+    T get(int column){
+        Column& c=table->getColumn(column);
+        if(c.type!=ColumnCodec<T>::type)throw "column type mismatch";
+        return ColumnCodec<T>::decode(data,c.offset);
+    }
+    const char* getData();
+    int getLength();
+private:
+    Table* table;
+    const char* data;
+    int length;
+};
+
+// 表和字段管理：表的目录作为记录经VersionManager保存，启动时全部读入内存，之后查表不再访问VM
+// 目录项串成一条链，最新创建的表的目录项uid保存在.bt文件中；建表在自己的事务中完成并立即提交（DDL隐式提交），因此链上的目录项总是已提交的
+// 行的读写按表的存储方式分派：row表经VersionManager读写Entry，pax表直接读写表独占的PAX块
+class TableManager{
+public:
+    static std::shared_ptr<TableManager> instance(); // 获取TableManager的单例对象
+    void init(); // 初始化TableManager，读入所有表的目录项；需要在VersionManager初始化之后调用
+    Table* createTable(const std::string& name,const std::vector<std::pair<std::string,Column::Type>>& columns,Table::Layout layout=Table::row,bool compressed=false); // 创建一张表，layout为表的存储方式；compressed只能用于pax表，表的页面写回时压缩
+    Table* getTable(const std::string& name); // 按表名查找，不存在时返回nullptr
+    std::vector<Table*> getTables(); // 所有的表
+    long long insert(long long xid,Table* table,std::vector<char>& row); // 事务XID向表中插入一行，返回其uid
+    std::vector<long long> insertMany(long long xid,Table* table,std::vector<std::vector<char>>& rows); // 批量插入；pax表每个块只为每个小页记录一条日志
+    bool read(long long xid,Table* table,long long uid,std::vector<char>& row); // 事务XID读取一行，不存在或不可见时返回false
+    bool del(long long xid,Table* table,long long uid); // 事务XID删除一行，行不可见或已被自己删除时返回false
+    void scanPage(long long xid,Table* table,long long pageNumber,ColumnBatch& batch); // 读出页面上表table中对事务可见的行，只读取batch中要求的列，追加到batch中
+    void scanPages(long long xid,Table* table,long long first,int number,ColumnBatch& batch,bool record=true); // 依次扫描从first开始的number个页面，并提示PageCache顺序预读；record为true时把读出的行记入乐观事务的读集
+    // 多个线程以同一个事务并发调用scanPages时record必须为false，由调用者收集各线程读出的uid，扫描结束后调用recordReads合并
+    void recordReads(long long xid,const std::vector<long long>& uids); // 把uids记入乐观事务的读集，其他隔离级别不做任何事
+
+    ~TableManager();
+    TableManager(const TableManager&) = delete; // 禁用拷贝构造函数
+    TableManager& operator=(const TableManager&) = delete; // 禁用赋值运算符
+private:
+    TableManager() = default; // 禁用外部构造
+    long long readBoot(); // 读取.bt文件中最新的目录项uid，文件不存在时返回0
+    void writeBoot(long long uid); // 先写临时文件并fsync再改名，保证.bt文件总是完整的
+    void syncDirectory(); // fsync当前目录，使文件的创建和改名持久化
+    std::vector<long long> insertPax(long long xid,Table* table,std::vector<std::vector<char>>& rows); // 向pax表追加行
+    bool readPax(Transaction* t,Table* table,long long uid,std::vector<char>& row);
+    bool delPax(Transaction* t,Table* table,long long uid);
+    void scanPaxPage(Transaction* t,Table* table,Page* page,ColumnBatch& batch);
+    void scanRowPage(Transaction* t,Table* table,Page* page,ColumnBatch& batch);
+
+    std::unordered_map<std::string,Table*> tables; // 表名到表的映射
+    std::vector<Table*> order; // 按创建顺序排列的表
+    long long head=0; // 最新创建的表的目录项uid
+    std::shared_mutex catalogLock; // 目录锁
+};
 
 #endif
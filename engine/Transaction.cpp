@@ -1,20 +1,35 @@
 #include "Transaction.h"
 
-Transaction* Transaction::newTransaction(long long xid,int level,std::unordered_map<long long,Transaction*> active){
-    Transaction* t=new Transaction;
+Transaction* Transaction::newTransaction(long long xid,int level,const std::unordered_map<long long,Transaction*>& active){
+    Transaction* t=ObjectPool<Transaction>::acquire();
     t->xid=xid;
     t->level=level;
+    t->autoAborted=false;
+    t->startSeq=0;
+    t->snapshot=nullptr;
+    t->snapshotSize=0;
     if(level!= 0) {
+        t->snapshot=reinterpret_cast<long long*>(t->arena.allocate(active.size()*sizeof(long long)));
         for(auto iter=active.begin();iter!=active.end();iter++){
-            t->snapshot.insert(std::pair<long long,bool>(iter->first, true));
+            t->snapshot[t->snapshotSize++]=iter->first;
         }
+        std::sort(t->snapshot,t->snapshot+t->snapshotSize);
     }
     return t;
 }
 
+void Transaction::freeTransaction(Transaction* t){
+    t->readSet.clear();
+    t->writeSet.clear();
+    t->snapshot=nullptr;
+    t->snapshotSize=0;
+    t->arena.reset();
+    ObjectPool<Transaction>::release(t);
+}
+
 bool Transaction::isInSnapshot(long long xid){
     if(xid==TransactionManager::supperXID)return false;
-    return snapshot.find(xid)!=snapshot.end();
+    return std::binary_search(snapshot,snapshot+snapshotSize,xid);
 }
 
 static std::shared_ptr<TransactionManager> transactionManager=nullptr;
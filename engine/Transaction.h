@@ -5,17 +5,31 @@
 #include <mutex>
 #include <fstream>
 #include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include "Pool.h"
 
 // 对一个事务的抽象
+// 隔离级别：readCommitted读提交；repeatableRead可重复读；optimistic乐观并发控制（按可重复读的快照读取，不经过锁表，提交时做向后验证）
 class Transaction{
 public:
-    static Transaction* newTransaction(long long xid,int level,std::unordered_map<long long,Transaction*> active);
+    static const int readCommitted=0;
+    static const int repeatableRead=1;
+    static const int optimistic=2;
+
+    static Transaction* newTransaction(long long xid,int level,const std::unordered_map<long long,Transaction*>& active); // 从对象池中取出一个事务对象并初始化
+    static void freeTransaction(Transaction* t); // 事务结束后将其归还对象池，并重置其区域分配器
     bool isInSnapshot(long long xid);
 
     long long xid; // 事务XID
     int level; // 事务隔离级别
-    std::unordered_map<long long,bool> snapshot;
+    long long* snapshot; // 事务开始时活跃的XID，升序存放在arena中
+    int snapshotSize; // 快照中XID的个数
     bool autoAborted; // 是否是自动撤销
+    long long startSeq; // 事务开始时已提交的最大提交序号
+    std::unordered_set<long long> readSet; // 乐观事务读过的UID
+    std::unordered_set<long long> writeSet; // 事务删除（写XDEL）过的UID
+    Arena arena; // 事务内的临时缓冲区（快照、日志记录），事务结束时整体丢弃
 };
 
 // 事务XID文件管理类
@@ -23,6 +37,12 @@ public:
 class TransactionManager {
 public:
     friend class Transaction;
+    friend class Node;
+    friend class BPlusTree;
+    friend class TreeBuilder;
+    friend class Bucket;
+    friend class HashIndex;
+    friend class TableManager;
 
     static std::shared_ptr<TransactionManager> instance(); // 获取TransactionManager的单例对象
     bool init(); // 初始化TransactionManager
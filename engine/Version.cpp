@@ -1,7 +1,7 @@
 #include "Version.h"
 
 Entry* Entry::newEntry(DataItem* dataItem,long long uid){
-    Entry* entry=new Entry;
+    Entry* entry=ObjectPool<Entry>::acquire();
     entry->uid=uid;
     entry->dataItem=dataItem;
     return entry;
@@ -17,25 +17,33 @@ std::vector<char> Entry::makeEntry(std::vector<char>& data,long long xid){
     char* p=reinterpret_cast<char*>(&xid);
     std::copy(p,p+xcrtLen,entry.begin());
     std::copy(data.begin(),data.end(),entry.begin()+xcrtLen+xdelLen);
+    return entry;
 }
 
 char* Entry::getData(){
     return dataItem->getData()+xcrtLen+xdelLen;
 }
 
+void Entry::copyData(std::vector<char>& data){
+    int size=dataItem->length-DataItem::validFlagLen-DataItem::dataSizeLen-xcrtLen-xdelLen;
+    dataItem->rLock();
+    data.assign(getData(),getData()+size);
+    dataItem->rUnLock();
+}
+
 long long Entry::getXCRT(){
     long long xid=0;
-    dataItem->readLock.lock();
+    dataItem->rLock();
     std::copy(dataItem->getData(),dataItem->getData()+xcrtLen,reinterpret_cast<char*>(&xid));
-    dataItem->readLock.unlock();
+    dataItem->rUnLock();
     return xid;
 }
 
 long long Entry::getXDEL(){
     long long xid=0;
-    dataItem->readLock.lock();
+    dataItem->rLock();
     std::copy(dataItem->getData()+xcrtLen,dataItem->getData()+xcrtLen+xdelLen,reinterpret_cast<char*>(&xid));
-    dataItem->readLock.unlock();
+    dataItem->rUnLock();
     return xid;
 }
 
@@ -46,10 +54,66 @@ void Entry::setXDEL(long long xid){
     dataItem->after(xid);
 }
 
+long long Entry::claimXDEL(long long xid,Arena* arena){
+    dataItem->before();
+    long long owner=0;
+    std::copy(dataItem->getData()+xcrtLen,dataItem->getData()+xcrtLen+xdelLen,reinterpret_cast<char*>(&owner));
+    if(!isClaimable(owner)){
+        dataItem->unBefore();
+        return owner;
+    }
+    char* p=reinterpret_cast<char*>(&xid);
+    std::copy(p,p+xdelLen,dataItem->getData()+xcrtLen);
+    dataItem->after(xid,arena);
+    return 0;
+}
+
+bool Entry::isClaimable(long long xdel){
+    return xdel==0||TransactionManager::instance()->isAborted(xdel);
+}
+
 long long Entry::getUid(){
     return this->uid;
 }
 
+void Entry::decodePage(Page* page,PageVersions& versions){
+    versions.clear();
+    versions.pageNumber=page->getPageNumber();
+    page->readLatch();
+    char* data=page->getData();
+    short end=PageManager::getFSO(page);
+    short offset=sizeof(short);
+    while(offset+DataItem::validFlagLen+DataItem::dataSizeLen<=end){
+        char flag=data[offset];
+        short dataSize=0;
+        std::copy(data+offset+DataItem::validFlagLen,data+offset+DataItem::validFlagLen+DataItem::dataSizeLen,reinterpret_cast<char*>(&dataSize));
+        if((flag&DataItem::invalidFlag)==0&&(flag&DataItem::versionedFlag)!=0){
+            char* p=data+offset+DataItem::validFlagLen+DataItem::dataSizeLen;
+            long long xcrt=0,xdel=0;
+            std::copy(p,p+xcrtLen,reinterpret_cast<char*>(&xcrt));
+            std::copy(p+xcrtLen,p+xcrtLen+xdelLen,reinterpret_cast<char*>(&xdel));
+            versions.offsets.push_back(offset);
+            versions.lengths.push_back(dataSize-xcrtLen-xdelLen);
+            versions.xcrt.push_back(xcrt);
+            versions.xdel.push_back(xdel);
+        }
+        offset+=DataItem::validFlagLen+DataItem::dataSizeLen+dataSize;
+    }
+    page->readUnlatch();
+}
+
+void PageVersions::clear(){
+    offsets.clear();
+    lengths.clear();
+    xcrt.clear();
+    xdel.clear();
+    visible.clear();
+}
+
+int PageVersions::size(){
+    return offsets.size();
+}
+
 bool Visibility::isVersionSkip(Transaction* t,Entry* entry){
     if(t->level==0){
         return false;
@@ -59,19 +123,23 @@ bool Visibility::isVersionSkip(Transaction* t,Entry* entry){
 }
 
 bool Visibility::isVisible(Transaction* t,Entry* entry){
+    return isVisible(t,entry->getXCRT(),entry->getXDEL());
+}
+
+bool Visibility::isVisible(Transaction* t,long long xcrt,long long xdel){
     if(t->level==0) {
-        return readCommitted(t, entry);
+        return readCommitted(t,xcrt,xdel);
     }else{
-        return repeatableRead(t, entry);
+        return repeatableRead(t,xcrt,xdel);
     }
 }
 
-bool Visibility::readCommitted(Transaction* t,Entry* entry){
-    if(entry->getXCRT()==t->xid&&entry->getXDEL()==0)return true;
-    if(TransactionManager::instance()->isCommitted(entry->getXCRT())) {
-        if(entry->getXDEL()==0) return true;
-        if(entry->getXDEL()!=t->xid) {
-            if(!TransactionManager::instance()->isCommitted(entry->getXDEL())) {
+bool Visibility::readCommitted(Transaction* t,long long xcrt,long long xdel){
+    if(xcrt==t->xid&&xdel==0)return true;
+    if(TransactionManager::instance()->isCommitted(xcrt)) {
+        if(xdel==0) return true;
+        if(xdel!=t->xid) {
+            if(!TransactionManager::instance()->isCommitted(xdel)) {
                 return true;
             }
         }
@@ -79,12 +147,12 @@ bool Visibility::readCommitted(Transaction* t,Entry* entry){
     return false;
 }
 
-bool Visibility::repeatableRead(Transaction* t,Entry* entry){
-    if(entry->getXCRT()==t->xid&&entry->getXDEL()==0) return true;
-    if(TransactionManager::instance()->isCommitted(entry->getXCRT())&&entry->getXCRT()<t->xid&&!t->isInSnapshot(entry->getXCRT())){
-        if(entry->getXDEL()==0) return true;
-        if(entry->getXDEL()!=t->xid) {
-            if(!TransactionManager::instance()->isCommitted(entry->getXDEL())||entry->getXDEL()>t->xid||t->isInSnapshot(entry->getXDEL())) {
+bool Visibility::repeatableRead(Transaction* t,long long xcrt,long long xdel){
+    if(xcrt==t->xid&&xdel==0) return true;
+    if(TransactionManager::instance()->isCommitted(xcrt)&&xcrt<t->xid&&!t->isInSnapshot(xcrt)){
+        if(xdel==0) return true;
+        if(xdel!=t->xid) {
+            if(!TransactionManager::instance()->isCommitted(xdel)||xdel>t->xid||t->isInSnapshot(xdel)) {
                 return true;
             }
         }
@@ -92,6 +160,60 @@ bool Visibility::repeatableRead(Transaction* t,Entry* entry){
     return false;
 }
 
+void Visibility::evaluate(Transaction* t,const long long* xcrt,const long long* xdel,int n,char* visible){
+    // 第一遍：为每个版本查出XCRT和XDEL的状态标志，相邻版本的XID往往相同，每个不同的XID只查询一次
+    std::unordered_map<long long,unsigned char> status;
+    auto flagsOf=[&](long long xid)->unsigned char{
+        auto iter=status.find(xid);
+        if(iter!=status.end())return iter->second;
+        unsigned char flags=0;
+        if(TransactionManager::instance()->isCommitted(xid))flags|=committedFlag;
+        if(t->level!=0&&t->isInSnapshot(xid))flags|=snapshotFlag;
+        status.insert({xid,flags});
+        return flags;
+    };
+    std::vector<unsigned char> crtFlags(n),delFlags(n);
+    long long lastCrt=-1,lastDel=-1;
+    unsigned char lastCrtFlags=0,lastDelFlags=0;
+    for(int i=0;i<n;i++){
+        if(xcrt[i]!=lastCrt){
+            lastCrt=xcrt[i];
+            lastCrtFlags=flagsOf(lastCrt);
+        }
+        if(xdel[i]!=lastDel){
+            lastDel=xdel[i];
+            lastDelFlags=flagsOf(lastDel);
+        }
+        crtFlags[i]=lastCrtFlags;
+        delFlags[i]=lastDelFlags;
+    }
+    // 第二遍：只有比较和位运算，没有分支和函数调用，编译器可以向量化
+    long long x=t->xid;
+    const unsigned char* cf=crtFlags.data();
+    const unsigned char* df=delFlags.data();
+    if(t->level==0){
+        for(int i=0;i<n;i++){
+            int own=(xcrt[i]==x)&(xdel[i]==0);
+            int crtCommitted=cf[i]&committedFlag;
+            int delOk=(xdel[i]==0)|((xdel[i]!=x)&((df[i]&committedFlag)==0));
+            visible[i]=(char)(own|((crtCommitted!=0)&delOk));
+        }
+    }else{
+        for(int i=0;i<n;i++){
+            int own=(xcrt[i]==x)&(xdel[i]==0);
+            int crtOk=((cf[i]&committedFlag)!=0)&(xcrt[i]<x)&((cf[i]&snapshotFlag)==0);
+            int delOk=(xdel[i]==0)|((xdel[i]!=x)&(((df[i]&committedFlag)==0)|(xdel[i]>x)|((df[i]&snapshotFlag)!=0)));
+            visible[i]=(char)(own|(crtOk&delOk));
+        }
+    }
+}
+
+void Visibility::scanPage(Transaction* t,Page* page,PageVersions& versions){
+    Entry::decodePage(page,versions);
+    versions.visible.resize(versions.size());
+    evaluate(t,versions.xcrt.data(),versions.xdel.data(),versions.size(),versions.visible.data());
+}
+
 static std::shared_ptr<LockTable> lockTable=nullptr;
 static std::mutex mutex;
 
@@ -107,112 +229,279 @@ std::shared_ptr<LockTable> LockTable::instance(){
     return lockTable;
 }
 
-std::mutex* LockTable::add(long long xid, long long uid){
-    tableLock.lock();
-    if(isInList(x2u,xid,uid))return nullptr;
-    if(u2x.find(uid)==u2x.end()){
-        u2x.insert({uid,xid});
-        putIntoList(x2u,xid,uid);
-        return nullptr;
+// 兼容矩阵，行为已持有的模式，列为请求的模式，顺序为IS、IX、S、SIX、X
+const bool LockTable::compatible[5][5]={
+    {true,true,true,true,false},
+    {true,true,false,false,false},
+    {true,false,true,false,false},
+    {true,false,false,false,false},
+    {false,false,false,false,false}
+};
+
+const LockTable::LockMode LockTable::supremums[5][5]={
+    {intentionShared,intentionExclusive,shared,sharedIntentionExclusive,exclusive},
+    {intentionExclusive,intentionExclusive,sharedIntentionExclusive,sharedIntentionExclusive,exclusive},
+    {shared,sharedIntentionExclusive,shared,sharedIntentionExclusive,exclusive},
+    {sharedIntentionExclusive,sharedIntentionExclusive,sharedIntentionExclusive,sharedIntentionExclusive,exclusive},
+    {exclusive,exclusive,exclusive,exclusive,exclusive}
+};
+
+bool LockTable::isCompatible(LockMode held,LockMode request){
+    return compatible[held][request];
+}
+
+LockTable::LockMode LockTable::supremum(LockMode mode0,LockMode mode1){
+    return supremums[mode0][mode1];
+}
+
+LockTable::LockMode LockTable::intention(LockMode mode){
+    if(mode==intentionShared||mode==shared)return intentionShared;
+    return intentionExclusive;
+}
+
+void LockTable::add(long long xid, long long uid, LockMode mode){
+    Shard& shard=shardOf(uid);
+    std::unique_lock<std::mutex> lock(shard.shardLock);
+    Lock& l=shard.locks[uid];
+    auto held=l.granted.find(xid);
+    bool upgrade=held!=l.granted.end();
+    if(upgrade){
+        if(supremum(held->second,mode)==held->second)return; // 已经持有足够强的锁
+        mode=supremum(held->second,mode);
+    }
+    // 锁升级优先于排队的请求；新请求只有在没有人排队时才能直接获得锁，避免饿死排队者
+    if(isGrantable(l,xid,mode)&&(upgrade||l.waiting.empty())){
+        l.granted[xid]=mode;
+        shard.x2u[xid].insert(uid);
+        return;
+    }
+    std::unordered_set<long long> blockers=blockersOf(l,xid,mode,upgrade);
+    if(policy==waitDie){
+        for(long long blocker:blockers){
+            if(blocker<xid){
+                // 年轻事务不等待年老事务
+                if(l.granted.empty()&&l.waiting.empty())shard.locks.erase(uid);
+                throw "dead lock";
+            }
+        }
+    }
+    {
+        std::unique_lock<std::mutex> graph(graphLock);
+        waitX[xid]=blockers;
+        if(policy==detect&&hasDeadLock(xid)){
+            waitX.erase(xid);
+            if(l.granted.empty()&&l.waiting.empty())shard.locks.erase(uid); // 不留下operator[]创建的空表项
+            throw "dead lock";
+        }
+    }
+    l.waiting.push(xid,mode,upgrade);
+    Waiter* waiter;
+    if(shard.waiterPool.empty()){
+        waiter=new Waiter;
+    }else{
+        waiter=shard.waiterPool.back();
+        shard.waiterPool.pop_back();
     }
-    waitU.insert({xid,uid});
-    putIntoList(wait,uid,xid);
-    if(hasDeadLock()){
-        waitU.erase(xid);
-        removeFromList(wait,uid,xid);
-        throw "dead lock";
+    waiter->granted=false;
+    shard.waiters.insert({xid,waiter});
+
+    // 等待期间释放分片锁，直到被授予锁或超时
+    auto start=std::chrono::steady_clock::now();
+    long long timeout=waitTimeout;
+    if(timeout>0){
+        waiter->cond.wait_for(lock,std::chrono::milliseconds(timeout),[waiter]{return waiter->granted;});
+    }else{
+        waiter->cond.wait(lock,[waiter]{return waiter->granted;});
+    }
+    long long micros=std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now()-start).count();
+    bool granted=waiter->granted;
+    shard.waiterPool.push_back(waiter);
+    record(shard,uid,micros,!granted);
+    if(granted)return;
+    // 超时：撤出等待队列，排在后面的请求可能因此可以获得锁
+    shard.waiters.erase(xid);
+    shard.locks[uid].waiting.erase(xid);
+    {
+        std::unique_lock<std::mutex> graph(graphLock);
+        waitX.erase(xid);
     }
-    std::mutex* lock=new std::mutex;
-    lock->lock();
-    waitLock.insert({xid,lock});
+    grantWaiters(shard,uid);
+    throw "lock wait timeout";
+}
 
-    tableLock.unlock();
-    return lock;
+void LockTable::add(long long xid, long long parentUid, long long uid, LockMode mode){
+    add(xid,parentUid,intention(mode));
+    add(xid,uid,mode);
 }
 
 void LockTable::remove(long long xid){
-    tableLock.lock();
-    auto iter=x2u.find(xid);
-    if(iter!=x2u.end()){
-        while(!iter->second.empty()){
-            long long uid=iter->second.front();
-            iter->second.pop_front();
-            selectXID(uid);
+    for(int i=0;i<shardNumber;i++){
+        Shard& shard=shards[i];
+        std::unique_lock<std::mutex> lock(shard.shardLock);
+        auto iter=shard.x2u.find(xid);
+        if(iter!=shard.x2u.end()){
+            std::unordered_set<long long> uids=std::move(iter->second);
+            shard.x2u.erase(iter);
+            for(long long uid:uids){
+                shard.locks[uid].granted.erase(xid);
+                grantWaiters(shard,uid);
+            }
         }
     }
-    waitU.erase(xid);
-    x2u.erase(xid);
-    waitLock.erase(xid);
-    tableLock.unlock();
-}
-
-void LockTable::selectXID(long long uid){
-    u2x.erase(uid);
-    auto iter=wait.find(uid);
-    if(iter==wait.end())return;
-    while (!iter->second.empty()){
-        long long xid=iter->second.front();
-        iter->second.pop_front();
-        if(waitLock.find(xid)==waitLock.end())continue;
-        else{
-            u2x.insert({uid,xid});
-            std::mutex* lock=waitLock.find(xid)->second;
-            waitU.erase(xid);
-            lock.unlock();
-            delete lock;
-            break;
-        }
+    std::unique_lock<std::mutex> graph(graphLock);
+    waitX.erase(xid);
+}
+
+void LockTable::setPolicy(DeadLockPolicy policy){
+    this->policy=policy;
+}
+
+void LockTable::setWaitTimeout(long long milliseconds){
+    this->waitTimeout=milliseconds;
+}
+
+LockTable::WaitStat LockTable::getWaitStat(long long uid){
+    Shard& shard=shardOf(uid);
+    std::unique_lock<std::mutex> lock(shard.shardLock);
+    auto iter=shard.waitStats.find(uid);
+    if(iter==shard.waitStats.end())return WaitStat();
+    return iter->second;
+}
+
+std::vector<std::pair<long long,LockTable::WaitStat>> LockTable::hottest(int n){
+    std::vector<std::pair<long long,WaitStat>> stats;
+    for(int i=0;i<shardNumber;i++){
+        std::unique_lock<std::mutex> lock(shards[i].shardLock);
+        stats.insert(stats.end(),shards[i].waitStats.begin(),shards[i].waitStats.end());
+    }
+    auto cmp=[](const std::pair<long long,WaitStat>& a,const std::pair<long long,WaitStat>& b){
+        return a.second.totalMicros>b.second.totalMicros;
+    };
+    if((int)stats.size()>n){
+        std::partial_sort(stats.begin(),stats.begin()+n,stats.end(),cmp);
+        stats.resize(n);
+    }else{
+        std::sort(stats.begin(),stats.end(),cmp);
     }
-    if(iter->second.empty())wait.erase(iter);
+    return stats;
 }
 
-bool LockTable::hasDeadLock(){
-    std::unordered_map<long long,int> xidStamp;
-    int stamp = 1;
-    for(auto iter=x2u.begin();iter!=x2u.end();iter++){
-        auto s=xidStamp.find(iter->first);
-        if(s!=xidStamp.end()&&s->second>0)continue;
-        stamp++;
-        if(dfs(iter->first,xidStamp,stamp))return true;
+void LockTable::resetWaitStats(){
+    for(int i=0;i<shardNumber;i++){
+        std::unique_lock<std::mutex> lock(shards[i].shardLock);
+        shards[i].waitStats.clear();
     }
-    return false;
 }
 
-bool LockTable::dfs(long long xid,std::unordered_map<long long,int>& xidStamp,int& stamp){
-    auto stp=xidStamp.find(xid);
-    if(stp!=xidStamp.end()&&stp->second==stamp)return true;
-    if(stp!=xidStamp.end()&&stp->second<stamp)return false;
-    xidStamp.insert({xid,stamp});
-    auto uid=waitU.find(xid);
-    if(uid==waitU.end())return false;
-    return dfs(u2x.find(uid->second)->second,xidStamp,stamp);
+void LockTable::record(Shard& shard,long long uid,long long micros,bool timeout){
+    WaitStat& stat=shard.waitStats[uid];
+    stat.count++;
+    if(timeout)stat.timeouts++;
+    stat.totalMicros+=micros;
+    int bucket=0;
+    while(bucket<bucketNumber-1&&(1ll<<(bucket+1))<=micros)bucket++;
+    stat.buckets[bucket]++;
 }
 
-void LockTable::removeFromList(std::unordered_map<long long, std::list<long long>>& listMap, long long uid0, long long uid1){
-    auto iter=listMap.find(uid0);
-    if(iter==listMap.end())return;
-    for(auto i=iter->second.begin();i!=iter->second.end();i++){
-        if(*i==uid1){
-            iter->second.erase(i);
-            break;
-        }
-    }
-    if(iter->second.empty())listMap.erase(iter);
+LockTable::Shard& LockTable::shardOf(long long uid){
+    // uid的高32位为页号，低位为页内偏移，将两者混合后再取模
+    unsigned long long h=(unsigned long long)uid*0x9E3779B97F4A7C15ull;
+    return shards[(h>>32)%shardNumber];
 }
 
-void LockTable::putIntoList(std::unordered_map<long long, std::list<long long>>& listMap, long uid0, long uid1){
-    listMap[uid0].push_front(uid1);
+bool LockTable::isGrantable(Lock& lock,long long xid,LockMode mode){
+    for(auto& holder:lock.granted){
+        if(holder.first!=xid&&!isCompatible(holder.second,mode))return false;
+    }
+    return true;
 }
 
-bool LockTable::isInList(std::unordered_map<long long, std::list<long long>>& listMap, long uid0, long uid1){
-    auto iter=listMap.find(uid0);
-    if(iter==listMap.end())return false;
-    for(long long  uid:iter->second){
-        if(uid==uid1)return true;
+std::unordered_set<long long> LockTable::blockersOf(Lock& lock,long long xid,LockMode mode,bool upgrade){
+    std::unordered_set<long long> blockers;
+    for(auto& holder:lock.granted){
+        if(holder.first!=xid&&!isCompatible(holder.second,mode))blockers.insert(holder.first);
+    }
+    if(!upgrade){
+        // 排在前面且不兼容的请求会先于xid获得锁，xid同样需要等待它们
+        for(long long waiter:lock.waiting.queue){
+            if(waiter==xid)break;
+            if(!isCompatible(lock.waiting.modes[waiter],mode))blockers.insert(waiter);
+        }
+    }
+    return blockers;
+}
+
+void LockTable::grantWaiters(Shard& shard,long long uid){
+    auto iter=shard.locks.find(uid);
+    if(iter==shard.locks.end())return;
+    Lock& l=iter->second;
+    std::unique_lock<std::mutex> graph(graphLock);
+    while(!l.waiting.empty()){
+        long long xid=l.waiting.queue.front();
+        LockMode mode=l.waiting.modes[xid];
+        auto waiter=shard.waiters.find(xid);
+        if(waiter==shard.waiters.end()){
+            // 等待者已经不在锁表中
+            l.waiting.erase(xid);
+            continue;
+        }
+        if(!isGrantable(l,xid,mode))break;
+        l.waiting.erase(xid);
+        l.granted[xid]=mode;
+        shard.x2u[xid].insert(uid);
+        waitX.erase(xid);
+        // 只唤醒获得锁的等待者
+        waiter->second->granted=true;
+        waiter->second->cond.notify_one();
+        shard.waiters.erase(waiter);
+    }
+    // 持有者发生了变化，重新计算其余等待者的等待边
+    for(long long waiter:l.waiting.queue){
+        waitX[waiter]=blockersOf(l,waiter,l.waiting.modes[waiter],l.granted.count(waiter)!=0);
+    }
+    if(l.granted.empty()&&l.waiting.empty())shard.locks.erase(iter);
+}
+
+bool LockTable::hasDeadLock(long long xid){
+    // 从xid等待的事务出发深度优先搜索，能回到xid即成环；只会访问从新等待边可达的事务
+    std::unordered_set<long long> visited;
+    std::vector<long long> stack(waitX[xid].begin(),waitX[xid].end());
+    while(!stack.empty()){
+        long long current=stack.back();
+        stack.pop_back();
+        if(current==xid)return true;
+        if(!visited.insert(current).second)continue;
+        auto next=waitX.find(current);
+        if(next==waitX.end())continue;
+        for(long long x:next->second)stack.push_back(x);
     }
     return false;
 }
 
+void LockTable::WaitQueue::push(long long xid,LockMode mode,bool front){
+    if(position.count(xid)!=0)return;
+    if(front){
+        queue.push_front(xid);
+        position.insert({xid,queue.begin()});
+    }else{
+        queue.push_back(xid);
+        position.insert({xid,std::prev(queue.end())});
+    }
+    modes[xid]=mode;
+}
+
+void LockTable::WaitQueue::erase(long long xid){
+    auto iter=position.find(xid);
+    if(iter==position.end())return;
+    queue.erase(iter->second);
+    position.erase(iter);
+    modes.erase(xid);
+}
+
+bool LockTable::WaitQueue::empty(){
+    return queue.empty();
+}
+
 static std::shared_ptr<VersionManager> versionManager=nullptr;
 static std::mutex mutex2;
 
@@ -229,6 +518,7 @@ std::shared_ptr<VersionManager> VersionManager::instance(){
 }
 
 void VersionManager::init(){
+    memoryConsumer=MemoryGovernor::instance()->addConsumer("entry");
     activeTransaction.insert({0, nullptr});
 }
 
@@ -236,18 +526,56 @@ VersionManager::~VersionManager(){
 
 }
 
-char* VersionManager::read(long long xid,long long uid){
+bool VersionManager::read(long long xid,long long uid,std::vector<char>& data){
     transactionLock.lock();
     auto iter=activeTransaction.find(xid);
     transactionLock.unlock();
+    Transaction* t=iter->second;
 
     Entry* entry=get(uid);
-    if(Visibility::isVisible(iter->second,entry)){
-        char* p=entry->getData();
-        release(entry->uid);
-        return p;
+    if(t->level==Transaction::optimistic)t->readSet.insert(uid); // 记录读集，提交时验证
+    bool visible=Visibility::isVisible(t,entry);
+    if(visible){
+        // Entry和DataItem只是页帧上的视图，释放之后页面可能被逐出、对象可能被复用，必须在释放之前拷出数据
+        entry->copyData(data);
+    }
+    release(entry->uid);
+    return visible;
+}
+
+void VersionManager::readMany(long long xid,const std::vector<long long>& uids,ReadBatch& result){
+    transactionLock.lock();
+    auto iter=activeTransaction.find(xid);
+    transactionLock.unlock();
+    Transaction* t=iter->second;
+    if(t->level==Transaction::optimistic)t->readSet.insert(uids.begin(),uids.end());
+
+    // 绕过两层缓存，直接按页拷出Entry，再对拷出的头部批量判断可见性
+    DataManager::instance()->readMany(uids,result,true);
+    int n=uids.size();
+    std::vector<long long> xcrt(n,0),xdel(n,0);
+    for(int i=0;i<n;i++){
+        if(!result.found(i))continue;
+        if(result.length(i)<Entry::xcrtLen+Entry::xdelLen){
+            result.lengths[i]=-1; // 放不下XCRT/XDEL的数据项不是Entry
+            continue;
+        }
+        char* p=result.data(i);
+        std::copy(p,p+Entry::xcrtLen,reinterpret_cast<char*>(&xcrt[i]));
+        std::copy(p+Entry::xcrtLen,p+Entry::xcrtLen+Entry::xdelLen,reinterpret_cast<char*>(&xdel[i]));
+    }
+    std::vector<char> visible(n);
+    Visibility::evaluate(t,xcrt.data(),xdel.data(),n,visible.data());
+    for(int i=0;i<n;i++){
+        if(!result.found(i))continue;
+        if(!visible[i]){
+            result.lengths[i]=-1;
+        }else{
+            // 跳过XCRT/XDEL，只暴露承载的数据
+            result.offsets[i]+=Entry::xcrtLen+Entry::xdelLen;
+            result.lengths[i]-=Entry::xcrtLen+Entry::xdelLen;
+        }
     }
-    else return nullptr;
 }
 
 long long VersionManager::insert(long long xid,std::vector<char>& data){
@@ -255,26 +583,50 @@ long long VersionManager::insert(long long xid,std::vector<char>& data){
     auto iter=activeTransaction.find(xid);
     transactionLock.unlock();
     std::vector<char> entry=Entry::makeEntry(data,xid);
-    return DataManager::instance()->insert(xid,entry);
+    return DataManager::instance()->insert(xid,entry,true);
+}
+
+std::vector<long long> VersionManager::bulkInsert(long long xid,std::vector<std::vector<char>>& rows){
+    std::vector<std::vector<char>> entries;
+    entries.reserve(rows.size());
+    for(auto& row:rows){
+        entries.push_back(Entry::makeEntry(row,xid));
+    }
+    return DataManager::instance()->bulkInsert(xid,entries,true);
 }
 
 bool VersionManager::del(long long xid,long long uid){
     transactionLock.lock();
     auto iter=activeTransaction.find(xid);
     transactionLock.unlock();
+    Transaction* t=iter->second;
 
     Entry* entry=get(uid);
     bool result;
-    if(!Visibility::isVisible(iter->second,entry))result= false;
+    if(t->level==Transaction::optimistic)t->readSet.insert(uid);
+    if(!Visibility::isVisible(t,entry))result= false;
     else{
-        std::mutex* lock=LockTable::instance()->add(xid,uid);
-        if(lock!= nullptr){
-            lock->lock();
-            lock->unlock();
+        if(t->level!=Transaction::optimistic){
+            // 乐观模式不经过锁表，冲突留到写XDEL和提交验证时发现
+            try{
+                LockTable::instance()->add(xid,uid);
+            }catch(const char* e){
+                // 发生死锁或等待超时，自动撤销该事务
+                autoAbort(t);
+                release(entry->uid);
+                throw;
+            }
         }
-        if(entry->getXDEL()==xid)result= false;
-        else{
-            entry->setXDEL(xid);
+        long long owner=entry->claimXDEL(xid,&t->arena);
+        if(owner==xid)result= false;
+        else if(owner!=0){
+            // 该版本正在被另一个活跃事务删除（只有乐观事务会在不持有锁的情况下写XDEL），先写者胜出；
+            // 或者已被一个在本事务开始之后提交的事务删除，不能覆盖它的XDEL，否则本事务撤销后这次删除就丢失了
+            autoAbort(t);
+            release(entry->uid);
+            throw "concurrent update";
+        }else{
+            t->writeSet.insert(uid);
             result=true;
         }
     }
@@ -282,34 +634,104 @@ bool VersionManager::del(long long xid,long long uid){
     return result;
 }
 
+Transaction* VersionManager::getTransaction(long long xid){
+    std::unique_lock<std::mutex> lock(transactionLock);
+    auto iter=activeTransaction.find(xid);
+    if(iter==activeTransaction.end()||iter->second==nullptr)throw "transaction is not active";
+    return iter->second;
+}
+
 long long VersionManager::begin(int level){
     transactionLock.lock();
     long long xid=TransactionManager::instance()->begin();
     Transaction* t=Transaction::newTransaction(xid,level,activeTransaction);
+    t->startSeq=commitSeq; // 快照与提交序号在transactionLock下一起确定
     activeTransaction.insert({xid,t});
     transactionLock.unlock();
+    return xid;
 }
 
 void VersionManager::commit(long long xid){
     transactionLock.lock();
     auto iter=activeTransaction.find(xid);
     transactionLock.unlock();
-    transactionLock.lock();
-    activeTransaction.erase(iter);
-    transactionLock.unlock();
-    LockTable::instance()->remove(xid);
+    Transaction* t=iter->second;
+
+    // validationLock只保护验证与committedWrites，不在持有它时写日志：
+    // 写集先以未定的序号（LLONG_MAX）登记，此后验证的乐观事务都会与它比较；落盘提交之后再补上真正的序号
+    CommitRecord* pending=nullptr;
+    if(t->level==Transaction::optimistic||!t->writeSet.empty()){
+        std::unique_lock<std::mutex> validation(validationLock);
+        if(t->level==Transaction::optimistic&&!validate(t)){
+            validation.unlock();
+            autoAbort(t);
+            throw "serialization failure";
+        }
+        if(!t->writeSet.empty()){
+            committedWrites.push_back({LLONG_MAX,std::move(t->writeSet)});
+            pending=&committedWrites.back(); // deque两端的插入和删除不会使其他元素的引用失效
+            t->writeSet.clear(); // 移动后的集合状态未定义，归还对象池前置空
+        }
+    }
     TransactionManager::instance()->commit(xid);
-
+    // 提交序号的递增与从活跃事务中移除必须原子地完成：
+    // 之后开始的事务要么在快照中看到它仍活跃（startSeq小于其序号，会被验证），要么看到它已提交
+    if(pending==nullptr){
+        transactionLock.lock();
+        ++commitSeq;
+        activeTransaction.erase(xid);
+        transactionLock.unlock();
+    }else{
+        // 补上序号时持有validationLock，在此之后开始的事务验证时一定看到真正的序号
+        std::unique_lock<std::mutex> validation(validationLock);
+        transactionLock.lock();
+        long long seq=++commitSeq;
+        activeTransaction.erase(xid);
+        long long minStartSeq=seq;
+        for(auto& active:activeTransaction){
+            if(active.second!=nullptr&&active.second->level==Transaction::optimistic){
+                minStartSeq=std::min(minStartSeq,active.second->startSeq);
+            }
+        }
+        transactionLock.unlock();
+        pending->seq=seq;
+        // 没有活跃的乐观事务需要验证的提交记录可以丢弃；未定的记录挡住其后的记录，丢弃是保守的
+        while(!committedWrites.empty()&&committedWrites.front().seq<=minStartSeq){
+            committedWrites.pop_front();
+        }
+    }
+    LockTable::instance()->remove(xid);
+    Transaction::freeTransaction(t);
 }
 
 void VersionManager::abort(long long xid){
     transactionLock.lock();
     auto iter=activeTransaction.find(xid);
+    Transaction* t=iter->second;
     activeTransaction.erase(iter);
     transactionLock.unlock();
-    if(iter->second->autoAborted)return;
-    LockTable::instance()->remove(xid);
-    TransactionManager::instance()->abort(xid);
+    if(!t->autoAborted){
+        LockTable::instance()->remove(xid);
+        TransactionManager::instance()->abort(xid);
+    }
+    Transaction::freeTransaction(t);
+}
+
+bool VersionManager::validate(Transaction* t){
+    // 向后验证：在t开始之后提交的事务的写集与t的读集不能相交
+    for(auto& record:committedWrites){
+        if(record.seq<=t->startSeq)continue;
+        for(long long uid:record.writeSet){
+            if(t->readSet.count(uid)!=0)return false;
+        }
+    }
+    return true;
+}
+
+void VersionManager::autoAbort(Transaction* t){
+    t->autoAborted=true;
+    LockTable::instance()->remove(t->xid);
+    TransactionManager::instance()->abort(t->xid);
 }
 
 Entry* VersionManager::get(long long uid){
@@ -329,21 +751,31 @@ Entry* VersionManager::get(long long uid){
             resourceLock.unlock();
             return entry;
         }
-        if(count==maxItemNumber){
-            // 如果缓存已满则抛出异常
-            resourceLock.unlock();
-            throw "cache is full!";
-        }
-        // 如果该实体没有正被获取，且没有在缓存中，且缓存未满；则将该资源加入到缓存中
-        count++;
+        // 如果该实体没有正被获取，且没有在缓存中；则将该资源加入到缓存中
         getting.insert(std::pair<long long,bool>(uid,true));
         resourceLock.unlock();
         break;
     }
 
-    Entry* entry=getForCache(uid);
+    // 向MemoryGovernor申请内存，预算不足时会请求其他缓存释放内存，仍然不足则抛出异常
+    if(!MemoryGovernor::instance()->reserve(memoryConsumer,sizeof(Entry))){
+        std::unique_lock<std::mutex> lock(resourceLock);
+        getting.erase(uid);
+        throw "cache is full!";
+    }
+
+    Entry* entry=nullptr;
+    try{
+        entry=getForCache(uid);
+    }catch(const char* e){
+        MemoryGovernor::instance()->release(memoryConsumer,sizeof(Entry));
+        std::unique_lock<std::mutex> lock(resourceLock);
+        getting.erase(uid);
+        throw;
+    }
     std::unique_lock<std::mutex> lock(resourceLock);
     getting.erase(uid);
+    count++;
     cache.insert(std::pair<long long,Entry*>(uid,entry));
     references.insert(std::pair<long long,int>(uid,1));
     return entry;
@@ -361,6 +793,7 @@ void VersionManager::release(long long uid){
         references.erase(uid);
         cache.erase(uid);
         count--;
+        MemoryGovernor::instance()->release(memoryConsumer,sizeof(Entry));
     }
 }
 
@@ -370,5 +803,7 @@ Entry* VersionManager::getForCache(long long uid){
 }
 
 void VersionManager::releaseForCache(Entry* entry){
-    PageCache::instance()->release(entry->dataItem->page->getPageNumber());
+    // Entry持有的是DataItem的引用，应通过DataManager释放，由DataItem缓存负责释放页面
+    DataManager::instance()->release(entry->uid);
+    ObjectPool<Entry>::release(entry);
 }
\ No newline at end of file
@@ -2,7 +2,14 @@
 #define VERSION
 
 #include <unordered_map>
+#include <unordered_set>
+#include <atomic>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
 #include <list>
+#include <deque>
+#include <climits>
 #include <mutex>
 #include "Data.h"
 #include "Transaction.h"
@@ -10,6 +17,8 @@
 class DataItem;
 class DataManager;
 class VersionManager;
+struct PageVersions;
+struct ReadBatch;
 // M向上层抽象出Entry；Entry结构：[XCRT] [XDEL] [data]。XCRT 是创建该条记录（版本）的事务编号，而 XDEL 则是删除该条记录（版本）的事务编号。
 class Entry{
 public:
@@ -18,10 +27,14 @@ public:
     static Entry* loadEntry(long long uid); // 加载一个Entry
     static std::vector<char> makeEntry(std::vector<char>& data,long long xid); // 根据事务的XID和数据制作一个Entry
     char* getData();
+    void copyData(std::vector<char>& data); // 在页面读闩锁下把承载的数据拷贝到data中
     long long getXCRT();
     long long getXDEL();
     void setXDEL(long long xid);
+    long long claimXDEL(long long xid,Arena* arena=nullptr); // 原子地检查并设置XDEL：XDEL可以被占用时设为xid并返回0，否则不修改并返回当前的XDEL；日志记录在arena中构造
+    static bool isClaimable(long long xdel); // XDEL为空或其事务已撤销时才可以被占用；已提交的XDEL表示该版本已被删除，活跃的XDEL表示正在被删除
     long long getUid();
+    static void decodePage(Page* page,PageVersions& versions); // 在页面读闩锁下，将页面上所有有效Entry的头部解码到versions中
 private:
     long long uid; // Entry地址
     DataItem* dataItem;
@@ -29,53 +42,136 @@ private:
     static const int xdelLen= sizeof(long long);
 };
 
+// 一个页面上所有Entry的头部，按页内顺序存放在连续数组中，便于批量判断可见性
+struct PageVersions{
+    long long pageNumber; // 页号
+    std::vector<short> offsets; // 每个Entry所在DataItem的页内偏移
+    std::vector<short> lengths; // 每个Entry承载数据的长度（不含XCRT/XDEL）
+    std::vector<long long> xcrt; // 每个Entry的XCRT
+    std::vector<long long> xdel; // 每个Entry的XDEL
+    std::vector<char> visible; // 可见性位图，每个Entry一个字节，1为可见
+    void clear();
+    int size();
+};
+
 // 可见性判断
 class Visibility{
 public:
     static bool isVersionSkip(Transaction* t,Entry* entry);
     static bool isVisible(Transaction* t,Entry* entry);
-    static bool readCommitted(Transaction* t,Entry* entry);
-    static bool repeatableRead(Transaction* t,Entry* entry);
+    static bool isVisible(Transaction* t,long long xcrt,long long xdel);
+    static bool readCommitted(Transaction* t,long long xcrt,long long xdel);
+    static bool repeatableRead(Transaction* t,long long xcrt,long long xdel);
+    // 批量判断n个版本对事务t的可见性，结果写入visible；每个不同的XID只查询一次状态
+    static void evaluate(Transaction* t,const long long* xcrt,const long long* xdel,int n,char* visible);
+    static void scanPage(Transaction* t,Page* page,PageVersions& versions); // 解码页面上的所有Entry并计算可见性位图，整个页面只加一次闩锁
+private:
+    static const unsigned char committedFlag=1; // XID已提交
+    static const unsigned char snapshotFlag=2; // XID在事务快照中
 };
 
 // 锁表，用来预防死锁（维护了一个依赖等待图，以进行死锁检测）
+// 锁表按UID分片，不同分片上的加锁与释放互不阻塞；等待图按边增量维护，死锁检测只从新加入的等待边出发
+// 支持IS/IX/S/SIX/X五种锁模式，兼容的锁可以同时被多个事务持有；已持有锁的事务可以申请更强的模式（锁升级）
+// 层次加锁：对表中的行加锁前，需要先对表加相应的意向锁（行S锁对应表IS锁，行X锁对应表IX锁）
+// 等待者挂在自己的条件变量上，获得锁时只唤醒它自己；等待超时后放弃并抛出异常
 class LockTable{
 public:
+    // 死锁处理策略
+    // detect：沿新加入的等待边检测环，成环则抛出异常
+    // waitDie：只允许年老事务（XID较小）等待年轻事务，年轻事务需要等待年老事务时直接抛出异常，不会产生环
+    enum DeadLockPolicy{detect,waitDie};
+    // 锁模式
+    enum LockMode{intentionShared,intentionExclusive,shared,sharedIntentionExclusive,exclusive};
+    static const int bucketNumber=24; // 等待时间直方图的桶数
+    // 一个UID上的锁等待统计，第i个桶记录等待时间在[2^i,2^(i+1))微秒内的次数
+    struct WaitStat{
+        long long count=0; // 等待次数
+        long long timeouts=0; // 超时次数
+        long long totalMicros=0; // 总等待时间（微秒）
+        long long buckets[bucketNumber]={0};
+    };
+
     static std::shared_ptr<LockTable> instance(); // 获取LockTable的单例对象
 
-    std::mutex* add(long long xid, long long uid); // 添加依赖关系【事务XID占用UID】。不需要等待则返回null，否则返回锁对象；会造成死锁则抛出异常
-    void remove(long long xid); // 移除一个事务
+    void add(long long xid, long long uid, LockMode mode=exclusive); // 事务XID以mode模式占用UID，必要时阻塞等待；会造成死锁或等待超时则抛出异常
+    void add(long long xid, long long parentUid, long long uid, LockMode mode); // 层次加锁：先对parentUid加意向锁，再对uid加mode锁
+    void remove(long long xid); // 移除一个事务，释放其持有的所有锁
+    void setPolicy(DeadLockPolicy policy); // 设置死锁处理策略
+    void setWaitTimeout(long long milliseconds); // 设置锁等待超时时间，不大于0表示一直等待
+    WaitStat getWaitStat(long long uid); // 获取一个UID上的锁等待统计
+    std::vector<std::pair<long long,WaitStat>> hottest(int n); // 总等待时间最长的n个UID
+    void resetWaitStats(); // 清空锁等待统计
+    static bool isCompatible(LockMode held,LockMode request); // 两种锁模式是否兼容
+    static LockMode supremum(LockMode mode0,LockMode mode1); // 同时满足两种锁模式的最弱模式（锁升级后的模式）
+    static LockMode intention(LockMode mode); // 对子资源加mode锁时，父资源需要的意向锁模式
 
     LockTable(const LockTable&) = delete; // 禁用拷贝构造函数
     LockTable& operator=(const LockTable&) = delete; // 禁用赋值运算符
 private:
+    // 等待某个UID的请求队列，保持先来先服务的顺序，同时可以按XID直接定位并移除
+    struct WaitQueue{
+        std::list<long long> queue; // 按等待先后排列的XID
+        std::unordered_map<long long,std::list<long long>::iterator> position; // XID在queue中的位置
+        std::unordered_map<long long,LockMode> modes; // XID请求的锁模式
+        void push(long long xid,LockMode mode,bool front); // 加入队列，锁升级请求插入到队首
+        void erase(long long xid);
+        bool empty();
+    };
+    // 等待者，获得锁时由释放者设置granted并唤醒
+    struct Waiter{
+        std::condition_variable cond;
+        bool granted;
+    };
+    // 一个UID上的锁：已授予的锁和等待队列
+    struct Lock{
+        std::unordered_map<long long,LockMode> granted; // 持有该UID的XID及其锁模式
+        WaitQueue waiting; // 等待该UID的请求
+    };
+    // 锁表的一个分片，管理UID哈希到该分片的所有资源
+    struct Shard{
+        std::unordered_map<long long, std::unordered_set<long long>> x2u; // 某个XID在本分片中已经获得的资源的UID集合
+        std::unordered_map<long long, Lock> locks; // UID上的锁
+        std::unordered_map<long long, Waiter*> waiters; // 正在等待本分片资源的XID的等待者
+        std::vector<Waiter*> waiterPool; // 空闲的等待者，复用以避免每次等待都分配
+        std::unordered_map<long long, WaitStat> waitStats; // UID上的锁等待统计
+        std::mutex shardLock; // 分片锁
+    };
+
     LockTable() = default; // 禁用外部构造
-    void selectXID(long long uid); // 从等待队列中选择一个xid来占用uid
-    bool hasDeadLock(); // 死锁检测
-    bool dfs(long long xid,std::unordered_map<long long,int>& xidStamp,int& stamp);
-    void removeFromList(std::unordered_map<long long, std::list<long long>>& listMap, long long uid0, long long uid1);
-    void putIntoList(std::unordered_map<long long, std::list<long long>>& listMap, long uid0, long uid1);
-    bool isInList(std::unordered_map<long long, std::list<long long>>& listMap, long uid0, long uid1);
-    std::unordered_map<long long, std::list<long long>> x2u;  // 某个XID已经获得的资源的UID列表
-    std::unordered_map<long long, long long> u2x;        // UID被某个XID持有
-    std::unordered_map<long long, std::list<long long>> wait; // 正在等待UID的XID列表
-    std::unordered_map<long long, std::mutex*> waitLock;   // 正在等待资源的XID的锁
-    std::unordered_map<long long, long long> waitU;      // XID正在等待的UID
-    std::mutex tableLock; // 表锁
+    Shard& shardOf(long long uid); // 获取UID所在的分片
+    bool isGrantable(Lock& lock,long long xid,LockMode mode); // mode是否与其他事务已持有的锁都兼容
+    std::unordered_set<long long> blockersOf(Lock& lock,long long xid,LockMode mode,bool upgrade); // 阻塞XID以mode模式获得锁的事务
+    void grantWaiters(Shard& shard,long long uid); // 按顺序唤醒可以获得锁的等待者，并更新其余等待者的等待边（调用时需持有分片锁）
+    bool hasDeadLock(long long xid); // 加入xid的等待边后是否成环（调用时需持有graphLock）
+    void record(Shard& shard,long long uid,long long micros,bool timeout); // 记录一次锁等待（调用时需持有分片锁）
+
+    static const int shardNumber=16; // 分片个数
+    static const bool compatible[5][5]; // 锁模式兼容矩阵
+    static const LockMode supremums[5][5]; // 锁模式上确界表
+    Shard shards[shardNumber];
+    std::unordered_map<long long, std::unordered_set<long long>> waitX; // 等待图：XID正在等待的事务
+    std::mutex graphLock; // 等待图锁，加锁顺序总是先分片锁后等待图锁
+    std::atomic<int> policy{detect}; // 死锁处理策略
+    std::atomic<long long> waitTimeout{50000}; // 锁等待超时时间（毫秒）
 };
 
 // Entry的缓存
 class VersionManager{
 public:
+    friend class TableManager;
     static std::shared_ptr<VersionManager> instance(); // 获取VersionManager的单例对象
     void init(); // 初始化VersionManager
 
-    char* read(long long xid,long long uid);
+    bool read(long long xid,long long uid,std::vector<char>& data); // 对事务可见时把数据拷贝到data中并返回true；数据在释放页面之前拷出，调用者持有自己的副本
+    void readMany(long long xid,const std::vector<long long>& uids,ReadBatch& result); // 批量读取：按页分组读取，并批量判断可见性，不可见的uid长度为-1
     long long insert(long long xid,std::vector<char>& data);
+    std::vector<long long> bulkInsert(long long xid,std::vector<std::vector<char>>& rows); // 批量插入多条记录，每个新页面只记录一条日志
     bool del(long long xid,long long uid);
     long long begin(int level);
     void commit(long long xid);
     void abort(long long xid);
+    Transaction* getTransaction(long long xid); // 获取活跃事务的对象，供按页读取的模块自行判断可见性
 
     ~VersionManager();
     VersionManager(const VersionManager&) = delete; // 禁用拷贝构造函数
@@ -86,16 +182,27 @@ private:
     void release(long long uid); // 释放一个实体，如果没有其他使用者引用该实体，将其从缓存中移除
     Entry* getForCache(long long uid); // 当键值为key的资源不在缓存中时，资源的获取方式
     void releaseForCache(Entry* entry); // 当资源被逐出缓存时的写入行为
+    bool validate(Transaction* t); // 乐观事务的提交验证（调用时需持有validationLock）
+    void autoAbort(Transaction* t); // 因冲突自动撤销事务，之后上层仍需调用abort
 
     std::unordered_map<long long,Transaction*> activeTransaction; // 活跃的事务
     std::unordered_map<long long,Entry*> cache; // 键值到实体的映射
     std::unordered_map<long long,int> references; // 键值到该实体的引用的个数的映射
     std::unordered_map<long long,bool> getting; // 是否有其他进程正在获取该实体
-    long long maxItemNumber; // 缓存最大可缓存的实体数
+    int memoryConsumer=-1; // 在MemoryGovernor中的使用者编号，每个缓存的实体占用sizeof(Entry)字节
     long long count=0; // 缓存中当前包含的实体个数
 
     std::mutex resourceLock; // 资源访问互斥锁
     std::mutex transactionLock; // 事务操作锁
+
+    // 一个已提交事务的写集
+    struct CommitRecord{
+        long long seq; // 提交序号，事务落盘提交之前为LLONG_MAX
+        std::unordered_set<long long> writeSet;
+    };
+    long long commitSeq=0; // 最近一次提交的序号
+    std::deque<CommitRecord> committedWrites; // 仍可能被活跃的乐观事务验证的提交记录，按登记的顺序排列（不一定按提交序号递增）
+    std::mutex validationLock; // 保护乐观验证与committedWrites，不在持有时写日志
 };
 
 #endif
@@ -0,0 +1,558 @@
+#include "Executor.h"
+
+// 内核：只做一件事的紧凑循环，没有虚函数调用，也尽量没有分支，交给编译器向量化
+// 类型分派在进入内核之前按批完成一次，而不是每行一次
+
+// 按类型取出数值列的数组，交给f
+template<typename F>
+static void numeric(Vector& v,F f){
+    switch(v.type){
+        case Column::int32:f(v.int32s.data());break;
+        case Column::int64:f(v.int64s.data());break;
+        case Column::float64:f(v.float64s.data());break;
+        default:throw "not a numeric value";
+    }
+}
+
+// r[i]=f(a[i],b[i])，先把两边转换为结果类型R
+template<typename R,typename A,typename B,typename F>
+static void binary(const A* a,const B* b,R* r,int n,F f){
+    for(int i=0;i<n;i++)r[i]=f((R)a[i],(R)b[i]);
+}
+
+template<typename R,typename A,typename B>
+static void arithmeticKernel(Expression::ArithmeticOp op,const A* a,const B* b,R* r,int n){
+    switch(op){
+        case Expression::add:binary(a,b,r,n,[](R x,R y){return x+y;});break;
+        case Expression::subtract:binary(a,b,r,n,[](R x,R y){return x-y;});break;
+        case Expression::multiply:binary(a,b,r,n,[](R x,R y){return x*y;});break;
+        default:
+            if constexpr(std::is_floating_point<R>::value){
+                binary(a,b,r,n,[](R x,R y){return x/y;}); // 浮点除法按IEEE 754，除以0得到±inf或NaN
+            }else{
+                // 整数除以0的行结果为0，LLONG_MIN/-1按补码回绕（直接相除会触发SIGFPE），由调用者检查有效行中是否有这两种情况
+                binary(a,b,r,n,[](R x,R y){return y==0?(R)0:y==-1?(R)(0ULL-(unsigned long long)x):x/y;});
+            }
+    }
+}
+
+// 选择满足f的行：dense时遍历0..n-1，否则遍历sel中的n个下标；结果写入out（可以就是sel），返回选中的行数
+// 每行都写out，只有满足条件时才前移，没有分支
+template<typename C,typename A,typename B,typename F>
+static int selectKernel(const A* a,const B* b,const int* sel,int n,bool dense,int* out,F f){
+    int m=0;
+    if(dense){
+        for(int i=0;i<n;i++){
+            out[m]=i;
+            m+=f((C)a[i],(C)b[i]);
+        }
+    }else{
+        for(int k=0;k<n;k++){
+            int i=sel[k];
+            out[m]=i;
+            m+=f((C)a[i],(C)b[i]);
+        }
+    }
+    return m;
+}
+
+template<typename C,typename A,typename B>
+static void compareKernel(Expression::CompareOp op,const A* a,const B* b,DataChunk& chunk){
+    int n=chunk.dense?chunk.count:chunk.selCount;
+    int* sel=chunk.sel.data();
+    int m;
+    switch(op){
+        case Expression::equal:m=selectKernel<C>(a,b,sel,n,chunk.dense,sel,[](const C& x,const C& y){return x==y;});break;
+        case Expression::notEqual:m=selectKernel<C>(a,b,sel,n,chunk.dense,sel,[](const C& x,const C& y){return x!=y;});break;
+        case Expression::less:m=selectKernel<C>(a,b,sel,n,chunk.dense,sel,[](const C& x,const C& y){return x<y;});break;
+        case Expression::lessEqual:m=selectKernel<C>(a,b,sel,n,chunk.dense,sel,[](const C& x,const C& y){return x<=y;});break;
+        case Expression::greater:m=selectKernel<C>(a,b,sel,n,chunk.dense,sel,[](const C& x,const C& y){return x>y;});break;
+        default:m=selectKernel<C>(a,b,sel,n,chunk.dense,sel,[](const C& x,const C& y){return x>=y;});
+    }
+    chunk.selCount=m;
+    chunk.dense=m==chunk.count;
+}
+
+// 无分组的归约：dense时为连续循环
+template<typename R,typename T,typename F>
+static R reduce(const T* a,const int* sel,int n,bool dense,R init,F f){
+    R value=init;
+    if(dense){
+        for(int i=0;i<n;i++)value=f(value,(R)a[i]);
+    }else{
+        for(int k=0;k<n;k++)value=f(value,(R)a[sel[k]]);
+    }
+    return value;
+}
+
+// 分组的归约：第k个有效行累加到state[groups[k]]
+template<typename R,typename T,typename F>
+static void reduceGroups(const T* a,const int* sel,const int* groups,int n,bool dense,R* state,F f){
+    for(int k=0;k<n;k++){
+        int i=dense?k:sel[k];
+        state[groups[k]]=f(state[groups[k]],(R)a[i]);
+    }
+}
+
+static void copyVector(Vector& from,Vector& to,int n){
+    to.reset(from.type,n);
+    switch(from.type){
+        case Column::int32:std::copy(from.int32s.begin(),from.int32s.begin()+n,to.int32s.begin());break;
+        case Column::int64:std::copy(from.int64s.begin(),from.int64s.begin()+n,to.int64s.begin());break;
+        case Column::float64:std::copy(from.float64s.begin(),from.float64s.begin()+n,to.float64s.begin());break;
+        default:std::copy(from.strings.begin(),from.strings.begin()+n,to.strings.begin());
+    }
+}
+
+void Vector::reset(Column::Type type,int count){
+    this->type=type;
+    switch(type){
+        case Column::int32:int32s.resize(count);break;
+        case Column::int64:int64s.resize(count);break;
+        case Column::float64:float64s.resize(count);break;
+        default:strings.resize(count);
+    }
+}
+
+int Vector::size(){
+    switch(type){
+        case Column::int32:return int32s.size();
+        case Column::int64:return int64s.size();
+        case Column::float64:return float64s.size();
+        default:return strings.size();
+    }
+}
+
+void DataChunk::reset(int count){
+    this->count=count;
+    if((int)sel.size()<count)sel.resize(count);
+    selCount=count;
+    dense=true;
+}
+
+// 列引用
+class ColumnExpression:public Expression{
+public:
+    explicit ColumnExpression(int index):index(index){}
+    Vector& evaluate(DataChunk& chunk) override{
+        if(index<0||index>=(int)chunk.columns.size())throw "column index out of range";
+        return chunk.columns[index];
+    }
+    Column::Type typeOf(const std::vector<Column::Type>& input) override{
+        if(index<0||index>=(int)input.size())throw "column index out of range";
+        return input[index];
+    }
+private:
+    int index;
+};
+
+// 常量：按批的行数展开成一列，行数不变时不重新填充
+class ConstantExpression:public Expression{
+public:
+    ConstantExpression(Column::Type type,long long integer,double real,const std::string& text):type(type),integer(integer),real(real),text(text){}
+    Vector& evaluate(DataChunk& chunk) override{
+        if(filled==chunk.count)return result;
+        result.reset(type,chunk.count);
+        switch(type){
+            case Column::int64:std::fill(result.int64s.begin(),result.int64s.end(),integer);break;
+            case Column::float64:std::fill(result.float64s.begin(),result.float64s.end(),real);break;
+            default:std::fill(result.strings.begin(),result.strings.end(),std::string_view(text));
+        }
+        filled=chunk.count;
+        return result;
+    }
+    Column::Type typeOf(const std::vector<Column::Type>& /*input*/) override{
+        return type;
+    }
+private:
+    Column::Type type;
+    long long integer;
+    double real;
+    std::string text;
+    int filled=-1; // 已展开的行数
+};
+
+// 四则运算：两边都是整数时结果为int64，否则为float64
+class ArithmeticExpression:public Expression{
+public:
+    ArithmeticExpression(ArithmeticOp op,std::unique_ptr<Expression> left,std::unique_ptr<Expression> right):op(op),left(std::move(left)),right(std::move(right)){}
+    Vector& evaluate(DataChunk& chunk) override{
+        Vector& l=left->evaluate(chunk);
+        Vector& r=right->evaluate(chunk);
+        int n=chunk.count;
+        Column::Type type=(l.type==Column::float64||r.type==Column::float64)?Column::float64:Column::int64;
+        result.reset(type,n);
+        numeric(l,[&](auto* a){
+            numeric(r,[&](auto* b){
+                if(type==Column::float64)arithmeticKernel(op,a,b,result.float64s.data(),n);
+                else arithmeticKernel(op,a,b,result.int64s.data(),n);
+                if(type==Column::int64&&op==divide)checkDivisor(a,b,chunk);
+            });
+        });
+        return result;
+    }
+    Column::Type typeOf(const std::vector<Column::Type>& input) override{
+        Column::Type l=left->typeOf(input);
+        Column::Type r=right->typeOf(input);
+        if(l==Column::string||r==Column::string)throw "not a numeric value";
+        return (l==Column::float64||r==Column::float64)?Column::float64:Column::int64;
+    }
+private:
+    // 整数除法只对有效行检查除数，被过滤掉的行上的0不算错误；LLONG_MIN/-1的结果超出int64，同样报错
+    template<typename A,typename B>
+    static void checkDivisor(const A* a,const B* b,DataChunk& chunk){
+        bool zero=false,overflow=false;
+        if(chunk.dense){
+            for(int i=0;i<chunk.count;i++){
+                zero|=b[i]==0;
+                overflow|=(long long)a[i]==LLONG_MIN&&(long long)b[i]==-1;
+            }
+        }else{
+            for(int k=0;k<chunk.selCount;k++){
+                int i=chunk.sel[k];
+                zero|=b[i]==0;
+                overflow|=(long long)a[i]==LLONG_MIN&&(long long)b[i]==-1;
+            }
+        }
+        if(zero)throw "division by zero";
+        if(overflow)throw "integer overflow in division";
+    }
+    ArithmeticOp op;
+    std::unique_ptr<Expression> left;
+    std::unique_ptr<Expression> right;
+};
+
+// 比较：数值之间按int64比较，有一边是浮点数时按float64比较；字符串之间按字节序比较
+class CompareExpression:public Expression{
+public:
+    CompareExpression(CompareOp op,std::unique_ptr<Expression> left,std::unique_ptr<Expression> right):op(op),left(std::move(left)),right(std::move(right)){}
+    Vector& evaluate(DataChunk& /*chunk*/) override{
+        throw "predicate has no value";
+    }
+    void select(DataChunk& chunk) override{
+        if(chunk.selCount==0)return;
+        Vector& l=left->evaluate(chunk);
+        Vector& r=right->evaluate(chunk);
+        if(l.type==Column::string||r.type==Column::string){
+            if(l.type!=r.type)throw "cannot compare a string with a number";
+            compareKernel<std::string_view>(op,l.strings.data(),r.strings.data(),chunk);
+            return;
+        }
+        bool real=l.type==Column::float64||r.type==Column::float64;
+        numeric(l,[&](auto* a){
+            numeric(r,[&](auto* b){
+                if(real)compareKernel<double>(op,a,b,chunk);
+                else compareKernel<long long>(op,a,b,chunk);
+            });
+        });
+    }
+    Column::Type typeOf(const std::vector<Column::Type>& /*input*/) override{
+        throw "predicate has no value";
+    }
+private:
+    CompareOp op;
+    std::unique_ptr<Expression> left;
+    std::unique_ptr<Expression> right;
+};
+
+// AND：左边缩小选择向量后，右边只检查剩下的行
+class ConjunctionExpression:public Expression{
+public:
+    ConjunctionExpression(std::unique_ptr<Expression> left,std::unique_ptr<Expression> right):left(std::move(left)),right(std::move(right)){}
+    Vector& evaluate(DataChunk& /*chunk*/) override{
+        throw "predicate has no value";
+    }
+    void select(DataChunk& chunk) override{
+        left->select(chunk);
+        if(chunk.selCount>0)right->select(chunk);
+    }
+    Column::Type typeOf(const std::vector<Column::Type>& /*input*/) override{
+        throw "predicate has no value";
+    }
+private:
+    std::unique_ptr<Expression> left;
+    std::unique_ptr<Expression> right;
+};
+
+std::unique_ptr<Expression> Expression::column(int index){
+    return std::unique_ptr<Expression>(new ColumnExpression(index));
+}
+
+std::unique_ptr<Expression> Expression::constant(long long value){
+    return std::unique_ptr<Expression>(new ConstantExpression(Column::int64,value,0,""));
+}
+
+std::unique_ptr<Expression> Expression::constant(double value){
+    return std::unique_ptr<Expression>(new ConstantExpression(Column::float64,0,value,""));
+}
+
+std::unique_ptr<Expression> Expression::constant(const std::string& value){
+    return std::unique_ptr<Expression>(new ConstantExpression(Column::string,0,0,value));
+}
+
+std::unique_ptr<Expression> Expression::arithmetic(ArithmeticOp op,std::unique_ptr<Expression> left,std::unique_ptr<Expression> right){
+    return std::unique_ptr<Expression>(new ArithmeticExpression(op,std::move(left),std::move(right)));
+}
+
+std::unique_ptr<Expression> Expression::compare(CompareOp op,std::unique_ptr<Expression> left,std::unique_ptr<Expression> right){
+    return std::unique_ptr<Expression>(new CompareExpression(op,std::move(left),std::move(right)));
+}
+
+std::unique_ptr<Expression> Expression::conjunction(std::unique_ptr<Expression> left,std::unique_ptr<Expression> right){
+    return std::unique_ptr<Expression>(new ConjunctionExpression(std::move(left),std::move(right)));
+}
+
+void Expression::select(DataChunk& /*chunk*/){
+    throw "expression is not a predicate";
+}
+
+TableSource::TableSource(long long xid,Table* table,const std::vector<int>& columns,long long first,long long last):xid(xid),table(table),page(first){
+    for(int column:columns){
+        if(column<0||column>=table->getColumnNumber())throw "column index out of range";
+    }
+    batch.reset(table,columns);
+    this->last=last>0?last:PageCache::instance()->getPageNumbers();
+}
+
+bool TableSource::next(DataChunk& chunk){
+    // 输出完已读出的行之后再读下一段页面，上一批的字符串在此之前一直有效
+    while(cursor>=batch.rows){
+        if(page>last)return false;
+        int number=std::min((long long)pagesPerRead,last-page+1);
+        batch.clear();
+        cursor=0;
+        TableManager::instance()->scanPages(xid,table,page,number,batch);
+        page+=number;
+    }
+    int n=std::min((int)DataChunk::vectorSize,batch.rows-cursor);
+    chunk.columns.resize(batch.columns.size());
+    for(int i=0;i<(int)batch.columns.size();i++){
+        Vector& v=chunk.columns[i];
+        Column::Type type=batch.types[i];
+        v.reset(type,n);
+        if(type==Column::string){
+            for(int r=0;r<n;r++)v.strings[r]=batch.get<std::string_view>(i,cursor+r);
+            continue;
+        }
+        int width=Column::widthOf(type);
+        const char* from=batch.values[i].data()+(long long)cursor*width;
+        switch(type){
+            case Column::int32:std::memcpy(v.int32s.data(),from,(long long)n*width);break;
+            case Column::int64:std::memcpy(v.int64s.data(),from,(long long)n*width);break;
+            default:std::memcpy(v.float64s.data(),from,(long long)n*width);
+        }
+    }
+    chunk.reset(n);
+    cursor+=n;
+    return true;
+}
+
+std::vector<Column::Type> TableSource::types(){
+    return batch.types;
+}
+
+Filter::Filter(std::unique_ptr<Operator> child,std::unique_ptr<Expression> predicate):child(std::move(child)),predicate(std::move(predicate)){
+}
+
+bool Filter::next(DataChunk& chunk){
+    while(child->next(chunk)){
+        predicate->select(chunk);
+        if(chunk.selCount>0)return true;
+    }
+    return false;
+}
+
+std::vector<Column::Type> Filter::types(){
+    return child->types();
+}
+
+Project::Project(std::unique_ptr<Operator> child,std::vector<std::unique_ptr<Expression>> expressions):child(std::move(child)),expressions(std::move(expressions)){
+    types(); // 检查表达式的类型
+}
+
+bool Project::next(DataChunk& chunk){
+    if(!child->next(input))return false;
+    chunk.columns.resize(expressions.size());
+    for(int i=0;i<(int)expressions.size();i++){
+        copyVector(expressions[i]->evaluate(input),chunk.columns[i],input.count);
+    }
+    chunk.reset(input.count);
+    if(!input.dense){
+        std::copy(input.sel.begin(),input.sel.begin()+input.selCount,chunk.sel.begin());
+        chunk.selCount=input.selCount;
+        chunk.dense=false;
+    }
+    return true;
+}
+
+std::vector<Column::Type> Project::types(){
+    std::vector<Column::Type> input=child->types();
+    std::vector<Column::Type> output;
+    for(auto& expression:expressions)output.push_back(expression->typeOf(input));
+    return output;
+}
+
+Aggregate::Aggregate(std::unique_ptr<Operator> child,int groupColumn,const std::vector<Spec>& specs):child(std::move(child)),groupColumn(groupColumn){
+    inputTypes=this->child->types();
+    if(groupColumn>=(int)inputTypes.size())throw "column index out of range";
+    if(groupColumn>=0&&inputTypes[groupColumn]==Column::float64)throw "cannot group by a float column";
+    for(const Spec& spec:specs){
+        Accumulator accumulator;
+        accumulator.spec=spec;
+        if(spec.column<0||spec.column>=(int)inputTypes.size()){
+            if(spec.function!=count||spec.column!=-1)throw "column index out of range";
+            accumulator.input=Column::int64;
+        }else{
+            accumulator.input=inputTypes[spec.column];
+            if(spec.function!=count&&accumulator.input==Column::string)throw "not a numeric value";
+        }
+        accumulators.push_back(accumulator);
+    }
+    if(groupColumn<0){
+        // 不分组时只有一个分组，没有输入也输出一行
+        groupNumber=1;
+        grow(1);
+    }
+}
+
+void Aggregate::grow(int groupNumber){
+    for(Accumulator& accumulator:accumulators){
+        long long intInit=0;
+        double floatInit=0;
+        if(accumulator.spec.function==min){
+            intInit=LLONG_MAX;
+            floatInit=HUGE_VAL;
+        }else if(accumulator.spec.function==max){
+            intInit=LLONG_MIN;
+            floatInit=-HUGE_VAL;
+        }
+        accumulator.counts.resize(groupNumber,0);
+        accumulator.ints.resize(groupNumber,intInit);
+        accumulator.floats.resize(groupNumber,floatInit);
+    }
+}
+
+int Aggregate::groupsOf(DataChunk& chunk){
+    int n=chunk.selCount;
+    groups.resize(n);
+    Vector& keys=chunk.columns[groupColumn];
+    for(int k=0;k<n;k++){
+        int i=chunk.dense?k:chunk.sel[k];
+        if(keys.type==Column::string){
+            auto iter=stringGroups.find(std::string(keys.strings[i]));
+            if(iter==stringGroups.end()){
+                iter=stringGroups.insert({std::string(keys.strings[i]),groupNumber++}).first;
+                stringKeys.push_back(iter->first);
+            }
+            groups[k]=iter->second;
+        }else{
+            long long key=keys.type==Column::int32?keys.int32s[i]:keys.int64s[i];
+            auto iter=intGroups.find(key);
+            if(iter==intGroups.end()){
+                iter=intGroups.insert({key,groupNumber++}).first;
+                intKeys.push_back(key);
+            }
+            groups[k]=iter->second;
+        }
+    }
+    grow(groupNumber);
+    return groupNumber;
+}
+
+void Aggregate::consume(DataChunk& chunk){
+    int n=chunk.selCount;
+    if(n==0)return;
+    bool grouped=groupColumn>=0;
+    if(grouped)groupsOf(chunk);
+    const int* sel=chunk.sel.data();
+    for(Accumulator& accumulator:accumulators){
+        if(grouped){
+            for(int k=0;k<n;k++)accumulator.counts[groups[k]]++;
+        }else{
+            accumulator.counts[0]+=n;
+        }
+        Function function=accumulator.spec.function;
+        if(function==count)continue;
+        numeric(chunk.columns[accumulator.spec.column],[&](auto* a){
+            using T=std::remove_const_t<std::remove_pointer_t<decltype(a)>>;
+            bool real=std::is_same<T,double>::value;
+            if(function==average||(real&&function==sum)){
+                auto add=[](double x,double y){return x+y;};
+                if(grouped)reduceGroups(a,sel,groups.data(),n,chunk.dense,accumulator.floats.data(),add);
+                else accumulator.floats[0]=reduce(a,sel,n,chunk.dense,accumulator.floats[0],add);
+            }else if(function==sum){
+                auto add=[](long long x,long long y){return x+y;};
+                if(grouped)reduceGroups(a,sel,groups.data(),n,chunk.dense,accumulator.ints.data(),add);
+                else accumulator.ints[0]=reduce(a,sel,n,chunk.dense,accumulator.ints[0],add);
+            }else if(real){
+                auto least=[](double x,double y){return y<x?y:x;};
+                auto greatest=[](double x,double y){return y>x?y:x;};
+                if(grouped&&function==min)reduceGroups(a,sel,groups.data(),n,chunk.dense,accumulator.floats.data(),least);
+                else if(grouped)reduceGroups(a,sel,groups.data(),n,chunk.dense,accumulator.floats.data(),greatest);
+                else if(function==min)accumulator.floats[0]=reduce(a,sel,n,chunk.dense,accumulator.floats[0],least);
+                else accumulator.floats[0]=reduce(a,sel,n,chunk.dense,accumulator.floats[0],greatest);
+            }else{
+                auto least=[](long long x,long long y){return y<x?y:x;};
+                auto greatest=[](long long x,long long y){return y>x?y:x;};
+                if(grouped&&function==min)reduceGroups(a,sel,groups.data(),n,chunk.dense,accumulator.ints.data(),least);
+                else if(grouped)reduceGroups(a,sel,groups.data(),n,chunk.dense,accumulator.ints.data(),greatest);
+                else if(function==min)accumulator.ints[0]=reduce(a,sel,n,chunk.dense,accumulator.ints[0],least);
+                else accumulator.ints[0]=reduce(a,sel,n,chunk.dense,accumulator.ints[0],greatest);
+            }
+        });
+    }
+}
+
+bool Aggregate::next(DataChunk& chunk){
+    if(!done){
+        DataChunk input;
+        while(child->next(input))consume(input);
+        done=true;
+    }
+    if(emitted>=groupNumber)return false;
+    int n=std::min((int)DataChunk::vectorSize,groupNumber-emitted);
+    std::vector<Column::Type> output=types();
+    chunk.columns.resize(output.size());
+    int c=0;
+    if(groupColumn>=0){
+        Vector& keys=chunk.columns[c++];
+        keys.reset(output[0],n);
+        for(int g=0;g<n;g++){
+            if(output[0]==Column::string)keys.strings[g]=stringKeys[emitted+g];
+            else keys.int64s[g]=intKeys[emitted+g];
+        }
+    }
+    for(Accumulator& accumulator:accumulators){
+        Vector& values=chunk.columns[c];
+        values.reset(output[c],n);
+        c++;
+        for(int g=0;g<n;g++){
+            int group=emitted+g;
+            long long rows=accumulator.counts[group];
+            switch(accumulator.spec.function){
+                case count:values.int64s[g]=rows;break;
+                case average:values.float64s[g]=rows==0?0:accumulator.floats[group]/rows;break;
+                default:
+                    // 没有输入行时最小值和最大值输出0
+                    if(values.type==Column::float64)values.float64s[g]=rows==0?0:accumulator.floats[group];
+                    else values.int64s[g]=rows==0?0:accumulator.ints[group];
+            }
+        }
+    }
+    chunk.reset(n);
+    emitted+=n;
+    return true;
+}
+
+std::vector<Column::Type> Aggregate::types(){
+    std::vector<Column::Type> output;
+    if(groupColumn>=0)output.push_back(inputTypes[groupColumn]==Column::string?Column::string:Column::int64);
+    for(Accumulator& accumulator:accumulators){
+        switch(accumulator.spec.function){
+            case count:output.push_back(Column::int64);break;
+            case average:output.push_back(Column::float64);break;
+            default:output.push_back(accumulator.input==Column::float64?Column::float64:Column::int64);
+        }
+    }
+    return output;
+}
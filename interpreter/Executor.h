@@ -0,0 +1,161 @@
+#ifndef EXECUTOR
+#define EXECUTOR
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <memory>
+#include <unordered_map>
+#include <climits>
+#include <cmath>
+#include <type_traits>
+#include "Table.h"
+
+// 一列值：按类型只使用其中一个数组，定长值连续存放，计算时可以直接被编译器向量化
+// 字符串是string_view，指向数据的来源（TableSource的ColumnBatch、常量或聚合的分组键），只在产生它的批次有效期内有效
+struct Vector{
+    Column::Type type=Column::int64;
+    std::vector<int> int32s;
+    std::vector<long long> int64s;
+    std::vector<double> float64s;
+    std::vector<std::string_view> strings;
+    void reset(Column::Type type,int count); // 设置类型和行数，不保证保留原来的值
+    int size();
+    template<typename T>
+    T* data();
+};
+
+template<>
+inline int* Vector::data<int>(){return int32s.data();}
+template<>
+inline long long* Vector::data<long long>(){return int64s.data();}
+template<>
+inline double* Vector::data<double>(){return float64s.data();}
+template<>
+inline std::string_view* Vector::data<std::string_view>(){return strings.data();}
+
+// 一批行：最多vectorSize行，按列存放
+// sel为选择向量，按升序存放有效行的下标；过滤只缩小选择向量，不移动任何列的数据。dense表示选择了全部行（sel为0..count-1），此时各个内核走不经过sel的连续循环
+struct DataChunk{
+    static const int vectorSize=2048; // 每批最多的行数
+    std::vector<Vector> columns;
+    int count=0; // 行数
+    std::vector<int> sel; // 选择向量
+    int selCount=0; // 有效行数
+    bool dense=true;
+    void reset(int count); // 设置行数并选择全部行
+};
+
+// 表达式：一次计算一批行，结果按行对齐，不看选择向量（无效行也计算，换取没有分支的连续循环）
+// 谓词（比较和AND）不产生值，而是用select缩小批次的选择向量
+// 表达式对象中保存中间结果的缓冲区，同一个表达式树同一时刻只能被一个线程使用
+class Expression{
+public:
+    enum ArithmeticOp{add,subtract,multiply,divide};
+    enum CompareOp{equal,notEqual,less,lessEqual,greater,greaterEqual};
+
+    static std::unique_ptr<Expression> column(int index); // 输入批次的第index列
+    static std::unique_ptr<Expression> constant(long long value);
+    static std::unique_ptr<Expression> constant(double value);
+    static std::unique_ptr<Expression> constant(const std::string& value);
+    static std::unique_ptr<Expression> arithmetic(ArithmeticOp op,std::unique_ptr<Expression> left,std::unique_ptr<Expression> right);
+    static std::unique_ptr<Expression> compare(CompareOp op,std::unique_ptr<Expression> left,std::unique_ptr<Expression> right);
+    static std::unique_ptr<Expression> conjunction(std::unique_ptr<Expression> left,std::unique_ptr<Expression> right); // AND
+
+    virtual ~Expression()=default;
+    virtual Vector& evaluate(DataChunk& chunk)=0; // 计算一批行，返回结果（列引用直接返回输入列，不拷贝）
+    virtual void select(DataChunk& chunk); // 只保留满足谓词的行；不是谓词的表达式抛出异常
+    virtual Column::Type typeOf(const std::vector<Column::Type>& input)=0; // 结果的类型
+protected:
+    Vector result; // 结果缓冲区
+};
+
+// 算子：按批拉取数据，next每次产生一批行，没有更多数据时返回false
+// 一个算子产生的批次在下一次调用它的next之前有效
+class Operator{
+public:
+    virtual ~Operator()=default;
+    virtual bool next(DataChunk& chunk)=0;
+    virtual std::vector<Column::Type> types()=0; // 输出的各列的类型
+};
+
+// 从表中读取行：逐页经TableManager::scanPages读出可见的行，再切成不超过vectorSize行的批次
+// 只扫描[first,last]中的页面，last为0表示扫描到最后一页；并行执行时每个morsel可以各建一个TableSource
+class TableSource:public Operator{
+public:
+    TableSource(long long xid,Table* table,const std::vector<int>& columns,long long first=2,long long last=0);
+    bool next(DataChunk& chunk) override;
+    std::vector<Column::Type> types() override;
+private:
+    long long xid;
+    Table* table;
+    ColumnBatch batch; // 已读出、尚未输出的行
+    int cursor=0; // batch中下一个要输出的行
+    long long page; // 下一个要扫描的页面
+    long long last;
+    static const int pagesPerRead=8; // 每次读取的页面数
+};
+
+// 过滤：用谓词缩小选择向量，跳过没有任何有效行的批次
+class Filter:public Operator{
+public:
+    Filter(std::unique_ptr<Operator> child,std::unique_ptr<Expression> predicate);
+    bool next(DataChunk& chunk) override;
+    std::vector<Column::Type> types() override;
+private:
+    std::unique_ptr<Operator> child;
+    std::unique_ptr<Expression> predicate;
+};
+
+// 投影：对每批输入计算一组表达式，输出的选择向量与输入相同
+class Project:public Operator{
+public:
+    Project(std::unique_ptr<Operator> child,std::vector<std::unique_ptr<Expression>> expressions);
+    bool next(DataChunk& chunk) override;
+    std::vector<Column::Type> types() override;
+private:
+    std::unique_ptr<Operator> child;
+    std::vector<std::unique_ptr<Expression>> expressions;
+    DataChunk input;
+};
+
+// 聚合：第一次调用next时读完全部输入，之后按批输出结果
+// 没有分组列时输出一行；有分组列时每个分组一行，第一列为分组键，顺序为分组第一次出现的顺序
+class Aggregate:public Operator{
+public:
+    enum Function{count,sum,min,max,average};
+    struct Spec{
+        Function function;
+        int column; // 输入列，count可以为-1，表示count(*)
+    };
+    Aggregate(std::unique_ptr<Operator> child,int groupColumn,const std::vector<Spec>& specs); // groupColumn为-1表示不分组
+    bool next(DataChunk& chunk) override;
+    std::vector<Column::Type> types() override;
+private:
+    // 一个聚合在所有分组上的状态，按分组编号存放
+    struct Accumulator{
+        Spec spec;
+        Column::Type input; // 输入列的类型
+        std::vector<long long> counts;
+        std::vector<long long> ints; // 整数的和、最小值或最大值
+        std::vector<double> floats; // 浮点数的和、最小值或最大值，以及平均值的和
+    };
+    void consume(DataChunk& chunk); // 累加一批输入
+    int groupsOf(DataChunk& chunk); // 为每个有效行求出分组编号，写入groups，返回分组总数
+    void grow(int groupNumber); // 为新出现的分组初始化状态
+
+    std::unique_ptr<Operator> child;
+    int groupColumn;
+    std::vector<Accumulator> accumulators;
+    std::vector<Column::Type> inputTypes;
+    std::unordered_map<long long,int> intGroups; // 整数分组键到分组编号
+    std::unordered_map<std::string,int> stringGroups; // 字符串分组键到分组编号
+    std::vector<long long> intKeys; // 按分组编号存放的分组键
+    std::vector<std::string> stringKeys;
+    std::vector<int> groups; // 当前批次每个有效行的分组编号
+    int groupNumber=0;
+    bool done=false; // 是否已读完输入
+    int emitted=0; // 已输出的分组数
+};
+
+#endif
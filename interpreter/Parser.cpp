@@ -0,0 +1,437 @@
+#include "Parser.h"
+
+static bool isLetter(char c){
+    return (c>='a'&&c<='z')||(c>='A'&&c<='Z')||c=='_';
+}
+
+static bool isDigit(char c){
+    return c>='0'&&c<='9';
+}
+
+static bool isSpace(char c){
+    return c==' '||c=='\t'||c=='\n'||c=='\r';
+}
+
+void Lexer::reset(std::string_view sql){
+    this->sql=sql;
+    position=0;
+}
+
+int Lexer::getPosition(){
+    return position;
+}
+
+bool Lexer::equals(std::string_view text,const char* word){
+    int i=0;
+    for(;i<(int)text.size();i++){
+        char c=text[i];
+        if(c>='A'&&c<='Z')c+='a'-'A';
+        if(word[i]!=c)return false; // word较短时在其结尾的'\0'处不相等
+    }
+    return word[i]=='\0';
+}
+
+Token Lexer::next(){
+    int n=sql.size();
+    // 跳过空白和注释
+    while(position<n){
+        if(isSpace(sql[position])){
+            position++;
+        }else if(sql[position]=='-'&&position+1<n&&sql[position+1]=='-'){
+            while(position<n&&sql[position]!='\n')position++;
+        }else{
+            break;
+        }
+    }
+    Token token;
+    token.offset=position;
+    if(position>=n)return token;
+    int start=position;
+    char c=sql[position];
+    if(isLetter(c)){
+        while(position<n&&(isLetter(sql[position])||isDigit(sql[position])))position++;
+        token.type=Token::identifier;
+    }else if(isDigit(c)||(c=='.'&&position+1<n&&isDigit(sql[position+1]))){
+        token.type=Token::integer;
+        while(position<n&&isDigit(sql[position]))position++;
+        if(position<n&&sql[position]=='.'){
+            token.type=Token::real;
+            position++;
+            while(position<n&&isDigit(sql[position]))position++;
+        }
+        if(position<n&&(sql[position]=='e'||sql[position]=='E')){
+            int p=position+1;
+            if(p<n&&(sql[p]=='+'||sql[p]=='-'))p++;
+            if(p<n&&isDigit(sql[p])){
+                token.type=Token::real;
+                position=p;
+                while(position<n&&isDigit(sql[position]))position++;
+            }
+        }
+    }else if(c=='\''){
+        // 字符串常量，两个连续的引号表示一个引号
+        position++;
+        start=position;
+        while(true){
+            if(position>=n){
+                position=start-1; // 指向开始的引号
+                throw "unterminated string literal";
+            }
+            if(sql[position]=='\''){
+                if(position+1<n&&sql[position+1]=='\''){
+                    token.escaped=true;
+                    position+=2;
+                    continue;
+                }
+                break;
+            }
+            position++;
+        }
+        token.type=Token::string;
+        token.text=sql.substr(start,position-start);
+        position++;
+        return token;
+    }else{
+        token.type=Token::symbol;
+        char d=position+1<n?sql[position+1]:'\0';
+        // 在读过它之前检查，出错时position指向这个字符；!只能出现在!=中
+        if(std::string_view("(),;*+-/=<>.").find(c)==std::string_view::npos&&!(c=='!'&&d=='='))throw "unexpected character";
+        position++;
+        // 两个字符的运算符
+        if((c=='<'&&(d=='='||d=='>'))||(c=='>'&&d=='=')||(c=='!'&&d=='='))position++;
+    }
+    token.text=sql.substr(start,position-start);
+    return token;
+}
+
+StatementNode* Parser::parse(std::string_view sql){
+    arena.reset();
+    errorOffset=-1;
+    depth=0;
+    lexer.reset(sql);
+    advance();
+    StatementNode* statement;
+    if(accept("create"))statement=createTable();
+    else if(accept("insert"))statement=insert();
+    else if(accept("select"))statement=select();
+    else if(accept("delete"))statement=del();
+    else if(accept("begin"))statement=begin();
+    else if(accept("commit")){
+        statement=make<StatementNode>();
+        statement->kind=StatementNode::commit;
+    }else if(accept("abort")||accept("rollback")){
+        statement=make<StatementNode>();
+        statement->kind=StatementNode::abort;
+    }else{
+        fail("unknown statement");
+    }
+    accept(";");
+    if(token.type!=Token::end)fail("unexpected token after statement");
+    return statement;
+}
+
+int Parser::getErrorOffset(){
+    return errorOffset;
+}
+
+void Parser::advance(){
+    try{
+        token=lexer.next();
+    }catch(const char* e){
+        errorOffset=lexer.getPosition();
+        throw;
+    }
+}
+
+bool Parser::accept(const char* word){
+    if(token.type==Token::identifier){
+        if(!Lexer::equals(token.text,word))return false;
+    }else if(token.type!=Token::symbol||token.text!=word){
+        return false;
+    }
+    advance();
+    return true;
+}
+
+void Parser::expect(const char* word){
+    if(!accept(word))fail("unexpected token");
+}
+
+std::string_view Parser::identifier(){
+    if(token.type!=Token::identifier)fail("identifier expected");
+    std::string_view text=token.text;
+    advance();
+    return text;
+}
+
+void Parser::fail(const char* message){
+    errorOffset=token.offset;
+    throw message;
+}
+
+StatementNode* Parser::createTable(){
+    expect("table");
+    StatementNode* statement=make<StatementNode>();
+    statement->kind=StatementNode::createTable;
+    statement->table=identifier();
+    expect("(");
+    ColumnNode** tail=&statement->columns;
+    do{
+        ColumnNode* column=make<ColumnNode>();
+        column->name=identifier();
+        column->type=identifier();
+        *tail=column;
+        tail=&column->next;
+        statement->columnCount++;
+    }while(accept(","));
+    expect(")");
+    if(accept("using")){
+        if(accept("pax")){
+            statement->pax=true;
+            statement->compressed=accept("compressed");
+        }else if(!accept("row"))fail("unknown table layout");
+    }
+    return statement;
+}
+
+StatementNode* Parser::insert(){
+    expect("into");
+    StatementNode* statement=make<StatementNode>();
+    statement->kind=StatementNode::insert;
+    statement->table=identifier();
+    expect("values");
+    RowNode** tail=&statement->rows;
+    do{
+        RowNode* row=make<RowNode>();
+        expect("(");
+        ExpressionNode** value=&row->values;
+        do{
+            *value=additive();
+            value=&(*value)->next;
+            row->valueCount++;
+        }while(accept(","));
+        expect(")");
+        *tail=row;
+        tail=&row->next;
+        statement->rowCount++;
+    }while(accept(","));
+    return statement;
+}
+
+StatementNode* Parser::select(){
+    StatementNode* statement=make<StatementNode>();
+    statement->kind=StatementNode::select;
+    if(token.type==Token::symbol&&token.text=="*"){
+        advance();
+        statement->selectList=make<ExpressionNode>();
+        statement->selectList->kind=ExpressionNode::star;
+        statement->selectCount=1;
+    }else{
+        ExpressionNode** tail=&statement->selectList;
+        do{
+            *tail=additive();
+            tail=&(*tail)->next;
+            statement->selectCount++;
+        }while(accept(","));
+    }
+    expect("from");
+    statement->table=identifier();
+    if(accept("where"))statement->where=disjunction();
+    if(accept("group")){
+        expect("by");
+        statement->groupBy=identifier();
+    }
+    return statement;
+}
+
+StatementNode* Parser::del(){
+    expect("from");
+    StatementNode* statement=make<StatementNode>();
+    statement->kind=StatementNode::del;
+    statement->table=identifier();
+    if(accept("where"))statement->where=disjunction();
+    return statement;
+}
+
+StatementNode* Parser::begin(){
+    StatementNode* statement=make<StatementNode>();
+    statement->kind=StatementNode::begin;
+    statement->isolation=Transaction::readCommitted;
+    if(accept("isolation")){
+        expect("level");
+        if(accept("read")){
+            expect("committed");
+        }else if(accept("repeatable")){
+            expect("read");
+            statement->isolation=Transaction::repeatableRead;
+        }else if(accept("optimistic")){
+            statement->isolation=Transaction::optimistic;
+        }else{
+            fail("unknown isolation level");
+        }
+    }
+    return statement;
+}
+
+ExpressionNode* Parser::binary(ExpressionNode::Op op,ExpressionNode* left,ExpressionNode* right){
+    ExpressionNode* node=make<ExpressionNode>();
+    node->kind=ExpressionNode::binary;
+    node->op=op;
+    node->left=left;
+    node->right=right;
+    // 同一优先级的运算符连成的链在这里循环生成，不经过nest，由子树高度限制
+    node->height=std::max(left->height,right->height)+1;
+    if(node->height>maxDepth)fail("expression is too deeply nested");
+    return node;
+}
+
+ExpressionNode* Parser::disjunction(){
+    ExpressionNode* left=conjunction();
+    while(accept("or"))left=binary(ExpressionNode::disjunction,left,conjunction());
+    return left;
+}
+
+ExpressionNode* Parser::conjunction(){
+    ExpressionNode* left=comparison();
+    while(accept("and"))left=binary(ExpressionNode::conjunction,left,comparison());
+    return left;
+}
+
+ExpressionNode* Parser::comparison(){
+    ExpressionNode* left=additive();
+    ExpressionNode::Op op;
+    if(accept("="))op=ExpressionNode::equal;
+    else if(accept("<>")||accept("!="))op=ExpressionNode::notEqual;
+    else if(accept("<="))op=ExpressionNode::lessEqual;
+    else if(accept(">="))op=ExpressionNode::greaterEqual;
+    else if(accept("<"))op=ExpressionNode::less;
+    else if(accept(">"))op=ExpressionNode::greater;
+    else return left;
+    return binary(op,left,additive());
+}
+
+ExpressionNode* Parser::additive(){
+    ExpressionNode* left=multiplicative();
+    while(true){
+        if(accept("+"))left=binary(ExpressionNode::add,left,multiplicative());
+        else if(accept("-"))left=binary(ExpressionNode::subtract,left,multiplicative());
+        else return left;
+    }
+}
+
+ExpressionNode* Parser::multiplicative(){
+    ExpressionNode* left=unary();
+    while(true){
+        if(accept("*"))left=binary(ExpressionNode::multiply,left,unary());
+        else if(accept("/"))left=binary(ExpressionNode::divide,left,unary());
+        else return left;
+    }
+}
+
+void Parser::nest(){
+    if(++depth>maxDepth)fail("expression is too deeply nested");
+}
+
+ExpressionNode* Parser::unary(){
+    if(accept("-")){
+        if(token.type==Token::integer){
+            // 负的整数常量直接折叠，这样最小的整数也能写出来
+            ExpressionNode* node=make<ExpressionNode>();
+            node->kind=ExpressionNode::integer;
+            unsigned long long value;
+            std::from_chars_result result=std::from_chars(token.text.data(),token.text.data()+token.text.size(),value);
+            if(result.ec!=std::errc()||value>(unsigned long long)LLONG_MAX+1)fail("integer literal out of range");
+            node->integerValue=value==(unsigned long long)LLONG_MAX+1?LLONG_MIN:-(long long)value;
+            advance();
+            return node;
+        }
+        nest();
+        ExpressionNode* operand=unary();
+        depth--;
+        if(operand->kind==ExpressionNode::real){
+            operand->realValue=-operand->realValue;
+            return operand;
+        }
+        ExpressionNode* node=make<ExpressionNode>();
+        node->kind=ExpressionNode::negate;
+        node->left=operand;
+        node->height=operand->height+1;
+        return node;
+    }
+    if(accept("+")){
+        nest();
+        ExpressionNode* operand=unary();
+        depth--;
+        return operand;
+    }
+    return primary();
+}
+
+ExpressionNode* Parser::primary(){
+    ExpressionNode* node;
+    if(token.type==Token::integer){
+        node=make<ExpressionNode>();
+        node->kind=ExpressionNode::integer;
+        const char* first=token.text.data();
+        std::from_chars_result result=std::from_chars(first,first+token.text.size(),node->integerValue);
+        if(result.ec!=std::errc())fail("integer literal out of range");
+        advance();
+        return node;
+    }
+    if(token.type==Token::real){
+        node=make<ExpressionNode>();
+        node->kind=ExpressionNode::real;
+        const char* first=token.text.data();
+        std::from_chars_result result=std::from_chars(first,first+token.text.size(),node->realValue);
+        if(result.ec!=std::errc())fail("real literal out of range");
+        advance();
+        return node;
+    }
+    if(token.type==Token::string){
+        node=make<ExpressionNode>();
+        node->kind=ExpressionNode::string;
+        node->text=unescape(token);
+        advance();
+        return node;
+    }
+    if(accept("(")){
+        nest();
+        node=disjunction();
+        depth--;
+        expect(")");
+        return node;
+    }
+    if(token.type!=Token::identifier)fail("expression expected");
+    std::string_view name=identifier();
+    node=make<ExpressionNode>();
+    node->text=name;
+    if(!accept("(")){
+        node->kind=ExpressionNode::column;
+        return node;
+    }
+    // 函数调用（聚合函数），参数为一个表达式或*
+    node->kind=ExpressionNode::call;
+    if(token.type==Token::symbol&&token.text=="*"){
+        advance();
+        node->left=make<ExpressionNode>();
+        node->left->kind=ExpressionNode::star;
+    }else{
+        nest();
+        node->left=disjunction();
+        node->height=node->left->height+1;
+        depth--;
+    }
+    expect(")");
+    return node;
+}
+
+std::string_view Parser::unescape(const Token& token){
+    if(!token.escaped)return token.text;
+    char* buffer=arena.allocate(token.text.size());
+    int length=0;
+    for(int i=0;i<(int)token.text.size();i++){
+        buffer[length++]=token.text[i];
+        if(token.text[i]=='\'')i++; // 跳过转义的第二个引号
+    }
+    return std::string_view(buffer,length);
+}
@@ -0,0 +1,133 @@
+#ifndef PARSER
+#define PARSER
+
+#include <string_view>
+#include <charconv>
+#include <new>
+#include <type_traits>
+#include <climits>
+#include <algorithm>
+#include "Transaction.h"
+
+// 词法单元：text指向请求缓冲区中的原文，不拷贝；字符串常量的text不含两边的引号
+struct Token{
+    enum Type{end,identifier,integer,real,string,symbol};
+    Type type=end;
+    std::string_view text;
+    int offset=0; // 在语句中的偏移
+    bool escaped=false; // 字符串常量中是否有转义的引号（''）
+};
+
+// 词法分析器：按需逐个产生词法单元，不分配内存
+// 标识符和关键字不区分大小写，关键字由语法分析器按原文比较；支持 -- 注释
+class Lexer{
+public:
+    void reset(std::string_view sql);
+    Token next(); // 下一个词法单元，到达末尾时返回end
+    static bool equals(std::string_view text,const char* word); // 忽略大小写比较（word为小写）
+    int getPosition(); // 已读到的位置；词法错误时为出错的字符（未结束的字符串为开始的引号）
+private:
+    std::string_view sql;
+    int position=0;
+};
+
+// AST节点都从语句的区域分配器中分配，只含指针、数值和string_view，不需要析构，整个区域一次丢弃
+// 列表用节点中的next指针串起来
+
+// 表达式
+struct ExpressionNode{
+    enum Kind{column,integer,real,string,star,binary,negate,call};
+    // binary的运算符
+    enum Op{add,subtract,multiply,divide,equal,notEqual,less,lessEqual,greater,greaterEqual,conjunction,disjunction};
+    Kind kind;
+    Op op;
+    std::string_view text; // 列名、字符串常量（已去掉转义）或函数名
+    long long integerValue; // 整数常量
+    double realValue; // 浮点数常量
+    ExpressionNode* left; // binary的左边，negate和call的参数
+    ExpressionNode* right;
+    ExpressionNode* next; // 列表中的下一个表达式
+    int height; // 以该节点为根的子树的高度，叶子为0
+};
+
+// CREATE TABLE中的一列
+struct ColumnNode{
+    std::string_view name;
+    std::string_view type; // 类型名原文，由执行层解释
+    ColumnNode* next;
+};
+
+// INSERT中的一行
+struct RowNode{
+    ExpressionNode* values;
+    int valueCount;
+    RowNode* next;
+};
+
+// 语句
+// CREATE TABLE name (column type, ...) [USING PAX [COMPRESSED]|ROW]
+// INSERT INTO name VALUES (value, ...), ...
+// SELECT * | expression, ... FROM name [WHERE condition] [GROUP BY column]
+// DELETE FROM name [WHERE condition]
+// BEGIN [ISOLATION LEVEL READ COMMITTED | REPEATABLE READ | OPTIMISTIC]，COMMIT，ABORT（或ROLLBACK）
+struct StatementNode{
+    enum Kind{createTable,insert,select,del,begin,commit,abort};
+    Kind kind;
+    std::string_view table;
+    ColumnNode* columns; // createTable
+    int columnCount;
+    bool pax; // createTable：USING PAX
+    bool compressed; // createTable：USING PAX COMPRESSED
+    RowNode* rows; // insert
+    int rowCount;
+    ExpressionNode* selectList; // select，*为一个star节点
+    int selectCount;
+    ExpressionNode* where; // select和del，没有时为nullptr
+    std::string_view groupBy; // select，没有时为空
+    int isolation; // begin：Transaction中的隔离级别
+};
+
+// 递归下降的语法分析器：每条语句的AST从自己的区域分配器中分配，parse时丢弃上一条语句的AST
+// 区域分配器的块在语句之间复用，热身之后分析语句不再向系统申请内存
+class Parser{
+public:
+    StatementNode* parse(std::string_view sql); // 分析一条语句（可以以分号结尾），返回的AST在下一次parse之前有效；语法错误时抛出异常
+    int getErrorOffset(); // 最近一次语法错误的位置
+private:
+    template<typename T>
+    T* make(){
+        static_assert(std::is_trivially_destructible<T>::value,"arena nodes are never destroyed");
+        return new(arena.allocate(sizeof(T))) T{};
+    }
+    void advance(); // 读入下一个词法单元
+    bool accept(const char* word); // 当前词法单元是关键字或符号word时读过它并返回true
+    void expect(const char* word); // 当前词法单元必须是word
+    std::string_view identifier(); // 读一个标识符
+    [[noreturn]] void fail(const char* message);
+    void nest(); // 进入一层嵌套的表达式（括号、函数参数、一元运算符），超过maxDepth层时报错；限制递归下降的深度
+
+    StatementNode* createTable();
+    StatementNode* insert();
+    StatementNode* select();
+    StatementNode* del();
+    StatementNode* begin();
+    // 表达式，按优先级从低到高
+    ExpressionNode* disjunction();
+    ExpressionNode* conjunction();
+    ExpressionNode* comparison();
+    ExpressionNode* additive();
+    ExpressionNode* multiplicative();
+    ExpressionNode* unary();
+    ExpressionNode* primary();
+    ExpressionNode* binary(ExpressionNode::Op op,ExpressionNode* left,ExpressionNode* right);
+    std::string_view unescape(const Token& token); // 去掉字符串常量中的转义，有转义时在区域中拷贝
+
+    Arena arena;
+    Lexer lexer;
+    Token token; // 当前词法单元
+    int errorOffset=-1;
+    int depth=0; // 当前表达式的嵌套层数，每条语句开始时清零
+    static const int maxDepth=256; // 表达式最多的嵌套层数，二元运算的子树高度也受它限制，避免递归下降和之后对AST的递归处理耗尽栈空间
+};
+
+#endif
@@ -0,0 +1,8 @@
+#include <iostream>
+
+using namespace std;
+
+int main(){
+
+    return 0;
+}
\ No newline at end of file